@@ -1,13 +1,16 @@
 #include "bpf_program.h"
 #include "syscall.h"
 
+#include <algorithm>
+#include <cassert>
 #include <cstdio>
 #include <cstdlib>
 #include <vector>
 
 #include <fcntl.h>
-#include <linux/filter.h>
+#include <linux/audit.h>
 #include <stddef.h>
+#include <sys/mman.h>
 #include <sys/prctl.h>
 #include <sys/socket.h>
 
@@ -33,78 +36,178 @@ struct seccomp_data {
 };
 #endif
 
-namespace NOPTrace {
-    void InstallBpfProgram() noexcept {
-        std::vector<struct sock_filter> filter = {
-            BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (offsetof(struct seccomp_data, nr))),
+#ifndef AUDIT_ARCH_X86_64
+    #define AUDIT_ARCH_X86_64 0xc000003e
+#endif
+
+#ifndef AUDIT_ARCH_AARCH64
+    #define AUDIT_ARCH_AARCH64 0xc00000b7
+#endif
 
-// Syscall open exists only at x86_64
 #if defined(__x86_64__)
-            // int open(const char *pathname, int flags);
-            BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_open, 0, 4),
-            BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (offsetof(struct seccomp_data, args[1]))),
-            // trace only open syscalls with O_WRONLY and O_RDWR access modes (flags arg.)
-            BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, O_WRONLY, 1, 0),
-            BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, O_RDWR, 0, 1),
-            BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_TRACE),
+    #define NATIVE_AUDIT_ARCH AUDIT_ARCH_X86_64
+#elif defined(__aarch64__)
+    #define NATIVE_AUDIT_ARCH AUDIT_ARCH_AARCH64
 #endif
 
-            // int openat(int dirfd, const char *pathname, int flags);
-            BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_openat, 0, 4),
-            BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (offsetof(struct seccomp_data, args[2]))),
-            // trace only openat syscalls with O_WRONLY and O_RDWR access modes (flags arg.)
-            BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, O_WRONLY, 1, 0),
-            BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, O_RDWR, 0, 1),
-            BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_TRACE),
-
-            // int fcntl(int fd, int cmd, ... /* arg */ );
-            BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_fcntl, 0, 6),
-            BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (offsetof(struct seccomp_data, args[1]))),
-            // trace only specific set of command
-            BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, F_DUPFD, 3, 0),
-            BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, F_DUPFD_CLOEXEC, 2, 0),
-            BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, F_SETFL, 1, 0),
-            BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, F_SETFD, 0, 1),
-            BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_TRACE),
-        };
+namespace NOPTrace {
+    // Conditional jumps have 8-bit offsets, rules with more conditions are traced unconditionally
+    const size_t MAX_RULE_CONDS = 250;
 
-        const std::vector<unsigned> tracingSyscalls = {
-#if defined(__x86_64__) // these exist only at x86 arch
-            SYS_creat,
-            SYS_dup2,
-#endif
-            SYS_write,
-            SYS_writev,
-            SYS_pwritev,
-            SYS_pwrite64,
-            SYS_pwritev2,
-            SYS_close,
-            SYS_dup,
-            SYS_dup3,
-            SYS_fallocate,
-            SYS_ftruncate,
-            SYS_lseek,
+    // Only open syscalls with O_WRONLY and O_RDWR access modes are traced
+    TSyscallRule GetOpenRule(const TSyscallInfo& info) noexcept {
+        if (info.Flags >= 0) {
+            return {info.Nr, info.Flags, O_WRONLY | O_RDWR};
+        }
+        return {info.Nr};
+    }
+
+    std::vector<TSyscallRule> GetTracingRules(bool skipDeferrable) noexcept {
+        std::vector<TSyscallRule> rules;
+
+        for (const auto& info : SyscallTable) {
+            if (skipDeferrable && IsDeferrableSyscall(info.Class)) {
+                continue;
+            }
+            switch (info.Class) {
+                case ESyscallClass::None:
+                    break;
+                case ESyscallClass::Open:
+                    rules.push_back(GetOpenRule(info));
+                    break;
+                case ESyscallClass::Mmap:
+                    // Only shared writable mappings can write to a file, protection is the argument next to length
+                    rules.push_back({info.Nr, info.Flags, MAP_SHARED, {}, info.Length + 1, PROT_WRITE});
+                    break;
+                case ESyscallClass::Fcntl:
+                    rules.push_back({info.Nr, info.Fd + 1, 0, {F_DUPFD, F_DUPFD_CLOEXEC, F_SETFL, F_SETFD}});
+                    break;
+                default:
+                    rules.push_back({info.Nr});
+                    break;
+            }
+        }
+        return rules;
+    }
+
+    std::vector<TSyscallRule> GetOpenRules() noexcept {
+        std::vector<TSyscallRule> rules;
+        for (const auto& info : SyscallTable) {
+            if (info.Class == ESyscallClass::Open) {
+                rules.push_back(GetOpenRule(info));
+            }
+        }
+        return rules;
+    }
+
+    // BPF jumps are forward only and offsets of conditional ones are limited by 8 bits
+    void AppendJump(TBpfProgram& prog, unsigned short code, unsigned k, size_t jt, size_t jf) noexcept {
+        assert(jt <= 255 && jf <= 255);
+        prog.push_back(BPF_JUMP(code, k, (unsigned char)jt, (unsigned char)jf));
+    }
+
+    unsigned GetArgOffset(int arg) noexcept {
+        return offsetof(struct seccomp_data, args) + arg * sizeof(__u64);
+    }
+
+    // Expects syscall number in the accumulator
+    TBpfProgram CompileRule(const TSyscallRule& rule) noexcept {
+        const size_t conds = (rule.Mask ? 1 : 0) + rule.Values.size();
+        const bool checkArg = rule.Arg >= 0 && conds && conds <= MAX_RULE_CONDS;
+        const bool checkRequired = rule.RequiredArg >= 0;
+
+        // Conditions between the syscall number check and the returns, a failed one jumps to SECCOMP_RET_ALLOW
+        TBpfProgram body;
+        if (checkRequired) {
+            body.push_back(BPF_STMT(BPF_LD | BPF_W | BPF_ABS, GetArgOffset(rule.RequiredArg)));
+            // Satisfied condition goes on to the argument check if there is one
+            AppendJump(body, BPF_JMP | BPF_JSET | BPF_K, rule.RequiredMask, 0, checkArg ? conds + 2 : 1);
+        }
+        if (checkArg) {
+            body.push_back(BPF_STMT(BPF_LD | BPF_W | BPF_ABS, GetArgOffset(rule.Arg)));
+
+            // Any satisfied condition jumps to SECCOMP_RET_TRACE, the last failed one - to SECCOMP_RET_ALLOW
+            size_t i = 0;
+            if (rule.Mask) {
+                AppendJump(body, BPF_JMP | BPF_JSET | BPF_K, rule.Mask, conds - 1 - i, i == conds - 1 ? 1 : 0);
+                i++;
+            }
+            for (auto value : rule.Values) {
+                AppendJump(body, BPF_JMP | BPF_JEQ | BPF_K, value, conds - 1 - i, i == conds - 1 ? 1 : 0);
+                i++;
+            }
+        }
+
+        TBpfProgram prog;
+        AppendJump(prog, BPF_JMP | BPF_JEQ | BPF_K, rule.Nr, 0, body.size() + 1);
+        prog.insert(prog.end(), body.begin(), body.end());
+        prog.push_back(BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_TRACE));
+        prog.push_back(BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW));
+        return prog;
+    }
+
+    // Balanced binary search over rules sorted by syscall number
+    TBpfProgram CompileTree(const std::vector<TSyscallRule>& rules, size_t begin, size_t end) noexcept {
+        if (end - begin == 1) {
+            return CompileRule(rules[begin]);
+        }
+
+        const size_t mid = begin + (end - begin) / 2;
+        TBpfProgram left = CompileTree(rules, begin, mid);
+        TBpfProgram right = CompileTree(rules, mid, end);
+
+        TBpfProgram prog;
+        if (left.size() <= 255) {
+            AppendJump(prog, BPF_JMP | BPF_JGE | BPF_K, rules[mid].Nr, left.size(), 0);
+        } else {
+            // Left subtree is too long for a conditional jump, so it's skipped by an unconditional one
+            AppendJump(prog, BPF_JMP | BPF_JGE | BPF_K, rules[mid].Nr, 0, 1);
+            prog.push_back(BPF_STMT(BPF_JMP | BPF_JA, (unsigned)left.size()));
+        }
+        prog.insert(prog.end(), left.begin(), left.end());
+        prog.insert(prog.end(), right.begin(), right.end());
+        return prog;
+    }
+
+    TBpfProgram CompileBpfProgram(std::vector<TSyscallRule> rules) noexcept {
+        std::sort(rules.begin(), rules.end(), [](const TSyscallRule& r1, const TSyscallRule& r2) {
+            return r1.Nr < r2.Nr;
+        });
+
+        TBpfProgram prog = {
+            // Syscall numbers of other arches (i386 or x32 ABI on x86_64) are meaningless for the tracer
+            BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (offsetof(struct seccomp_data, arch))),
+            BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, NATIVE_AUDIT_ARCH, 1, 0),
+            BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW),
+            BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (offsetof(struct seccomp_data, nr))),
         };
 
-        for (auto syscall : tracingSyscalls) {
-            filter.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, syscall, 0, 1));
-            filter.push_back(BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_TRACE));
+        if (rules.empty()) {
+            prog.push_back(BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW));
+            return prog;
         }
-        // Allow all other syscalls
-        filter.push_back(BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW));
 
+        TBpfProgram tree = CompileTree(rules, 0, rules.size());
+        prog.insert(prog.end(), tree.begin(), tree.end());
+        if (prog.size() > BPF_MAXINSNS) {
+            return {};
+        }
+        return prog;
+    }
+
+    void InstallBpfProgram(const TBpfProgram& filter) noexcept {
         struct sock_fprog prog;
-        prog.filter = &filter.front();
+        prog.filter = const_cast<struct sock_filter*>(filter.data());
         prog.len = (unsigned short)filter.size();
 
         if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) == -1) {
             perror("prctl(PR_SET_NO_NEW_PRIVS, 1, ...) failed:");
-            exit(2);
+            _exit(2);
         }
 
         if (prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog) == -1) {
             perror("prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, ...) failed:");
-            exit(2);
+            _exit(2);
         }
     }
 }
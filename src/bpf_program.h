@@ -1,5 +1,30 @@
 #pragma once
 
+#include <vector>
+
+#include <linux/filter.h>
+
 namespace NOPTrace {
-    void InstallBpfProgram() noexcept;
+    // Syscall is traced if it has no predicate or if lower 32 bits of the argument Arg
+    // have any bit of Mask set or are equal to one of Values.
+    // If RequiredArg is given, lower 32 bits of it must also have any bit of RequiredMask set.
+    struct TSyscallRule {
+        unsigned Nr;
+        int Arg = -1;
+        unsigned Mask = 0;
+        std::vector<unsigned> Values = {};
+        int RequiredArg = -1;
+        unsigned RequiredMask = 0;
+    };
+
+    using TBpfProgram = std::vector<struct sock_filter>;
+
+    // Deferrable syscalls are left out when they are accounted by other means
+    std::vector<TSyscallRule> GetTracingRules(bool skipDeferrable = false) noexcept;
+    // Write-mode opens only, for engines which account everything else by events
+    std::vector<TSyscallRule> GetOpenRules() noexcept;
+    // Empty if the program exceeds the kernel limit on its length
+    TBpfProgram CompileBpfProgram(std::vector<TSyscallRule> rules) noexcept;
+    // Called by the forked tracee before exec, it exits if the filter can't be installed
+    void InstallBpfProgram(const TBpfProgram& filter) noexcept;
 }
@@ -0,0 +1,84 @@
+#include "cgroup.h"
+#include "utils.h"
+
+#include <sstream>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace NOPTrace {
+    namespace {
+        std::string GetCgroup2Mount() {
+            for (const auto& mount : ReadMountInfo(getpid())) {
+                if (mount.FsType == "cgroup2") {
+                    return mount.MountPoint;
+                }
+            }
+            return "";
+        }
+
+        void ListProcesses(const std::string& dir, std::vector<pid_t>& pids) {
+            std::stringstream content(ReadFileSafe(dir + "/cgroup.procs"));
+            pid_t pid;
+            while (content >> pid) {
+                pids.push_back(pid);
+            }
+
+            DIR* dp = opendir(dir.c_str());
+            if (!dp) {
+                return;
+            }
+            std::vector<std::string> children;
+            while (struct dirent* entry = readdir(dp)) {
+                if (entry->d_type == DT_DIR && entry->d_name[0] != '.') {
+                    children.push_back(dir + "/" + entry->d_name);
+                }
+            }
+            closedir(dp);
+
+            for (const auto& child : children) {
+                ListProcesses(child, pids);
+            }
+        }
+    }
+
+    std::string ResolveCgroupDir(const std::string& path) noexcept {
+        const std::string mount = GetCgroup2Mount();
+        if (mount.empty()) {
+            return "";
+        }
+
+        std::string dir = JoinPath(GetCwd(), path);
+        if (dir != mount && dir.compare(0, mount.size() + 1, mount + "/")) {
+            dir = JoinPath(mount, "." + JoinPath("/", path));
+        }
+
+        struct stat st;
+        if (stat((dir + "/cgroup.procs").c_str(), &st) < 0) {
+            return "";
+        }
+        return dir;
+    }
+
+    std::vector<pid_t> ListCgroupProcesses(const std::string& dir) noexcept {
+        std::vector<pid_t> pids;
+        ListProcesses(dir, pids);
+        return pids;
+    }
+
+    std::string GetProcessCgroup(pid_t pid) noexcept {
+        std::stringstream ss;
+        ss << "/proc/" << pid << "/cgroup";
+        std::stringstream content(ReadFileSafe(ss.str()));
+
+        // Unified hierarchy has the zero id and no controllers: 0::PATH
+        std::string line;
+        while (std::getline(content, line)) {
+            if (!line.compare(0, 3, "0::")) {
+                return line.substr(3);
+            }
+        }
+        return "";
+    }
+}
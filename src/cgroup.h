@@ -0,0 +1,16 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+namespace NOPTrace {
+    // Directory of the cgroup v2 path, which is either absolute or relative to the hierarchy root.
+    // Empty string if there is no such cgroup.
+    std::string ResolveCgroupDir(const std::string& path) noexcept;
+    // Processes of the cgroup and all its descendants
+    std::vector<pid_t> ListCgroupProcesses(const std::string& dir) noexcept;
+    // Path relative to the hierarchy root as in /proc/<pid>/cgroup
+    std::string GetProcessCgroup(pid_t pid) noexcept;
+}
@@ -0,0 +1,443 @@
+#include "sink.h"
+#include "storage.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <getopt.h>
+#include <poll.h>
+#include <unistd.h>
+
+namespace {
+    using namespace NOPTrace;
+
+    // Finished sessions kept for queries, the oldest ones are dropped first
+    const size_t MAX_FINISHED_SESSIONS = 1024;
+    // Records are small, a longer one is truncated and dropped
+    const size_t MAX_RECORD_SIZE = 1 << 16;
+
+    volatile sig_atomic_t Stopped = 0;
+
+    void Stop(int) {
+        Stopped = 1;
+    }
+
+    struct TWriter {
+        TProcInfoPtr ProcInfo;
+        size_t Output = 0;
+    };
+
+    struct TSession {
+        TSession(uint64_t id, long topSize)
+            : Id(id)
+            , Files(topSize, false)
+        {
+        }
+
+        uint64_t Id;
+        pid_t Pid = 0;
+        std::string CommandLine;
+        // Largest files of the session and its totals by cgroups and mounts
+        TFileStorage Files;
+        // Writers by pid and command line, a pid may be reused within the session
+        std::map<std::pair<pid_t, std::string>, TWriter> Writers;
+        size_t FileCount = 0;
+        // Totals record is received, the session is lost if it has disconnected without one
+        bool Finished = false;
+        bool Connected = true;
+    };
+
+    // Sessions of the host by id, sessions are streamed over seqpacket connections
+    class TCollector {
+    public:
+        TCollector(int listenFd, long topSize) noexcept
+            : ListenFd(listenFd)
+            , TopSize(topSize)
+        {
+        }
+
+        void Run() noexcept;
+
+    private:
+        void Accept() noexcept;
+        // false if the connection has to be closed
+        bool Receive(int fd) noexcept;
+        void Disconnect(int fd) noexcept;
+        void AddFile(TSession& session, const TReportFile& file) noexcept;
+        void Reply(int fd, uint64_t limit, uint64_t sessionId) const noexcept;
+        void Print(std::ostream& stream, size_t limit, const std::vector<const TSession*>& sessions) const noexcept;
+
+    private:
+        int ListenFd;
+        long TopSize;
+        uint64_t LastId = 0;
+        // Session id by connection, 0 until the session record comes
+        std::map<int, uint64_t> Clients;
+        std::map<uint64_t, TSession> Sessions;
+        std::deque<uint64_t> Finished;
+    };
+
+    void TCollector::Run() noexcept {
+        std::vector<struct pollfd> fds;
+        while (!Stopped) {
+            fds.clear();
+            fds.push_back({ListenFd, POLLIN, 0});
+            for (const auto& it : Clients) {
+                fds.push_back({it.first, POLLIN, 0});
+            }
+
+            if (poll(fds.data(), fds.size(), -1) < 0) {
+                if (errno != EINTR) {
+                    std::cerr << "poll failed: " << strerror(errno) << std::endl;
+                    return;
+                }
+                continue;
+            }
+
+            for (const auto& pfd : fds) {
+                if (!pfd.revents) {
+                    continue;
+                }
+                if (pfd.fd == ListenFd) {
+                    Accept();
+                } else if (!Receive(pfd.fd)) {
+                    Disconnect(pfd.fd);
+                }
+            }
+        }
+    }
+
+    void TCollector::Accept() noexcept {
+        int fd = accept4(ListenFd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd >= 0) {
+            Clients.emplace(fd, 0);
+        }
+    }
+
+    bool TCollector::Receive(int fd) noexcept {
+        static char buf[MAX_RECORD_SIZE];
+        const ssize_t len = recv(fd, buf, sizeof(buf), 0);
+        if (len <= 0) {
+            return false;
+        }
+
+        TSinkReader reader(buf, std::min<size_t>(len, sizeof(buf)));
+        ESinkRecord type;
+        if (!reader.Get(type)) {
+            return true;
+        }
+
+        uint64_t& sessionId = Clients[fd];
+        auto session = Sessions.find(sessionId);
+
+        switch (type) {
+            case ESinkRecord::Session: {
+                uint64_t pid;
+                std::string cmd;
+                if (sessionId || !reader.Get(pid) || !reader.Get(cmd)) {
+                    return false;
+                }
+                sessionId = ++LastId;
+                TSession& added = Sessions.emplace(sessionId, TSession(sessionId, TopSize)).first->second;
+                added.Pid = pid;
+                added.CommandLine = cmd;
+                return true;
+            }
+            case ESinkRecord::File: {
+                TReportFile file;
+                if (session != Sessions.end() && GetReportFile(reader, file)) {
+                    AddFile(session->second, file);
+                }
+                return true;
+            }
+            case ESinkRecord::Totals:
+                if (session != Sessions.end()) {
+                    session->second.Finished = true;
+                }
+                return true;
+            case ESinkRecord::Query: {
+                uint64_t limit, querySession;
+                if (!sessionId && reader.Get(limit) && reader.Get(querySession)) {
+                    Reply(fd, limit, querySession);
+                }
+                // The reader gets the end of the report as EOF
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void TCollector::Disconnect(int fd) noexcept {
+        auto client = Clients.find(fd);
+        auto session = Sessions.find(client->second);
+        if (session != Sessions.end()) {
+            session->second.Connected = false;
+            Finished.push_back(session->first);
+        }
+        close(fd);
+        Clients.erase(client);
+
+        while (Finished.size() > MAX_FINISHED_SESSIONS) {
+            Sessions.erase(Finished.front());
+            Finished.pop_front();
+        }
+    }
+
+    void TCollector::AddFile(TSession& session, const TReportFile& file) noexcept {
+        auto& writer = session.Writers[{file.Pid, file.CommandLine}];
+        if (!writer.ProcInfo) {
+            writer.ProcInfo = std::make_shared<const TProcInfo>(file.Pid, file.Ppid, "", file.CommandLine, file.Cgroup);
+        }
+        writer.Output += file.Size;
+
+        auto output = std::make_shared<TOutputFile>(file.Filename, file.Size, writer.ProcInfo);
+        output->Estimated = file.Estimated;
+        if (!file.MountPoint.empty()) {
+            output->Mount = std::make_shared<const TMountInfo>(TMountInfo{0, file.MountPoint, ""});
+        }
+        session.Files.AddFileEntry(output);
+        session.FileCount++;
+    }
+
+    void TCollector::Reply(int fd, uint64_t limit, uint64_t sessionId) const noexcept {
+        std::vector<const TSession*> sessions;
+        for (const auto& it : Sessions) {
+            if (!sessionId || it.first == sessionId) {
+                sessions.push_back(&it.second);
+            }
+        }
+
+        std::stringstream stream;
+        if (sessions.empty()) {
+            stream << "No session " << sessionId << std::endl;
+        } else {
+            Print(stream, limit ? limit : TopSize, sessions);
+        }
+
+        // Every send is a message, so the report is split into records of the reader's buffer size
+        const std::string report = stream.str();
+        for (size_t pos = 0; pos < report.size(); pos += MAX_RECORD_SIZE) {
+            const size_t size = std::min(MAX_RECORD_SIZE, report.size() - pos);
+            if (send(fd, report.data() + pos, size, MSG_NOSIGNAL) < 0) {
+                return;
+            }
+        }
+    }
+
+    void TCollector::Print(std::ostream& stream, size_t limit, const std::vector<const TSession*>& sessions) const noexcept {
+        struct TEntry {
+            const TSession* Session;
+            size_t Size;
+            TProcInfoPtr ProcInfo;
+            std::string Filename;
+        };
+        auto bySize = [](const TEntry& a, const TEntry& b) {
+            return a.Size > b.Size;
+        };
+
+        std::vector<TEntry> writers;
+        std::vector<TEntry> files;
+        std::map<std::string, size_t> cgroups;
+        std::map<std::string, TMountOutput> mounts;
+        size_t total = 0;
+
+        const int padding = 14;
+        stream << "Sessions:" << std::endl;
+        for (const auto session : sessions) {
+            const size_t output = session->Files.GetOutputSize();
+            stream << std::setw(padding) << output << "b #" << session->Id << " (pid:" << session->Pid << ", files: "
+                   << session->FileCount << ", " << (session->Finished ? "finished" : session->Connected ? "running" : "lost")
+                   << ") " << session->CommandLine << std::endl;
+
+            for (const auto& it : session->Writers) {
+                writers.push_back({session, it.second.Output, it.second.ProcInfo, ""});
+            }
+            // Every session keeps as many largest files as the whole host needs
+            for (const auto& file : session->Files.GetLargestFiles()) {
+                files.push_back({session, file->Size, file->ProcInfo, file->Filename});
+            }
+            for (const auto& it : session->Files.GetCgroupOutputSizes()) {
+                cgroups[it.first] += it.second;
+            }
+            for (const auto& it : session->Files.GetMountOutputs()) {
+                auto& mount = mounts[it.first];
+                mount.Size += it.second.Size;
+                mount.Files += it.second.Files;
+            }
+            total += output;
+        }
+
+        std::stable_sort(writers.begin(), writers.end(), bySize);
+        std::stable_sort(files.begin(), files.end(), bySize);
+        writers.resize(std::min(writers.size(), limit));
+        files.resize(std::min(files.size(), limit));
+
+        if (!writers.empty()) {
+            stream << "Top writers:" << std::endl;
+            for (const auto& entry : writers) {
+                stream << std::setw(padding) << entry.Size << "b #" << entry.Session->Id << " (pid:" << entry.ProcInfo->Pid
+                       << ", ppid:" << entry.ProcInfo->Ppid << ") " << entry.ProcInfo->CommandLine << std::endl;
+            }
+        }
+        if (!files.empty()) {
+            stream << "Top files:" << std::endl;
+            for (const auto& entry : files) {
+                stream << std::setw(padding) << entry.Size << "b " << entry.Filename << " (#" << entry.Session->Id
+                       << ", pid:" << entry.ProcInfo->Pid << ")" << std::endl;
+            }
+        }
+        if (!cgroups.empty()) {
+            stream << "Cgroup totals:" << std::endl;
+            for (const auto& it : cgroups) {
+                stream << std::setw(padding) << it.second << "b " << it.first << std::endl;
+            }
+        }
+        if (!mounts.empty()) {
+            stream << "Mount totals:" << std::endl;
+            for (const auto& it : mounts) {
+                stream << std::setw(padding) << it.second.Size << "b " << it.first << " (files: " << it.second.Files << ")" << std::endl;
+            }
+        }
+        stream << "Total output: " << total << "b" << std::endl;
+    }
+
+    int Listen(const std::string& address) {
+        struct sockaddr_un addr;
+        socklen_t len;
+        if (!ParseSinkAddress(address, addr, len)) {
+            std::cerr << "Invalid sink: " << address << std::endl;
+            exit(2);
+        }
+
+        int fd = ConnectSink(address);
+        if (fd >= 0) {
+            std::cerr << "Collector is already running at " << address << std::endl;
+            exit(2);
+        }
+        // Socket of a collector which is gone
+        if (addr.sun_path[0]) {
+            unlink(addr.sun_path);
+        }
+
+        fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if (fd < 0 || bind(fd, (struct sockaddr*)&addr, len) < 0 || listen(fd, SOMAXCONN) < 0) {
+            std::cerr << "Failed to listen at " << address << ": " << strerror(errno) << std::endl;
+            exit(2);
+        }
+        return fd;
+    }
+
+    int Query(const std::string& address, uint64_t limit, uint64_t sessionId) {
+        int fd = ConnectSink(address);
+        if (fd < 0) {
+            std::cerr << "Failed to connect to " << address << ": " << strerror(errno) << std::endl;
+            return 1;
+        }
+
+        TSinkWriter query(ESinkRecord::Query);
+        query.Put(limit);
+        query.Put(sessionId);
+        const std::string& data = query.GetData();
+        if (send(fd, data.data(), data.size(), MSG_NOSIGNAL) < 0) {
+            std::cerr << "Failed to send the query: " << strerror(errno) << std::endl;
+            close(fd);
+            return 1;
+        }
+
+        static char buf[MAX_RECORD_SIZE];
+        ssize_t len;
+        while ((len = recv(fd, buf, sizeof(buf), 0)) > 0) {
+            std::cout.write(buf, len);
+        }
+        close(fd);
+        return 0;
+    }
+
+    void printHelp() {
+        std::cout << "Usage: optrace-collector [-s ADDR] [-n VAL]\n"
+                  << "       optrace-collector -q [-s ADDR] [-n VAL] [-S ID]\n\n"
+                  << "Collects files and totals streamed by optrace -k sessions of the host\n\n"
+                  << "  -s|--sink ADDR           unix:PATH or unix:@NAME to listen at (default: unix:/run/optrace.sock)\n"
+                  << "  -n|--top VAL             number of writers and files to keep and print (default: 20)\n"
+                  << "  -q|--query               print sessions, top writers and files of the running collector\n"
+                  << "  -S|--session ID          print only the session ID\n";
+    }
+}
+
+int main(int argc, char* argv[]) {
+    std::string address = "unix:/run/optrace.sock";
+    long topSize = 20;
+    bool query = false;
+    uint64_t sessionId = 0;
+
+    const char* const short_cli_options = "s:n:qS:";
+    const struct option cli_options[] = {
+        {"sink",    required_argument,  0, 's'},
+        {"top",     required_argument,  0, 'n'},
+        {"query",   no_argument,        0, 'q'},
+        {"session", required_argument,  0, 'S'},
+        {"help",    no_argument,        0, 0},
+        {0, 0, 0, 0}
+    };
+
+    int c = 0;
+    while (c != -1) {
+        c = getopt_long(argc, argv, short_cli_options, cli_options, nullptr);
+        switch(c) {
+            case 0:
+                printHelp();
+                return 0;
+            case 's':
+                address = optarg;
+                break;
+            case 'n':
+                topSize = atol(optarg);
+                if (topSize <= 0) {
+                    std::cerr << "Invalid top size: " << optarg << std::endl;
+                    return 2;
+                }
+                break;
+            case 'q':
+                query = true;
+                break;
+            case 'S':
+                sessionId = strtoull(optarg, nullptr, 10);
+                break;
+            case -1:
+                break;
+            default:
+                printHelp();
+                return 2;
+        }
+    }
+
+    if (query) {
+        return Query(address, topSize, sessionId);
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = Stop;
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+
+    const int fd = Listen(address);
+    TCollector(fd, topSize).Run();
+
+    close(fd);
+    struct sockaddr_un addr;
+    socklen_t len;
+    if (ParseSinkAddress(address, addr, len) && addr.sun_path[0]) {
+        unlink(addr.sun_path);
+    }
+    return 0;
+}
@@ -1,9 +1,11 @@
 #include "context.h"
 
+#include "cgroup.h"
 #include "cores.h"
 #include "syscall.h"
 #include "utils.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cerrno>
 #include <cmath>
@@ -15,98 +17,144 @@
 
 #include <sched.h>
 #include <fcntl.h>
-#include <fnmatch.h>
+#include <linux/limits.h>
 #include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// Support ubuntu-10
+#ifndef RWF_APPEND
+    #define RWF_APPEND 0x00000010
+#endif
+
+#ifndef IORING_ENTER_REGISTERED_RING
+    #define IORING_ENTER_REGISTERED_RING (1U << 4)
+#endif
+
+#ifndef CLOSE_RANGE_CLOEXEC
+    #define CLOSE_RANGE_CLOEXEC (1U << 2)
+#endif
 
 namespace NOPTrace {
-    void TContext::RegisterTracee(pid_t pid) noexcept {
-        assert(ProcMap.find(pid) == ProcMap.end());
+    // Bounds of the output between free space checks of a filesystem
+    const size_t MIN_FREE_CHECK_MIN = 64 << 10;
+    const size_t MIN_FREE_CHECK_MAX = 64 << 20;
+
+    namespace {
+        // Files accounted by size growth are shared, the growth is accounted once at the last close then
+        TFileStatePtr CopyFileState(const TFileStatePtr& file) {
+            if (file->IsSizeDelta()) {
+                return file;
+            }
+            return std::make_shared<TFileState>(*file);
+        }
 
+        TReportFile MakeReportFile(const TOutputFile& output) {
+            return {
+                output.Filename,
+                output.Size,
+                output.Estimated,
+                output.ProcInfo->Pid,
+                output.ProcInfo->Ppid,
+                output.ProcInfo->CommandLine,
+                output.ProcInfo->Cgroup,
+                output.Mount ? output.Mount->MountPoint : "",
+            };
+        }
+    }
+
+    void TContext::RegisterTracee(pid_t pid) noexcept {
         auto proc = NewProcState(pid, 0);
-        ProcMap[pid] = proc;
-        GroupLeaders.emplace(pid);
+        proc->Cwd = GetCwd();
+        SetProcState(pid, proc, true);
+
+        FillFds(proc.get(), true);
+    }
+
+    void TContext::RegisterAttached(pid_t pid, pid_t ppid) noexcept {
+        auto proc = NewProcState(pid, ppid);
+        std::stringstream ss;
+        ss << "/proc/" << pid << "/cwd";
+        proc->Cwd = ReadLinkSafe(ss.str());
+        SetProcState(pid, proc, true);
 
-        FillFds(proc.get());
+        FillFds(proc.get(), false);
     }
 
     void TContext::RegisterExec(pid_t pid, pid_t /*execpid*/) noexcept {
         auto oldproc = GetProcState(pid);
         auto newproc = NewProcState(pid, oldproc->ProcInfo->Ppid);
+        newproc->Cwd = oldproc->Cwd;
 
-        // Drop empty and file descriptors with O_CLOEXEC flag
-        const int highestFd = GetHighestFd(oldproc->Fds, true);
-        if (highestFd >= 0) {
-            auto& newfds = newproc->Fds;
-            auto& oldfds = oldproc->Fds;
-
-            newfds.resize(highestFd + 1);
-            for (int i = 0; i <= highestFd; i++) {
-                if (oldfds[i] && !oldfds[i]->IsCloexecSet()) {
-                    newfds[i] = std::make_shared<TFileState>(*oldfds[i]);
-                }
+        // Drop file descriptors with O_CLOEXEC flag
+        oldproc->Fds.ForEach([&](size_t fd, TFileStatePtr& file) {
+            if (!file->IsCloexecSet()) {
+                newproc->Fds.Set(fd, CopyFileState(file));
             }
-        }
+        });
 
         VanishProcess(pid);
 
-        GroupLeaders.emplace(pid);
-        ProcMap[pid] = newproc;
+        SetProcState(pid, newproc, true);
+
+        if (Callbacks.OnExec) {
+            Callbacks.OnExec(pid, newproc->ProcInfo->CommandLine);
+        }
     }
 
     TProcStatePtr TContext::NewProcState(size_t pid, size_t ppid) const noexcept {
         std::string cmdline = GetCommandLine(pid, Options.CommandLengthLimit);
         
         std::string comm;
-        if (Options.SearchForCoreDumps) {
+        if (Options.SearchForCoreDumps || !Options.ProcThrottles.empty()) {
             std::stringstream ss;
             ss << "/proc/" << pid << "/comm";
             comm = ReadFileSafe(ss.str());
         }
 
-        return std::make_shared<TProcState>(pid, ppid, comm, cmdline);
-    }
+        std::string cgroup;
+        if (!Options.Cgroups.empty()) {
+            cgroup = GetProcessCgroup(pid);
+        }
 
-    int TContext::GetHighestFd(const std::vector<TFileStatePtr>& fds, bool cloexecFree) const noexcept {
-        for (int fd = fds.size() - 1; fd >= 0; fd--) {
-            if (!!fds[fd]) {
-                if (cloexecFree) {
-                    if (!fds[fd]->IsCloexecSet()) {
-                        return fd;
-                    }
-                } else {
-                    return fd;
-                }
-            }
+        auto proc = std::make_shared<TProcState>(pid, ppid, comm, cmdline, cgroup);
+        if (!Options.ProcThrottles.empty()) {
+            proc->Throttle = ProcThrottlePatterns.MatchFirst(comm);
         }
-        return -1;
+        return proc;
     }
 
     void TContext::RegisterProcess(pid_t parent, pid_t child) noexcept {
-        assert(ProcMap.find(child) == ProcMap.end());
         auto pproc = GetProcState(parent);
 
         auto newproc = NewProcState(child, parent);
+        newproc->Cwd = pproc->Cwd;
+        newproc->DirFds = pproc->DirFds;
+        newproc->IoUrings = pproc->IoUrings;
+        newproc->Mappings = pproc->Mappings;
+        newproc->SizeDelta = pproc->SizeDelta;
 
-        const int highestFd = GetHighestFd(pproc->Fds, false);
-        if (highestFd >= 0) {
-            auto& newfds = newproc->Fds;
-            auto& pprocfds = pproc->Fds;
-
-            newfds.resize(highestFd + 1);
-            for (int i = 0; i <= highestFd; i++) {
-                if (pprocfds[i]) {
-                    newfds[i] = std::make_shared<TFileState>(*pprocfds[i]);
-                }
-            }
-        }
+        pproc->Fds.ForEach([&](size_t fd, TFileStatePtr& file) {
+            newproc->Fds.Set(fd, CopyFileState(file));
+        });
 
-        GroupLeaders.emplace(child);
-        ProcMap[child] = newproc;
+        SetProcState(child, newproc, true);
     }
 
     void TContext::RegisterThread(pid_t pid, pid_t thread) noexcept {
-        assert(ProcMap.find(pid) != ProcMap.end());
-        ProcMap[thread] = ProcMap[pid];
+        const TProcSlot* slot = Procs.Find(pid);
+        assert(slot && slot->Proc);
+        SetProcState(thread, slot->Proc, false);
+    }
+
+    void TContext::SetProcState(pid_t pid, TProcStatePtr proc, bool leader) noexcept {
+        TProcSlot& slot = Procs[pid];
+        assert(!slot.Proc);
+        slot.Proc = std::move(proc);
+        slot.Leader = leader;
     }
 
     void TContext::TearDownFd(TFileStatePtr& file, TProcInfoPtr pinfo) noexcept {
@@ -114,138 +162,467 @@ namespace NOPTrace {
 
         // Add an entry to the storage only when closing the last ref to the FileState
         if (file.use_count() == 1) {
-            auto output = std::make_shared<TOutputFile>(file.get(), pinfo);
-            FileStorage.AddFileEntry(output);
+            if (file->IsSizeDelta() || file->IsMapped()) {
+                file->EnrollFileSize();
+            }
+            auto output = NewOutputFile(*file, pinfo);
+            AddOutput(output);
+            if (Callbacks.OnClose) {
+                Callbacks.OnClose(MakeReportFile(*output));
+            }
         }
 
         file = nullptr;
     }
 
+    TOutputFilePtr TContext::NewOutputFile(const TFileState& file, TProcInfoPtr pinfo) noexcept {
+        auto output = std::make_shared<TOutputFile>(&file, pinfo);
+        if (file.IsResolved()) {
+            output->Mount = MountTable.Find(file.GetDev());
+        }
+        return output;
+    }
+
+    void TContext::AddOutput(TOutputFilePtr output) noexcept {
+        FileStorage.AddFileEntry(output);
+        if (Sink && (output->Size || Options.StoreEmptyFiles)) {
+            TSinkWriter record(ESinkRecord::File);
+            PutReportFile(record, MakeReportFile(*output));
+            Sink->Send(record);
+        }
+    }
+
+    TProcInfoPtr TContext::GetProcInfo(pid_t pid) const noexcept {
+        const TProcSlot* slot = Procs.Find(pid);
+        if (!slot || !slot->Proc) {
+            return nullptr;
+        }
+        return slot->Proc->ProcInfo;
+    }
+
+    void TContext::RegisterFileOutput(TFileStatePtr& file, TProcInfoPtr pinfo) noexcept {
+        TearDownFd(file, pinfo);
+    }
+
     void TContext::VanishProcess(pid_t pid) noexcept {
-        if (GroupLeaders.find(pid) != GroupLeaders.end()) {
-            auto proc = GetProcState(pid);
+        TProcSlot* slot = Procs.Find(pid);
+        assert(slot && slot->Proc);
+        if (slot->Leader) {
+            auto proc = slot->Proc.get();
             auto pinfo = proc->ProcInfo;
 
-            for (auto& file : proc->Fds) {
-                if (file) {
-                    TearDownFd(file, pinfo);
-                }
+            proc->Fds.ForEach([&](size_t, TFileStatePtr& file) {
+                TearDownFd(file, pinfo);
+            });
+            for (auto& mapping : proc->Mappings) {
+                TearDownFd(mapping.second, pinfo);
             }
-            GroupLeaders.erase(pid);
         }
 
-        assert(ProcMap.find(pid) != ProcMap.end());
-        ProcMap.erase(pid);
+        slot->Proc.reset();
+        slot->Leader = false;
+        slot->OpenPath.clear();
     }
 
     void TContext::RegisterCoreDump(pid_t pid, int termSig) noexcept {
-        auto pinfo = GetProcState(pid)->ProcInfo;
+        auto proc = GetProcState(pid);
 
         if (Options.SearchForCoreDumps) {
-            SearchAndRegisterCoreDumpFile(pinfo, termSig);
+            SearchAndRegisterCoreDumpFile(proc->ProcInfo, proc->Cwd, termSig);
         }
     }
 
-    void TContext::SearchAndRegisterCoreDumpFile(TProcInfoPtr pinfo, int termSig) noexcept {
-        // TODO We need to use pinfo->Cwd and trace (f)chdir if SearchForCoreDumps is specified
-        // check process creation and finish time with core m_time, store (path, m_time, size)
-        // to avoid discovering same core more than once
-        std::string filename = RecoverCoreDumpFile(pinfo->Pid, pinfo->CommandName, GetCwd(), termSig);
+    void TContext::SearchAndRegisterCoreDumpFile(TProcInfoPtr pinfo, const std::string& cwd, int termSig) noexcept {
+        std::string filename = CoreDumps->Find(pinfo->Pid, pinfo->CommandName, cwd.empty() ? GetCwd() : cwd, termSig);
         if (!filename.empty()) {
-            auto output = std::make_shared<TOutputFile>(filename, GetFileLength(filename), pinfo);
-            FileStorage.AddFileEntry(output);
+            struct stat st;
+            const bool found = stat(filename.c_str(), &st) == 0;
+            auto output = std::make_shared<TOutputFile>(filename, found ? st.st_size : 0, pinfo);
+            if (found) {
+                output->Mount = MountTable.Find(st.st_dev);
+            }
+            AddOutput(output);
         }
     }
 
-    void TContext::FillFds(TProcState* proc) noexcept {
-        const int highestFd = MyHighestFd();
-        if (highestFd < 0) {
+    void TContext::FillFds(TProcState* proc, bool self) noexcept {
+        // Tracee which is not exec'ed yet shares open file descriptions with us,
+        // so there is no need to read /proc/<pid>/fdinfo of the tracee itself.
+        const pid_t pid = proc->ProcInfo->Pid;
+        std::stringstream ss;
+        if (self) {
+            ss << "/proc/self/fd";
+        } else {
+            ss << "/proc/" << pid << "/fd";
+        }
+
+        int dirfd = open(ss.str().c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dirfd < 0) {
             return;
         }
 
-        auto& fds = proc->Fds;
-        fds.resize(highestFd + 1);
+        struct stat st;
+        char name[16];
 
-        std::stringstream ss;
-        ss << "/proc/" << proc->ProcInfo->Pid << "/fd/";
-        std::string prefix(ss.str());
-        int prefixSize = prefix.size();
-        prefix.resize(prefix.size() + std::log10(highestFd) + 1);
-        char* prefixEnd = const_cast<char*>(prefix.c_str()) + prefixSize;
+        for (int fd : ListFds(dirfd)) {
+            size_t flags = 0, pos = 0;
+            snprintf(name, sizeof(name), "%d", fd);
+
+            if (self) {
+                int fdflags = fcntl(fd, F_GETFL);
+                if (fd == dirfd || fdflags < 0) {
+                    continue;
+                }
+                flags = fdflags;
+            } else if (!ReadFdInfo(pid, fd, flags, pos)) {
+                continue;
+            }
 
-        int flags = -1;
-        for (int fd = highestFd; fd >= 0; fd--) {
-            flags = fcntl(fd, F_GETFD);
+            if (!((flags & O_WRONLY) || (flags & O_RDWR))) {
+                continue;
+            }
+            if (fstatat(dirfd, name, &st, 0) < 0 || !S_ISREG(st.st_mode)) {
+                continue;
+            }
+
+            if (self) {
+                if (fcntl(fd, F_GETFD) & FD_CLOEXEC) {
+                    flags |= O_CLOEXEC;
+                }
+                off_t curr = lseek(fd, 0, SEEK_CUR);
+                pos = curr > 0 ? curr : 0;
+            }
 
-            if (flags >= 0 && IsFile(fd)) {
-                snprintf(prefixEnd, prefixSize, "%d", fd);
-                fds[fd] = std::make_shared<TFileState>(ReadLink(prefix), flags);
+            auto file = std::make_shared<TFileState>(ReadLinkSafe(name, dirfd), flags);
+            if (!Options.Quotas.empty()) {
+                file->SetQuota(MatchQuota(file->GetFilename()));
+            }
+            if (!Options.Throttles.empty()) {
+                file->SetThrottle(ThrottlePatterns.MatchFirst(file->GetFilename()));
             }
+            if (!file->IsAppendSet() && pos) {
+                file->SetCurrPos(pos);
+            }
+
+            proc->Fds.Set(fd, file);
         }
-        return;
+
+        close(dirfd);
     }
 
-    int TContext::SyscallEnter(pid_t, const user_regs_struct&) noexcept {
+    int TContext::SyscallEnter(pid_t pid, const user_regs_struct& registers) noexcept {
+        const TSyscallInfo& info = GetSyscallInfo(SYSCALL_NR(registers));
+
+        switch (info.Class) {
+            case ESyscallClass::Open: {
+                int dirfd = info.Fd >= 0 ? (int)GetSyscallArg(registers, info.Fd) : AT_FDCWD;
+                // creat has no flags and always opens for writing
+                size_t flags = info.Flags >= 0 ? GetSyscallArg(registers, info.Flags) : O_WRONLY;
+                if ((flags & O_WRONLY) || (flags & O_RDWR)) {
+                    OpOpenEnter(pid, dirfd, GetSyscallArg(registers, info.Path));
+                }
+                break;
+            }
+            // File must be resolved before its size is changed
+            case ESyscallClass::Write:
+            case ESyscallClass::PositionalWrite:
+            case ESyscallClass::CopyWrite:
+            case ESyscallClass::Resize:
+                OpPrepareWrite(pid, GetSyscallArg(registers, info.Fd));
+                break;
+            case ESyscallClass::UringEnter:
+                // int io_uring_enter(unsigned int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags, ...);
+                OpIoUringEnter(pid, GetSyscallArg(registers, info.Fd), GetSyscallArg(registers, 1), GetSyscallArg(registers, info.Flags));
+                break;
+            default:
+                break;
+        }
         return 0;
     }
 
     TProcState* TContext::GetProcState(pid_t pid) noexcept {
-        assert(ProcMap.find(pid) != ProcMap.end());
-        return ProcMap[pid].get();
+        TProcSlot* slot = Procs.Find(pid);
+        assert(slot && slot->Proc);
+        return slot->Proc.get();
     }
 
     void TContext::OpWriteChangeOffset(pid_t pid, size_t fd, size_t offset) noexcept {
-        auto& fds = GetProcState(pid)->Fds;
+        auto file = GetProcState(pid)->Fds.Get(fd);
 
-        if (fds.size() > fd && !!fds[fd]) {
-            fds[fd]->Enroll(offset);
+        if (file) {
+            const size_t prevOutput = file->GetOutputSize();
+            file->Enroll(offset);
+            EnforceLimits(pid, *file, prevOutput);
         }
     }
 
     void TContext::OpWriteNoOffsetChange(pid_t pid, size_t fd, size_t nbytes, size_t offset) noexcept {
-        auto& fds = GetProcState(pid)->Fds;
+        auto file = GetProcState(pid)->Fds.Get(fd);
 
-        if ((fds.size() > fd) && !!fds[fd]) {
-            fds[fd]->EnrollNoShift(nbytes, offset);
+        if (file) {
+            const size_t prevOutput = file->GetOutputSize();
+            file->EnrollNoShift(nbytes, offset);
+            EnforceLimits(pid, *file, prevOutput);
         }
     }
 
-    void TContext::OpOpenWriteFile(pid_t pid, size_t fd, size_t flags) noexcept {
-        auto& fds = GetProcState(pid)->Fds;
+    void TContext::OpWriteAppend(pid_t pid, size_t fd, size_t nbytes, bool shift) noexcept {
+        auto file = GetProcState(pid)->Fds.Get(fd);
 
-        if (fd >= fds.size()) {
-            fds.resize(fd + 1);
+        if (file) {
+            const size_t prevOutput = file->GetOutputSize();
+            file->EnrollAppend(nbytes, shift);
+            EnforceLimits(pid, *file, prevOutput);
         }
+    }
 
-        std::stringstream ss;
-        ss << "/proc/" << pid << "/fd/" << fd;
+    void TContext::OpCopyWrite(pid_t pid, size_t fd, size_t nbytes, unsigned long long offsetPtr) noexcept {
+        auto file = GetProcState(pid)->Fds.Get(fd);
+
+        if (!file) {
+            return;
+        }
+
+        const size_t prevOutput = file->GetOutputSize();
+        if (!offsetPtr) {
+            file->Enroll(nbytes);
+        } else {
+            // Kernel has already advanced the offset by the number of bytes copied
+            loff_t offset;
+            if (ReadTraceeMemory(pid, offsetPtr, &offset, sizeof(offset)) && offset >= (loff_t)nbytes) {
+                file->EnrollNoShift(nbytes, offset - nbytes);
+            }
+        }
+        EnforceLimits(pid, *file, prevOutput);
+    }
+
+    void TContext::OpMmap(pid_t pid, size_t fd, unsigned long long addr) noexcept {
+        auto proc = GetProcState(pid);
+        TFileStatePtr* file = proc->Fds.Find(fd);
+
+        if (!file) {
+            return;
+        }
+
+        // Pages are written after the syscall, so the initial size is taken now
+        OpPrepareWrite(pid, fd);
+        (*file)->SetMapped();
+
+        // Previous mapping at the same address is gone
+        auto& mapping = proc->Mappings[addr];
+        if (mapping) {
+            TearDownFd(mapping, proc->ProcInfo);
+        }
+        mapping = *file;
+    }
+
+    void TContext::OpIoUringSetup(pid_t pid, size_t fd, unsigned long long params) noexcept {
+        auto proc = GetProcState(pid);
+
+        TIoUring ring;
+        ReadIoUringParams(pid, params, ring);
+        proc->IoUrings[fd] = ring;
+
+        // Writes of the process can go through the ring from now on
+        if (!proc->SizeDelta) {
+            proc->SizeDelta = true;
+            proc->Fds.ForEach([&](size_t fd, TFileStatePtr& file) {
+                OpPrepareWrite(pid, fd);
+                file->SetSizeDelta();
+            });
+        }
+    }
+
+    void TContext::OpIoUringRegister(pid_t pid, size_t fd, unsigned opcode, unsigned long long arg, unsigned nrArgs) noexcept {
+        auto& rings = GetProcState(pid)->IoUrings;
+        auto it = rings.find(fd);
+
+        if (it != rings.end()) {
+            RegisterIoUringFiles(pid, it->second, opcode, arg, nrArgs);
+        }
+    }
+
+    void TContext::OpIoUringEnter(pid_t pid, size_t fd, unsigned toSubmit, unsigned flags) noexcept {
+        auto& rings = GetProcState(pid)->IoUrings;
+        if (!toSubmit || rings.empty()) {
+            return;
+        }
+
+        // fd is an index in the registered rings table, it is known only if there is a single ring
+        auto it = (flags & IORING_ENTER_REGISTERED_RING) ? (rings.size() == 1 ? rings.begin() : rings.end()) : rings.find(fd);
+        if (it == rings.end()) {
+            return;
+        }
+
+        auto& ring = it->second;
+        if (!ring.LookedUp) {
+            ring.LookedUp = true;
+            LocateIoUring(pid, ring);
+        }
+
+        // Lengths are requested ones, the final size delta is taken anyway
+        for (const auto& write : ReadIoUringWrites(pid, ring, toSubmit)) {
+            OpPrepareWrite(pid, write.Fd);
+            if (write.Append) {
+                OpWriteAppend(pid, write.Fd, write.Length, write.Offset == -1);
+            } else if (write.Offset == -1) {
+                OpWriteChangeOffset(pid, write.Fd, write.Length);
+            } else {
+                OpWriteNoOffsetChange(pid, write.Fd, write.Length, write.Offset);
+            }
+        }
+    }
+
+    std::string TContext::GetDirFdPath(TProcState* proc, pid_t pid, int dirfd) noexcept {
+        auto it = proc->DirFds.find(dirfd);
+        if (it != proc->DirFds.end()) {
+            return it->second;
+        }
+
+        std::string dirname = ReadLinkSafe(GetFdPath(pid, dirfd));
+        if (!dirname.empty() && dirname[0] == '/') {
+            proc->DirFds[dirfd] = dirname;
+            return dirname;
+        }
+        return "";
+    }
+
+    void TContext::OpOpenEnter(pid_t pid, int dirfd, unsigned long long pathname) noexcept {
+        std::string filename = ReadTraceeString(pid, pathname, PATH_MAX);
+        if (filename.empty()) {
+            return;
+        }
+
+        std::string dirname;
+        if (filename[0] != '/') {
+            auto proc = GetProcState(pid);
+            if (dirfd == AT_FDCWD) {
+                dirname = proc->Cwd;
+            } else {
+                dirname = GetDirFdPath(proc, pid, dirfd);
+            }
+            // Fallback to readlink at syscall-exit-stop
+            if (dirname.empty()) {
+                return;
+            }
+        }
+
+        Procs.Find(pid)->OpenPath = JoinPath(dirname, filename);
+    }
+
+    std::string TContext::TakeOpenPath(pid_t pid) noexcept {
+        std::string filename;
+        filename.swap(Procs.Find(pid)->OpenPath);
+        return filename;
+    }
+
+    void TContext::OpOpenWriteFile(pid_t pid, size_t fd, size_t flags, const std::string& filename) noexcept {
+        auto proc = GetProcState(pid);
+
+        // Many files are opened in write mode but never written,
+        // so initial size is resolved lazily and name is resolved only if it's required right now.
+        auto file = std::make_shared<TFileState>(flags);
+        std::string name = filename;
+
+        // The fd may be closed already, the name is resolved at the first write then
+        if (name.empty() && (MatchesPaths || Options.StoreEmptyFiles || Callbacks.OnOpen)) {
+            name = ReadLinkSafe(GetFdPath(pid, fd));
+        }
+        if (!name.empty()) {
+            file->SetFilename(name);
+        }
+
+        // The path argument may go through symlinks, so patterns are matched against the readlinked name.
+        // The file is still reported under the name it's opened by, as it is without patterns.
+        if (MatchesPaths) {
+            std::string resolved = filename.empty() ? name : ReadLinkSafe(GetFdPath(pid, fd));
+            if (resolved.empty()) {
+                resolved = name;
+            }
+            if (!Options.InterruptionTargets.empty()) {
+                ProcessInterruptionTarget(pid, resolved);
+            }
+            if (!Options.Quotas.empty()) {
+                file->SetQuota(MatchQuota(resolved));
+            }
+            if (!Options.Throttles.empty()) {
+                file->SetThrottle(ThrottlePatterns.MatchFirst(resolved));
+            }
+        }
 
-        std::string filename = ReadLink(ss.str());
+        proc->Fds.Set(fd, file);
+        if (Callbacks.OnOpen) {
+            Callbacks.OnOpen(pid, fd, name);
+        }
 
-        if (Options.InterruptionSignal) {
-            ProcessInterruptionTarget(pid, filename.data());
+        if (proc->SizeDelta) {
+            OpPrepareWrite(pid, fd);
+            file->SetSizeDelta();
+        } else if (Options.Engine == EEngine::Perf) {
+            // Writes are read from perf rings when the file might have grown already
+            OpPrepareWrite(pid, fd);
         }
+    }
+
+    void TContext::OpPrepareWrite(pid_t pid, size_t fd) noexcept {
+        auto file = GetProcState(pid)->Fds.Get(fd);
 
-        fds[fd] = std::make_shared<TFileState>(filename, flags);
+        if (file && !file->IsResolved()) {
+            std::string filename = file->GetFilename();
+            if (filename.empty()) {
+                filename = ReadLinkSafe(GetFdPath(pid, fd));
+            }
+            file->Resolve(filename);
+        }
     }
 
-    void TContext::OpOpenFile(pid_t pid, size_t fd, size_t flags) noexcept {
+    void TContext::OpOpenFile(pid_t pid, size_t fd, size_t flags, const std::string& filename) noexcept {
         if ((flags & O_WRONLY) || (flags & O_RDWR)) {
-            OpOpenWriteFile(pid, fd, flags);
+            OpOpenWriteFile(pid, fd, flags, filename);
         }
     }
 
     void TContext::OpClose(pid_t pid, size_t fd) noexcept {
         auto proc = GetProcState(pid);
-        auto& fds = proc->Fds;
 
-        if ((fd < fds.size()) && !!fds[fd]) {
-            auto& file = fds[fd];
+        if (!proc->DirFds.empty()) {
+            proc->DirFds.erase(fd);
+        }
+        if (!proc->IoUrings.empty()) {
+            proc->IoUrings.erase(fd);
+        }
 
-            if (file) {
-                TearDownFd(file, proc->ProcInfo);
+        TFileStatePtr* file = proc->Fds.Find(fd);
+        if (file) {
+            TearDownFd(*file, proc->ProcInfo);
+            proc->Fds.Erase(fd);
+        }
+    }
+
+    void TContext::OpCloseRange(pid_t pid, size_t first, size_t last) noexcept {
+        auto proc = GetProcState(pid);
+
+        std::vector<size_t> fds;
+        proc->Fds.ForEach([&](size_t fd, TFileStatePtr&) {
+            if (fd >= first && fd <= last) {
+                fds.push_back(fd);
+            }
+        });
+        for (const auto& it : proc->DirFds) {
+            if ((size_t)it.first >= first && (size_t)it.first <= last) {
+                fds.push_back(it.first);
+            }
+        }
+        for (const auto& it : proc->IoUrings) {
+            if ((size_t)it.first >= first && (size_t)it.first <= last) {
+                fds.push_back(it.first);
             }
         }
+
+        // Tables can't be changed while they are walked
+        for (size_t fd : fds) {
+            OpClose(pid, fd);
+        }
     }
 
     bool TContext::OpDup(pid_t pid, size_t fd, size_t newfd) noexcept {
@@ -259,19 +636,15 @@ namespace NOPTrace {
             return false;
         }
         // newfd is valid previously opened file descriptor, we need to close it
-        if (newfd < fds.size() && !!fds[newfd]) {
-            OpClose(pid, newfd);
-        }
+        OpClose(pid, newfd);
 
         // oldfd is not a file descriptor opened for writing
-        if ((oldfd >= fds.size()) || !fds[oldfd]) {
+        TFileStatePtr* file = fds.Find(oldfd);
+        if (!file) {
             return false;
         }
 
-        if (newfd >= fds.size()) {
-            fds.resize(newfd + 1);
-        }
-        fds[newfd] = fds[oldfd];
+        fds.Set(newfd, *file);
         return true;
     }
 
@@ -281,130 +654,169 @@ namespace NOPTrace {
         }
 
         auto proc = GetProcState(pid);
-        proc->Fds[newfd]->SetCloexecFlag(flags & O_CLOEXEC);
+        proc->Fds.Get(newfd)->SetCloexecFlag(flags & O_CLOEXEC);
         return true;
     }
 
     void TContext::OpResize(pid_t pid, size_t fd, size_t size) noexcept {
-        auto& fds = GetProcState(pid)->Fds;
+        auto file = GetProcState(pid)->Fds.Get(fd);
 
-        if ((fds.size() > fd) && !!fds[fd]) {
-            fds[fd]->EnrollNoShift(size, 0);
+        if (file) {
+            const size_t prevOutput = file->GetOutputSize();
+            file->EnrollResize(size);
+            EnforceLimits(pid, *file, prevOutput);
         }
     }
 
     void TContext::OpSeek(pid_t pid, size_t fd, size_t pos) noexcept {
-        auto& fds = GetProcState(pid)->Fds;
+        auto file = GetProcState(pid)->Fds.Get(fd);
 
-        if ((fds.size() > fd) && !!fds[fd]) {
-            fds[fd]->SetCurrPos(pos);
+        if (file) {
+            file->SetCurrPos(pos);
         }
     }
 
     void TContext::OpSetFlag(pid_t pid, size_t fd, size_t flags) noexcept {
-        auto& fds = GetProcState(pid)->Fds;
+        auto file = GetProcState(pid)->Fds.Get(fd);
 
-        if ((fds.size() > fd) && !!fds[fd]) {
-            fds[fd]->SetFlags(flags);
+        if (file) {
+            file->SetFlags(flags);
         }
     }
 
+    void TContext::OpChdir(pid_t pid) noexcept {
+        std::stringstream ss;
+        ss << "/proc/" << pid << "/cwd";
+        GetProcState(pid)->Cwd = ReadLinkSafe(ss.str());
+    }
+
     int TContext::SyscallExit(pid_t pid, const user_regs_struct& registers) noexcept {
-        const unsigned long long& syscall = SYSCALL_NR(registers);
+        const TSyscallInfo& info = GetSyscallInfo(SYSCALL_NR(registers));
         const unsigned long long& retdata = SYSCALL_RETDATA(registers);
-        const unsigned long long& arg0 = SYSCALL_ARG0(registers);
-        const unsigned long long& arg1 = SYSCALL_ARG1(registers);
-        const unsigned long long& arg2 = SYSCALL_ARG2(registers);
-        const unsigned long long& arg3 = SYSCALL_ARG3(registers);
-
-        switch (syscall) {
-            case SYS_write:
-            case SYS_writev:
+        const unsigned long long fd = info.Fd >= 0 ? GetSyscallArg(registers, info.Fd) : 0;
+        std::string filename;
+
+        switch (info.Class) {
+            case ESyscallClass::None:
+                break;
+            case ESyscallClass::Write:
                 if ((ssize_t)retdata > 0) {
-                    OpWriteChangeOffset(pid, arg0, retdata);
+                    OpWriteChangeOffset(pid, fd, retdata);
+                    NotifyWrite(pid, fd, retdata);
                 }
                 break;
-            case SYS_pwritev:
-            case SYS_pwrite64:
-            case SYS_pwritev2:
+            case ESyscallClass::PositionalWrite:
                 if ((ssize_t)retdata > 0) {
-                    OpWriteNoOffsetChange(pid, arg0, retdata, arg3);
+                    const unsigned long long offset = GetSyscallArg(registers, info.Offset);
+                    const unsigned long long flags = info.Flags >= 0 ? GetSyscallArg(registers, info.Flags) : 0;
+                    // pwritev2 takes -1 as the current fd position
+                    if (flags & RWF_APPEND) {
+                        OpWriteAppend(pid, fd, retdata, (long long)offset == -1);
+                    } else if ((long long)offset == -1) {
+                        OpWriteChangeOffset(pid, fd, retdata);
+                    } else {
+                        OpWriteNoOffsetChange(pid, fd, retdata, offset);
+                    }
+                    NotifyWrite(pid, fd, retdata);
                 }
                 break;
-#if defined(__x86_64__)
-            case SYS_creat:
-                if ((int)retdata >= 0) {
-                    OpOpenWriteFile(pid, retdata, arg1);
+            case ESyscallClass::CopyWrite:
+                if ((ssize_t)retdata > 0) {
+                    OpCopyWrite(pid, fd, retdata, GetSyscallArg(registers, info.Offset));
+                    NotifyWrite(pid, fd, retdata);
                 }
                 break;
-            case SYS_open:
+            case ESyscallClass::Open:
+                filename = TakeOpenPath(pid);
                 if ((int)retdata >= 0) {
-                    OpOpenFile(pid, retdata, arg1);
+                    if (info.Flags >= 0) {
+                        OpOpenFile(pid, retdata, GetSyscallArg(registers, info.Flags), filename);
+                    } else {
+                        OpOpenWriteFile(pid, retdata, O_CREAT | O_WRONLY | O_TRUNC, filename);
+                    }
                 }
                 break;
-#endif
-            case SYS_openat:
-                if ((int)retdata >= 0) {
-                    OpOpenFile(pid, retdata, arg2);
+            case ESyscallClass::Chdir:
+                if ((int)retdata == 0) {
+                    OpChdir(pid);
                 }
                 break;
-            case SYS_close:
-                OpClose(pid, arg0);
+            case ESyscallClass::Close:
+                OpClose(pid, fd);
                 break;
-            case SYS_fcntl:
+            case ESyscallClass::CloseRange:
+                // int close_range(unsigned int first, unsigned int last, unsigned int flags);
+                // CLOSE_RANGE_CLOEXEC only marks the fds
+                if ((int)retdata == 0 && !(GetSyscallArg(registers, info.Flags) & CLOSE_RANGE_CLOEXEC)) {
+                    OpCloseRange(pid, fd, (unsigned)GetSyscallArg(registers, 1));
+                }
+                break;
+            case ESyscallClass::Fcntl:
                 if ((int)retdata >= 0) {
-                    switch (arg1) {
+                    switch (GetSyscallArg(registers, info.Fd + 1)) {
                         case F_DUPFD:
-                            OpDup(pid, arg0, retdata);
+                            OpDup(pid, fd, retdata);
                             break;
                         case F_DUPFD_CLOEXEC:
-                            OpDup3(pid, arg0, retdata, O_CLOEXEC);
+                            OpDup3(pid, fd, retdata, O_CLOEXEC);
                             break;
                         case F_SETFL:
                         case F_SETFD:
-                            OpSetFlag(pid, arg0, arg2);
+                            OpSetFlag(pid, fd, GetSyscallArg(registers, info.Flags));
                             break;
                     }
                 }
                 break;
-            case SYS_dup:
+            case ESyscallClass::Dup:
                 if ((int)retdata >= 0) {
-                    OpDup(pid, arg0, retdata);
+                    if (info.NewFd < 0) {
+                        OpDup(pid, fd, retdata);
+                    } else if (info.Flags < 0) {
+                        OpDup2(pid, fd, GetSyscallArg(registers, info.NewFd));
+                    } else {
+                        OpDup3(pid, fd, GetSyscallArg(registers, info.NewFd), GetSyscallArg(registers, info.Flags));
+                    }
                 }
                 break;
-#if defined(__x86_64__)
-            case SYS_dup2:
+            case ESyscallClass::Resize:
                 if ((int)retdata >= 0) {
-                    OpDup2(pid, arg0, arg1);
+                    // Offset + length for fallocate, length for ftruncate
+                    unsigned long long offset = info.Offset >= 0 ? GetSyscallArg(registers, info.Offset) : 0;
+                    OpResize(pid, fd, offset + GetSyscallArg(registers, info.Length));
                 }
                 break;
-#endif
-            case SYS_dup3:
+            case ESyscallClass::Seek:
                 if ((int)retdata >= 0) {
-                    OpDup3(pid, arg0, arg1, arg2);
+                    OpSeek(pid, fd, retdata);
                 }
                 break;
-            case SYS_fallocate:
-                if ((int)retdata >= 0) {
-                    //                  v offset + len
-                    OpResize(pid, arg0, arg2 + arg3);
+            case ESyscallClass::Mmap:
+                // void *mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset);
+                if ((long long)retdata >= 0 && (GetSyscallArg(registers, info.Length + 1) & PROT_WRITE)
+                    && (GetSyscallArg(registers, info.Flags) & MAP_SHARED))
+                {
+                    OpMmap(pid, fd, retdata);
                 }
                 break;
-            case SYS_ftruncate:
+            case ESyscallClass::UringSetup:
+                // int io_uring_setup(u32 entries, struct io_uring_params *p);
                 if ((int)retdata >= 0) {
-                    OpResize(pid, arg0, arg1);
+                    OpIoUringSetup(pid, retdata, GetSyscallArg(registers, 1));
                 }
                 break;
-            case SYS_lseek:
+            case ESyscallClass::UringRegister:
+                // int io_uring_register(unsigned int fd, unsigned int opcode, void *arg, unsigned int nr_args);
                 if ((int)retdata >= 0) {
-                    OpSeek(pid, arg0, retdata);
+                    OpIoUringRegister(pid, fd, GetSyscallArg(registers, 1), GetSyscallArg(registers, 2), GetSyscallArg(registers, 3));
                 }
                 break;
+            case ESyscallClass::UringEnter:
+                break;
         }
         return 0;
     }
 
-    void TContext::PrintReport() const noexcept {
+    void TContext::PrintReport(const TFileStorage& storage) const noexcept {
         std::streambuf* streamBufPtr(std::cerr.rdbuf());
         std::ofstream ofStream;
 
@@ -427,7 +839,7 @@ namespace NOPTrace {
         std::ostream stream(streamBufPtr);
 
         std::unordered_set<TProcInfo const*> procInfoSet;
-        const auto files = FileStorage.GetLargestFiles();
+        const auto files = storage.GetLargestFiles();
 
         if (files.size()) {
 	        stream << "Output tracer summary report";
@@ -457,6 +869,9 @@ namespace NOPTrace {
                 stream << std::setw(padding) << entry->Size << "b";
             }
             stream << " " << entry->Filename;
+            if (entry->Estimated) {
+                stream << " (size delta)";
+            }
             if (dumpProcLegend) {
                 stream << " (pid:" << entry->ProcInfo->Pid << "|" << (unsigned long)entry->ProcInfo.get() << ")";
             }
@@ -472,7 +887,34 @@ namespace NOPTrace {
             }
         }
 
-        const size_t outputSize = FileStorage.GetOutputSize();
+        const auto& cgroupSizes = storage.GetCgroupOutputSizes();
+        if (!cgroupSizes.empty()) {
+            stream << "Cgroup totals:" << std::endl;
+            for (const auto& it : cgroupSizes) {
+                if (Options.HumanReadableSizes) {
+                    stream << std::setw(padding) << HumanReadableSize(it.second);
+                } else {
+                    stream << std::setw(padding) << it.second << "b";
+                }
+                stream << " " << it.first << std::endl;
+            }
+        }
+
+        const auto& mountOutputs = storage.GetMountOutputs();
+        if (!mountOutputs.empty()) {
+            stream << "Mount totals:" << std::endl;
+            for (const auto& it : mountOutputs) {
+                if (Options.HumanReadableSizes) {
+                    stream << std::setw(padding) << HumanReadableSize(it.second.Size);
+                } else {
+                    stream << std::setw(padding) << it.second.Size << "b";
+                }
+                stream << " " << it.first << " (" << it.second.Largest->Mount->FsType << ", files: " << it.second.Files
+                       << ", largest: " << it.second.Largest->Filename << ")" << std::endl;
+            }
+        }
+
+        const size_t outputSize = storage.GetOutputSize();
 
         stream << "Total output: ";
         if (Options.HumanReadableSizes) {
@@ -483,19 +925,197 @@ namespace NOPTrace {
     }
 
     int TContext::PostProcess(int rc) noexcept {
-        while (ProcMap.size()) {
-            VanishProcess(ProcMap.begin()->first);
+        if (Finished) {
+            return rc;
+        }
+        Finished = true;
+
+        Procs.ForEach([this](pid_t pid, TProcSlot& slot) {
+            if (slot.Proc) {
+                VanishProcess(pid);
+            }
+        });
+
+        if (Sink) {
+            TSinkWriter totals(ESinkRecord::Totals);
+            totals.Put(FileStorage.GetOutputSize());
+            Sink->Send(totals);
         }
 
-        if (Options.FilesInReport != 0) {
-            PrintReport();
+        if (Report) {
+            FillReport(FileStorage, *Report);
+        } else if (Options.FilesInReport != 0 && !(Sink && Sink->IsConnected())) {
+            PrintReport(FileStorage);
         }
         return rc;
     }
 
-    void TContext::ProcessInterruptionTarget(pid_t pid, const char* filename) const noexcept {
-        if (fnmatch(Options.InterruptionTarget.data(), filename, FNM_NOESCAPE) == 0) {
+    void TContext::PrintSnapshot() noexcept {
+        if (Options.FilesInReport == 0) {
+            return;
+        }
+
+        TFileStorage snapshot = FileStorage;
+        std::unordered_set<const TFileState*> seen;
+        Procs.ForEach([&](pid_t, TProcSlot& slot) {
+            if (!slot.Leader) {
+                return;
+            }
+            slot.Proc->Fds.ForEach([&](size_t, TFileStatePtr& file) {
+                if (seen.emplace(file.get()).second) {
+                    snapshot.AddFileEntry(NewOutputFile(*file, slot.Proc->ProcInfo));
+                }
+            });
+        });
+        PrintReport(snapshot);
+    }
+
+    void TContext::ProcessInterruptionTarget(pid_t pid, const std::string& filename) const noexcept {
+        if (InterruptionTargets.MatchFirst(filename) >= 0) {
             kill(pid, Options.InterruptionSignal);
         }
     }
+
+    int TContext::MatchQuota(const std::string& filename) const noexcept {
+        return QuotaPatterns.MatchFirst(filename);
+    }
+
+    // Checked on every accounted write, so the writer is signalled as soon as a limit is crossed.
+    // Each limit fires once, so writers which handle or ignore the signal aren't flooded.
+    void TContext::EnforceLimits(pid_t pid, TFileState& file, size_t prevOutput) noexcept {
+        if (!Limited) {
+            return;
+        }
+
+        if (Options.MinFree && file.IsResolved()) {
+            CheckFreeSpace(file, file.GetOutputSize() - prevOutput);
+        }
+
+        if (Options.MaxFileSize && !file.IsOverMaxSize() && file.GetFileSize() > Options.MaxFileSize) {
+            file.SetOverMaxSize();
+            kill(pid, Options.MaxFileSizeSignal);
+            NotifyLimit(pid, ELimit::MaxFileSize, file);
+        }
+
+        const int quota = file.GetQuota();
+        if (quota >= 0) {
+            QuotaUsage[quota] += file.GetOutputSize() - prevOutput;
+            if (!QuotaExceeded[quota] && QuotaUsage[quota] > Options.Quotas[quota].Limit) {
+                QuotaExceeded[quota] = true;
+                kill(pid, Options.Quotas[quota].Signal);
+                NotifyLimit(pid, ELimit::Quota, file);
+            }
+        }
+    }
+
+    // Buckets are charged with the bytes written, not with the output growth, as the disk bandwidth is shaped
+    void TContext::ChargeThrottles(pid_t pid, size_t fd, size_t nbytes) noexcept {
+        auto proc = GetProcState(pid);
+        const long long now = GetMonotonicTime();
+
+        long long delay = 0;
+        if (proc->Throttle >= 0) {
+            delay = ProcThrottleBuckets[proc->Throttle].Charge(nbytes, now);
+        }
+
+        auto file = proc->Fds.Get(fd);
+        if (file && file->GetThrottle() >= 0) {
+            delay = std::max(delay, ThrottleBuckets[file->GetThrottle()].Charge(nbytes, now));
+        }
+        ThrottleDelay = std::max(ThrottleDelay, delay);
+    }
+
+    long long TContext::TakeThrottleDelay() noexcept {
+        const long long delay = ThrottleDelay;
+        ThrottleDelay = 0;
+        return delay;
+    }
+
+    // statvfs is called on a schedule driven by the output: checks get more frequent as free space
+    // approaches the limit, so traced writers alone can't cross it unnoticed
+    void TContext::CheckFreeSpace(const TFileState& file, size_t nbytes) noexcept {
+        auto& fs = Filesystems[file.GetDev()];
+        fs.Output += nbytes;
+        if (fs.Output < fs.NextCheck) {
+            return;
+        }
+        fs.Output = 0;
+
+        struct statvfs st;
+        if (statvfs(file.GetFilename().c_str(), &st) < 0) {
+            // File might be removed, the next one will tell
+            fs.NextCheck = MIN_FREE_CHECK_MIN;
+            return;
+        }
+
+        const size_t avail = st.f_bavail * st.f_frsize;
+        const size_t limit = Options.MinFreePercent ? st.f_blocks * st.f_frsize / 100 * Options.MinFree : Options.MinFree;
+        if (avail >= limit) {
+            fs.Low = false;
+            fs.NextCheck = std::min(std::max((avail - limit) / 2, MIN_FREE_CHECK_MIN), MIN_FREE_CHECK_MAX);
+            return;
+        }
+
+        fs.NextCheck = MIN_FREE_CHECK_MIN;
+        if (!fs.Low) {
+            fs.Low = true;
+            InterruptLargestWriter(file.GetDev());
+        }
+    }
+
+    // Process holding the largest open output on the filesystem gets the interruption signal
+    void TContext::InterruptLargestWriter(dev_t dev) noexcept {
+        pid_t writer = 0;
+        const TFileState* largest = nullptr;
+        Procs.ForEach([&](pid_t pid, TProcSlot& slot) {
+            if (!slot.Leader) {
+                return;
+            }
+            slot.Proc->Fds.ForEach([&](size_t, TFileStatePtr& file) {
+                if (file->IsResolved() && file->GetDev() == dev && (!largest || file->GetOutputSize() > largest->GetOutputSize())) {
+                    writer = pid;
+                    largest = file.get();
+                }
+            });
+        });
+
+        if (largest) {
+            std::cerr << "optrace: free space is below the limit, interrupting " << writer << std::endl;
+            kill(writer, Options.InterruptionSignal);
+            NotifyLimit(writer, ELimit::MinFree, *largest);
+        }
+        PrintSnapshot();
+    }
+
+    void TContext::NotifyWrite(pid_t pid, size_t fd, size_t nbytes) noexcept {
+        if (Throttled) {
+            ChargeThrottles(pid, fd, nbytes);
+        }
+
+        if (Callbacks.OnWrite) {
+            auto file = GetProcState(pid)->Fds.Get(fd);
+            if (file) {
+                Callbacks.OnWrite(pid, fd, file->GetFilename(), nbytes);
+            }
+        }
+    }
+
+    void TContext::NotifyLimit(pid_t pid, ELimit limit, const TFileState& file) noexcept {
+        if (Callbacks.OnLimit) {
+            Callbacks.OnLimit(pid, limit, file.GetFilename());
+        }
+    }
+
+    void TContext::FillReport(const TFileStorage& storage, TReport& report) const noexcept {
+        report.Files.clear();
+        for (const auto& file : storage.GetLargestFiles()) {
+            report.Files.push_back(MakeReportFile(*file));
+        }
+        report.TotalOutput = storage.GetOutputSize();
+        report.CgroupOutput = storage.GetCgroupOutputSizes();
+        report.MountOutput.clear();
+        for (const auto& it : storage.GetMountOutputs()) {
+            report.MountOutput[it.first] = it.second.Size;
+        }
+    }
 }
@@ -1,9 +1,15 @@
 #pragma once
 
+#include "cores.h"
+#include "glob.h"
+#include "mounts.h"
 #include "optrace.h"
+#include "pidtable.h"
 #include "ptrace.h"
+#include "sink.h"
 #include "storage.h"
 
+#include <memory>
 #include <vector>
 #include <unordered_map>
 #include <unordered_set>
@@ -11,38 +17,116 @@
 #include <sys/user.h>
 
 namespace NOPTrace {
+    // Tracer state of a thread
+    struct TThreadState {
+        // Syscall the thread is in, -1 if it's unknown or the thread is out of syscall
+        int Syscall = -1;
+        // Thread is reported before the event of its creator, it's kept stopped until the event
+        bool Suspended = false;
+        // Monotonic time (ns) the thread is held at its syscall-exit-stop until, 0 if it isn't held
+        long long HeldUntil = 0;
+    };
+
     class TContext {
     public:
-        TContext(const struct TOptions opts)
+        // Slot of a thread known to the tracer, the tracer creates and erases it, the context sets
+        // the process state while the thread is registered. So one lookup serves both of them at a stop.
+        struct TProcSlot {
+            // Threads of a process share its state, the slot of the thread group leader owns the fds.
+            // Null while the thread is unknown to the context.
+            TProcStatePtr Proc;
+            bool Leader = false;
+            TThreadState Thread;
+            // Absolute path of the file being opened by the thread, read at syscall-entry-stop. It is normalized lexically,
+            // symlinks are kept, so such files are reported under the name they are opened by whether patterns are given or not.
+            std::string OpenPath;
+        };
+
+        TContext(const struct TOptions opts, const TCallbacks& callbacks = {}, TReport* report = nullptr)
             : Options(opts)
+            , Callbacks(callbacks)
+            , Report(report)
+            , Limited(!opts.Quotas.empty() || opts.MaxFileSize || opts.MinFree)
+            , MatchesPaths(!opts.InterruptionTargets.empty() || !opts.Quotas.empty() || !opts.Throttles.empty())
+            , QuotaUsage(opts.Quotas.size(), 0)
+            , QuotaExceeded(opts.Quotas.size(), false)
+            , InterruptionTargets(opts.InterruptionTargets)
+            , QuotaPatterns(GetPatterns(opts.Quotas))
+            , Throttled(!opts.Throttles.empty() || !opts.ProcThrottles.empty())
+            , ThrottlePatterns(GetPatterns(opts.Throttles))
+            , ProcThrottlePatterns(GetPatterns(opts.ProcThrottles))
             , FileStorage(opts.FilesInReport, opts.StoreEmptyFiles)
+            , CoreDumps(opts.SearchForCoreDumps ? new TCoreDumpIndex() : nullptr)
+            , Sink(opts.Sink.empty() ? nullptr : new TSink(opts.Sink))
         {
+            for (const auto& throttle : opts.Throttles) {
+                ThrottleBuckets.emplace_back(throttle.Rate);
+            }
+            for (const auto& throttle : opts.ProcThrottles) {
+                ProcThrottleBuckets.emplace_back(throttle.Rate);
+            }
         }
 
         void RegisterTracee(pid_t pid) noexcept;
+        void RegisterAttached(pid_t pid, pid_t ppid) noexcept;
         void RegisterThread(pid_t pid, pid_t thread) noexcept;
         void RegisterProcess(pid_t parent, pid_t child) noexcept;
         void RegisterExec(pid_t pid, pid_t execpid) noexcept;
         void RegisterCoreDump(pid_t pid, int termSig) noexcept;
+        // The slot of the thread is kept for the tracer
         void VanishProcess(pid_t pid) noexcept;
+        TPidTable<TProcSlot>& GetThreads() noexcept {
+            return Procs;
+        }
+
+        TProcInfoPtr GetProcInfo(pid_t pid) const noexcept;
+        void RegisterFileOutput(TFileStatePtr& file, TProcInfoPtr pinfo) noexcept;
 
         int SyscallEnter(pid_t pid, const user_regs_struct& registers) noexcept;
         int SyscallExit(pid_t pid, const user_regs_struct& registers) noexcept;
+        // Nanoseconds the thread has to be held at its syscall-exit-stop for to fit the throttles,
+        // taken right after SyscallExit
+        long long TakeThrottleDelay() noexcept;
 
         int PostProcess(int rc) noexcept;
 
     private:
-        void FillFds(TProcState* proc) noexcept;
-        int GetHighestFd(const std::vector<TFileStatePtr>& fds, bool cloexecFree) const noexcept;
+        void FillFds(TProcState* proc, bool self) noexcept;
         void TearDownFd(TFileStatePtr& file, TProcInfoPtr pinfo) noexcept;
+        TOutputFilePtr NewOutputFile(const TFileState& file, TProcInfoPtr pinfo) noexcept;
+        // Accounts the final output of the file
+        void AddOutput(TOutputFilePtr output) noexcept;
 
         TProcStatePtr NewProcState(size_t pid, size_t ppid) const noexcept;
         TProcState* GetProcState(pid_t pid) noexcept;
-        void SearchAndRegisterCoreDumpFile(TProcInfoPtr pinfo, int termSig) noexcept;
-        void ProcessInterruptionTarget(pid_t pid, const char* filename) const noexcept;
+        // Slot may be created by the tracer before the thread is registered
+        void SetProcState(pid_t pid, TProcStatePtr proc, bool leader) noexcept;
+        void SearchAndRegisterCoreDumpFile(TProcInfoPtr pinfo, const std::string& cwd, int termSig) noexcept;
+        void ProcessInterruptionTarget(pid_t pid, const std::string& filename) const noexcept;
+        int MatchQuota(const std::string& filename) const noexcept;
+        void EnforceLimits(pid_t pid, TFileState& file, size_t prevOutput) noexcept;
+        void ChargeThrottles(pid_t pid, size_t fd, size_t nbytes) noexcept;
+        void NotifyWrite(pid_t pid, size_t fd, size_t nbytes) noexcept;
+        void NotifyLimit(pid_t pid, ELimit limit, const TFileState& file) noexcept;
+        void CheckFreeSpace(const TFileState& file, size_t nbytes) noexcept;
+        void InterruptLargestWriter(dev_t dev) noexcept;
 
-        void OpOpenFile(pid_t pid, size_t fd, size_t flags) noexcept;
-        void OpOpenWriteFile(pid_t pid, size_t fd, size_t flags) noexcept;
+        template <class TRule>
+        static std::vector<std::string> GetPatterns(const std::vector<TRule>& rules) noexcept {
+            std::vector<std::string> patterns;
+            for (const auto& rule : rules) {
+                patterns.push_back(rule.Pattern);
+            }
+            return patterns;
+        }
+
+        std::string GetDirFdPath(TProcState* proc, pid_t pid, int dirfd) noexcept;
+        std::string TakeOpenPath(pid_t pid) noexcept;
+
+        void OpOpenEnter(pid_t pid, int dirfd, unsigned long long pathname) noexcept;
+        void OpOpenFile(pid_t pid, size_t fd, size_t flags, const std::string& filename) noexcept;
+        void OpOpenWriteFile(pid_t pid, size_t fd, size_t flags, const std::string& filename) noexcept;
+        void OpPrepareWrite(pid_t pid, size_t fd) noexcept;
         bool OpDup(pid_t pid, size_t fd, size_t newfd) noexcept;
         bool OpDup2(pid_t pid, size_t oldfd, size_t newfd) noexcept;
         bool OpDup3(pid_t pid, size_t oldfd, size_t newfd, size_t flags) noexcept;
@@ -51,15 +135,62 @@ namespace NOPTrace {
         void OpSetFlag(pid_t pid, size_t fd, size_t flags) noexcept;
         void OpWriteChangeOffset(pid_t pid, size_t fd, size_t offset) noexcept;
         void OpWriteNoOffsetChange(pid_t pid, size_t fd, size_t nbytes, size_t offset) noexcept;
+        void OpWriteAppend(pid_t pid, size_t fd, size_t nbytes, bool shift) noexcept;
+        void OpCopyWrite(pid_t pid, size_t fd, size_t nbytes, unsigned long long offsetPtr) noexcept;
         void OpClose(pid_t pid, size_t fd) noexcept;
+        void OpCloseRange(pid_t pid, size_t first, size_t last) noexcept;
+        void OpChdir(pid_t pid) noexcept;
+        void OpMmap(pid_t pid, size_t fd, unsigned long long addr) noexcept;
+        void OpIoUringSetup(pid_t pid, size_t fd, unsigned long long params) noexcept;
+        void OpIoUringRegister(pid_t pid, size_t fd, unsigned opcode, unsigned long long arg, unsigned nrArgs) noexcept;
+        void OpIoUringEnter(pid_t pid, size_t fd, unsigned toSubmit, unsigned flags) noexcept;
 
-        void PrintReport() const noexcept;
+        void PrintReport(const TFileStorage& storage) const noexcept;
+        void FillReport(const TFileStorage& storage, TReport& report) const noexcept;
+        // Report including the files which are still open
+        void PrintSnapshot() noexcept;
 
     private:
         const struct TOptions Options;
+        const TCallbacks Callbacks;
+        // Report is filled here instead of being printed if it's given
+        TReport* Report;
+
+        // Report is already printed
+        bool Finished = false;
+        // Quotas, file size or free space limit are set
+        const bool Limited;
+        // Opened files are matched against interruption targets, quotas or throttles
+        const bool MatchesPaths;
+        // Output charged to each quota
+        std::vector<size_t> QuotaUsage;
+        // Quota has fired, its writers aren't signalled again
+        std::vector<bool> QuotaExceeded;
+        const TGlobMatcher InterruptionTargets;
+        const TGlobMatcher QuotaPatterns;
+        // File or process throttles are set
+        const bool Throttled;
+        const TGlobMatcher ThrottlePatterns;
+        const TGlobMatcher ProcThrottlePatterns;
+        std::vector<TTokenBucket> ThrottleBuckets;
+        std::vector<TTokenBucket> ProcThrottleBuckets;
+        long long ThrottleDelay = 0;
+
+        // Filesystem with traced files, statvfs is checked again when the output since the last check reaches NextCheck
+        struct TFilesystem {
+            size_t Output = 0;
+            size_t NextCheck = 0;
+            // Free space is below the limit, the writer is interrupted once until it's back
+            bool Low = false;
+        };
+        std::unordered_map<dev_t, TFilesystem> Filesystems;
 
-        std::unordered_set<pid_t> GroupLeaders;
-        std::unordered_map<pid_t, TProcStatePtr> ProcMap;
+        TPidTable<TProcSlot> Procs;
+        TMountTable MountTable;
         TFileStorage FileStorage;
+        // Created before tracees start, so the dumps of all of them are caught
+        std::unique_ptr<TCoreDumpIndex> CoreDumps;
+        // Collector of the session, the report is printed locally unless it's connected at the end
+        std::unique_ptr<TSink> Sink;
     };
 }
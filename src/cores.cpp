@@ -1,59 +1,25 @@
 #include "cores.h"
 #include "utils.h"
 
+#include <cstring>
 #include <sstream>
-#include <string>
-#include <vector>
 
 #include <dirent.h>
 #include <fnmatch.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace NOPTrace {
-
-    struct TCorePattern {
-        std::string Path;
-        std::string Mask;
-    };
-
-    std::string RecoverCoreDumpFile(pid_t pid, const std::string& comm, const std::string& cwd, int termSig) noexcept {
-        std::string corePattern = ReadFileSafe("/proc/sys/kernel/core_pattern");
-
-        TCorePattern defaultPattern{"", "*"};
-        if (corePattern.find('/', 0) == 0) {
-            defaultPattern.Path = GetDirName(corePattern);
-        } else {
-            defaultPattern.Path = cwd;
-        }
-        defaultPattern.Path += '/';
-
-        if (corePattern.empty() || corePattern.find("|", 0) == 0) {
-            std::string coreUsesPid = ReadFileSafe("/proc/sys/kernel/core_uses_pid");
-
-            if (coreUsesPid.empty() || coreUsesPid == "0") {
-                defaultPattern.Mask = "core";
-            } else {
-                defaultPattern.Mask = "core.%p";
-            }
-        } else {
-            defaultPattern.Mask = GetBaseName(corePattern);
-        }
-
-        // Some widely distributed core dump dirs and masks
-        std::vector<TCorePattern> patterns = {
-            defaultPattern,
-            {"/coredumps/", "%e.%p.%s"},
-            {"/coredumps/", "*%p*"},
-            {"/cores/", "*%p*"},
-            {"/var/lib/systemd/coredump", "*%p*"},
-        };
-
-        auto ResolveMask = [&](const std::string& mask) -> std::string {
+    namespace {
+        std::string ResolveMask(const std::string& mask, pid_t pid, const std::string& comm, int termSig) {
             std::stringstream res;
             for (auto it = mask.begin(); it != mask.end(); it++) {
                 if (*it == '%') {
-                    switch (*++it) {
-                    case 0:
+                    if (++it == mask.end()) {
                         break;
+                    }
+                    switch (*it) {
                     case '%':
                         res << *it;
                         break;
@@ -74,31 +40,175 @@ namespace NOPTrace {
                 }
             }
             return res.str();
-        };
+        }
 
-        DIR *dir;
-        struct dirent *direntry;
+        bool HasWildcards(const std::string& mask) {
+            return mask.find_first_of("*?[") != std::string::npos;
+        }
+    }
 
-        for (auto& pattern : patterns) {
-            std::string mask = ResolveMask(pattern.Mask);
+    TCoreDumpIndex::TCoreDumpIndex() noexcept {
+        clock_gettime(CLOCK_REALTIME, &StartTime);
 
-            dir = opendir(pattern.Path.c_str());
-            if (!dir) {
-                continue;
+        std::string corePattern = ReadFileSafe("/proc/sys/kernel/core_pattern");
+
+        TCorePattern defaultPattern{"", "*", -1};
+        if (corePattern.find('/', 0) == 0) {
+            defaultPattern.Path = GetDirName(corePattern) + '/';
+        }
+
+        if (corePattern.empty() || corePattern.find("|", 0) == 0) {
+            std::string coreUsesPid = ReadFileSafe("/proc/sys/kernel/core_uses_pid");
+
+            if (coreUsesPid.empty() || coreUsesPid == "0") {
+                defaultPattern.Mask = "core";
             } else {
-                while ((direntry = readdir(dir)) != nullptr) {
-                    if (direntry->d_type != DT_REG) {
+                defaultPattern.Mask = "core.%p";
+            }
+        } else {
+            defaultPattern.Mask = GetBaseName(corePattern);
+        }
+
+        // Some widely distributed core dump dirs and masks
+        Patterns = {
+            defaultPattern,
+            {"/coredumps/", "%e.%p.%s", -1},
+            {"/coredumps/", "*%p*", -1},
+            {"/cores/", "*%p*", -1},
+            {"/var/lib/systemd/coredump/", "*%p*", -1},
+        };
+
+        InotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (InotifyFd < 0) {
+            return;
+        }
+        for (auto& pattern : Patterns) {
+            // Directories of several patterns get the same watch descriptor
+            if (!pattern.Path.empty()) {
+                pattern.Wd = inotify_add_watch(InotifyFd, pattern.Path.c_str(), IN_CREATE | IN_MOVED_TO | IN_ONLYDIR);
+            }
+        }
+    }
+
+    TCoreDumpIndex::~TCoreDumpIndex() {
+        if (InotifyFd >= 0) {
+            close(InotifyFd);
+        }
+    }
+
+    void TCoreDumpIndex::ReadEvents() noexcept {
+        if (InotifyFd < 0) {
+            return;
+        }
+
+        alignas(struct inotify_event) char buff[64 * 1024];
+        ssize_t len;
+        while ((len = read(InotifyFd, buff, sizeof(buff))) > 0) {
+            for (char* ptr = buff; ptr < buff + len;) {
+                const struct inotify_event* event = (const struct inotify_event*)ptr;
+                ptr += sizeof(struct inotify_event) + event->len;
+
+                if (event->mask & IN_Q_OVERFLOW) {
+                    Overflow = true;
+                    continue;
+                }
+                if (!event->len) {
+                    continue;
+                }
+
+                const std::string name = event->name;
+                for (size_t i = 0; i < Patterns.size(); i++) {
+                    if (Patterns[i].Wd != event->wd) {
                         continue;
                     }
-                    if (fnmatch(mask.c_str(), direntry->d_name, FNM_NOESCAPE) == 0) {
-                        std::stringstream res;
-                        res << pattern.Path << direntry->d_name;
-                        return res.str();
+                    // Every pattern of the directory gets the entry, candidates are checked in the pattern order
+                    const TCoreEntry entry = {i, name};
+                    Created.push_back(entry);
+                    for (size_t pos = name.find_first_of("0123456789"); pos != std::string::npos;) {
+                        size_t end = name.find_first_not_of("0123456789", pos);
+                        NumberIndex[strtoul(name.substr(pos, end - pos).c_str(), nullptr, 10)].push_back(entry);
+                        pos = end == std::string::npos ? end : name.find_first_of("0123456789", end);
                     }
                 }
-                closedir(dir);
+            }
+        }
+    }
+
+    std::string TCoreDumpIndex::Find(pid_t pid, const std::string& comm, const std::string& cwd, int termSig) noexcept {
+        ReadEvents();
+
+        const std::vector<TCoreEntry>* byPid = nullptr;
+        auto it = NumberIndex.find(pid);
+        if (it != NumberIndex.end()) {
+            byPid = &it->second;
+        }
+
+        for (size_t i = 0; i < Patterns.size(); i++) {
+            const auto& pattern = Patterns[i];
+            const std::string mask = ResolveMask(pattern.Mask, pid, comm, termSig);
+            const std::string dir = pattern.Path.empty() ? cwd + '/' : pattern.Path;
+
+            if (pattern.Wd < 0 || Overflow) {
+                std::string path = Scan(dir, mask);
+                if (!path.empty()) {
+                    return path;
+                }
+                continue;
+            }
+
+            // Names of cores matching the pid mask have the pid in them
+            const auto& candidates = pattern.Mask.find("%p") != std::string::npos ? byPid : &Created;
+            if (!candidates) {
+                continue;
+            }
+            for (const auto& entry : *candidates) {
+                if (entry.Pattern == i && !fnmatch(mask.c_str(), entry.Name.c_str(), FNM_NOESCAPE) && Accept(dir + entry.Name)) {
+                    return dir + entry.Name;
+                }
             }
         }
         return "";
     }
+
+    // Directory isn't watched, only the mask without wildcards is resolved in O(1)
+    std::string TCoreDumpIndex::Scan(const std::string& dir, const std::string& mask) noexcept {
+        if (!HasWildcards(mask)) {
+            return Accept(dir + mask) ? dir + mask : "";
+        }
+
+        DIR* dp = opendir(dir.c_str());
+        if (!dp) {
+            return "";
+        }
+
+        std::string res;
+        while (struct dirent* entry = readdir(dp)) {
+            if (entry->d_type != DT_REG) {
+                continue;
+            }
+            if (fnmatch(mask.c_str(), entry->d_name, FNM_NOESCAPE) == 0 && Accept(dir + entry->d_name)) {
+                res = dir + entry->d_name;
+                break;
+            }
+        }
+        closedir(dp);
+        return res;
+    }
+
+    // Core must be written during the session and must not be registered already with the same mtime
+    bool TCoreDumpIndex::Accept(const std::string& path) noexcept {
+        struct stat st;
+        if (stat(path.c_str(), &st) < 0 || !S_ISREG(st.st_mode) || st.st_mtime < StartTime.tv_sec) {
+            return false;
+        }
+
+        // Core might be overwritten by the next crash within a second
+        const long long mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+        auto it = Found.find(path);
+        if (it != Found.end() && it->second == mtime) {
+            return false;
+        }
+        Found[path] = mtime;
+        return true;
+    }
 }
@@ -1,7 +1,52 @@
 #pragma once
 
 #include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/types.h>
+#include <time.h>
 
 namespace NOPTrace {
-    std::string RecoverCoreDumpFile(pid_t pid, const std::string& comm, const std::string& cwd, int termSig) noexcept;
+    // Core dumps of the traced processes. Patterns are resolved once per session, files appearing in
+    // the absolute dump directories are caught by inotify and indexed by the numbers in their names.
+    class TCoreDumpIndex {
+    public:
+        TCoreDumpIndex() noexcept;
+        ~TCoreDumpIndex();
+
+        // Path of the core dumped by the process, empty if it's not found or it's found already
+        std::string Find(pid_t pid, const std::string& comm, const std::string& cwd, int termSig) noexcept;
+
+    private:
+        struct TCorePattern {
+            // Empty for the cwd of the process
+            std::string Path;
+            std::string Mask;
+            // Watch descriptor, -1 if the directory isn't watched
+            int Wd;
+        };
+
+        struct TCoreEntry {
+            size_t Pattern;
+            std::string Name;
+        };
+
+        void ReadEvents() noexcept;
+        std::string Scan(const std::string& dir, const std::string& mask) noexcept;
+        bool Accept(const std::string& path) noexcept;
+
+    private:
+        std::vector<TCorePattern> Patterns;
+        int InotifyFd;
+        // Events were lost, watched directories are scanned then
+        bool Overflow = false;
+        struct timespec StartTime;
+        // Files created in the watched directories by the numbers in their names
+        std::unordered_map<unsigned long, std::vector<TCoreEntry>> NumberIndex;
+        // All files created in the watched directories for masks without pid
+        std::vector<TCoreEntry> Created;
+        // Registered cores with their modification time in ns
+        std::unordered_map<std::string, long long> Found;
+    };
 }
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <sys/types.h>
+
+namespace NOPTrace {
+    class TContext;
+
+    // Source of file write events which are accounted without stopping tracees at them,
+    // ptrace only follows their lifecycle for attribution
+    class TEventSource {
+    public:
+        virtual ~TEventSource() = default;
+
+        // false if the source can't be set up, the reason is printed
+        virtual bool IsValid() const noexcept = 0;
+        // Called for a stopped tracee before it is resumed for the first time,
+        // its future children and threads are followed by the source itself. Returns false on errors.
+        virtual bool Follow(pid_t) noexcept {
+            return true;
+        }
+        // True if launched tracees should stop at write-mode opens, which are passed to Opened instead of the context
+        virtual bool RecordsOpens() const noexcept {
+            return false;
+        }
+        // Called at the exit stop of a write-mode open with its result, before the tracee can write to the file
+        virtual void Opened(TContext&, pid_t, int) noexcept {
+        }
+        // Readable when there are pending events
+        virtual int GetFd() const noexcept = 0;
+        // Accounts all pending events
+        virtual void Drain(TContext& context) noexcept = 0;
+        // Accounts pending events and the files still being written
+        virtual void Finish(TContext& context) noexcept = 0;
+    };
+}
@@ -0,0 +1,278 @@
+#include "fanotify.h"
+#include "context.h"
+#include "utils.h"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <unordered_set>
+
+#include <fcntl.h>
+#include <sys/fanotify.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <unistd.h>
+
+// File handle events are supported since linux-5.1
+#ifndef FAN_REPORT_FID
+    #define FAN_REPORT_FID 0x00000200
+    #define FAN_EVENT_INFO_TYPE_FID 1
+
+struct fanotify_event_info_header {
+    __u8 info_type;
+    __u8 pad;
+    __u16 len;
+};
+
+struct fanotify_event_info_fid {
+    struct fanotify_event_info_header hdr;
+    __kernel_fsid_t fsid;
+    unsigned char handle[0];
+};
+#endif
+
+namespace NOPTrace {
+    namespace {
+        // Nothing is stored on these filesystems
+        bool IsPseudoFs(const std::string& fsType) {
+            static const std::unordered_set<std::string> pseudoFs = {
+                "autofs", "binfmt_misc", "bpf", "cgroup", "cgroup2", "configfs", "debugfs", "devpts",
+                "fusectl", "hugetlbfs", "mqueue", "nsfs", "proc", "pstore", "securityfs", "sysfs", "tracefs",
+            };
+            return pseudoFs.find(fsType) != pseudoFs.end();
+        }
+    }
+
+    TFanotifySource::TFanotifySource() noexcept {
+        // Filesystem timestamps are taken from the coarse clock
+        clock_gettime(CLOCK_REALTIME_COARSE, &StartTime);
+
+        // File handles spare the kernel opening a file for every event. Kernels before 5.1 have no such events
+        // and some filesystems can't encode handles, all mounts are marked in the group reporting fds then.
+        if (!Init(true)) {
+            Close();
+            if (!Init(false)) {
+                Close();
+            }
+        }
+    }
+
+    bool TFanotifySource::Init(bool reportFid) noexcept {
+        Fd = fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK | (reportFid ? FAN_REPORT_FID : 0),
+                           O_RDONLY | O_LARGEFILE | O_CLOEXEC);
+        if (Fd < 0) {
+            if (!reportFid) {
+                std::cerr << "fanotify_init failed: " << strerror(errno) << std::endl;
+            }
+            return false;
+        }
+        ReportFid = reportFid;
+
+        size_t marked = 0;
+        for (const auto& mount : ReadMountInfo(getpid())) {
+            if (IsPseudoFs(mount.FsType)) {
+                continue;
+            }
+            // Some mounts can't be marked, e.g. overmounted ones
+            if (fanotify_mark(Fd, FAN_MARK_ADD | FAN_MARK_MOUNT, FAN_MODIFY | FAN_CLOSE_WRITE, AT_FDCWD, mount.MountPoint.c_str()) != 0) {
+                // Filesystem can't encode file handles or has no fsid
+                if (reportFid && (errno == EOPNOTSUPP || errno == ENODEV || errno == EXDEV)) {
+                    return false;
+                }
+                continue;
+            }
+            marked++;
+
+            if (reportFid) {
+                const int mountFd = open(mount.MountPoint.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                struct statfs sfs;
+                if (mountFd < 0 || fstatfs(mountFd, &sfs) != 0) {
+                    close(mountFd);
+                    return false;
+                }
+                // Mounts of one filesystem share the fsid, any of them resolves its handles
+                if (!MountFds.emplace(std::make_pair(sfs.f_fsid.__val[0], sfs.f_fsid.__val[1]), mountFd).second) {
+                    close(mountFd);
+                }
+            }
+        }
+
+        if (!marked) {
+            std::cerr << "fanotify_mark failed for all mounts: " << strerror(errno) << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    void TFanotifySource::Close() noexcept {
+        for (const auto& it : MountFds) {
+            close(it.second);
+        }
+        MountFds.clear();
+        close(Fd);
+        Fd = -1;
+    }
+
+    bool TFanotifySource::IsValid() const noexcept {
+        return Fd >= 0;
+    }
+
+    TFanotifySource::~TFanotifySource() {
+        Close();
+    }
+
+    bool TFanotifySource::RecordsOpens() const noexcept {
+        return true;
+    }
+
+    void TFanotifySource::Opened(TContext& context, pid_t pid, int fd) noexcept {
+        if (fd < 0 || Disabled) {
+            return;
+        }
+        // Queued events are of the writes made before the open
+        Drain(context);
+
+        struct stat st;
+        if (stat(GetFdPath(pid, fd).c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+            return;
+        }
+        // Size of a file being written is known since its first event
+        auto& entry = Files[std::make_pair(st.st_dev, st.st_ino)];
+        if (!entry.File) {
+            entry.Size = st.st_size;
+            entry.SizeKnown = true;
+        }
+    }
+
+    int TFanotifySource::GetFd() const noexcept {
+        return Fd;
+    }
+
+    bool TFanotifySource::IsCreatedByTracees(int fd) const noexcept {
+        struct statx stx;
+        if (statx(fd, "", AT_EMPTY_PATH, STATX_BTIME, &stx) != 0 || !(stx.stx_mask & STATX_BTIME)) {
+            return false;
+        }
+        if (stx.stx_btime.tv_sec != StartTime.tv_sec) {
+            return stx.stx_btime.tv_sec > StartTime.tv_sec;
+        }
+        return stx.stx_btime.tv_nsec >= (unsigned)StartTime.tv_nsec;
+    }
+
+    void TFanotifySource::HandleEvent(TContext& context, pid_t pid, int fd, unsigned long long mask) noexcept {
+        struct stat st;
+        if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+            return;
+        }
+
+        const auto key = std::make_pair(st.st_dev, st.st_ino);
+        auto it = Files.find(key);
+
+        // Files written only by processes out of the traced tree are not tracked at all
+        TProcInfoPtr pinfo = (mask & FAN_MODIFY) ? context.GetProcInfo(pid) : nullptr;
+        if (pinfo) {
+            if (it == Files.end()) {
+                it = Files.emplace(key, TWrittenFile()).first;
+            }
+
+            auto& entry = it->second;
+            if (!entry.File) {
+                entry.File = std::make_shared<TFileState>(O_WRONLY);
+                entry.File->Resolve(ReadLinkSafe(GetFdPath(getpid(), fd)));
+                entry.File->SetSizeDelta();
+                // Size before the first write is known for files opened by launched tracees and for files
+                // created or closed while tracing, for other files the writes made before the first event
+                // is read are not accounted.
+                if (entry.SizeKnown) {
+                    entry.File->SetInitSize(entry.Size);
+                } else if (IsCreatedByTracees(fd)) {
+                    entry.File->SetInitSize(0);
+                }
+            }
+            entry.ProcInfo = pinfo;
+        }
+
+        if ((mask & FAN_CLOSE_WRITE) && it != Files.end() && it->second.File) {
+            auto& entry = it->second;
+            context.RegisterFileOutput(entry.File, entry.ProcInfo);
+            entry.Size = st.st_size;
+            entry.SizeKnown = true;
+        }
+    }
+
+    int TFanotifySource::OpenFid(const struct fanotify_event_metadata* meta) const noexcept {
+        const char* info = reinterpret_cast<const char*>(meta) + meta->metadata_len;
+        const char* end = reinterpret_cast<const char*>(meta) + meta->event_len;
+
+        while (info + sizeof(struct fanotify_event_info_header) <= end) {
+            auto header = reinterpret_cast<const struct fanotify_event_info_header*>(info);
+            if (header->len < sizeof(*header) || (ptrdiff_t)header->len > end - info) {
+                break;
+            }
+            if (header->info_type == FAN_EVENT_INFO_TYPE_FID) {
+                auto fid = reinterpret_cast<const struct fanotify_event_info_fid*>(info);
+                auto it = MountFds.find(std::make_pair(fid->fsid.val[0], fid->fsid.val[1]));
+                if (it == MountFds.end()) {
+                    return -1;
+                }
+                auto handle = reinterpret_cast<struct file_handle*>(const_cast<unsigned char*>(fid->handle));
+                return open_by_handle_at(it->second, handle, O_PATH | O_CLOEXEC);
+            }
+            info += header->len;
+        }
+        return -1;
+    }
+
+    void TFanotifySource::Drain(TContext& context) noexcept {
+        alignas(struct fanotify_event_metadata) char buff[65536];
+        ssize_t len;
+
+        while ((len = read(Fd, buff, sizeof(buff))) > 0) {
+            auto meta = reinterpret_cast<struct fanotify_event_metadata*>(buff);
+            for (; FAN_EVENT_OK(meta, len); meta = FAN_EVENT_NEXT(meta, len)) {
+                if (meta->vers != FANOTIFY_METADATA_VERSION && !Disabled) {
+                    // Events can't be parsed, files are accounted by the sizes known so far
+                    std::cerr << "Unexpected fanotify metadata version: " << (int)meta->vers << ", report is incomplete" << std::endl;
+                    // No more events are generated, the queued ones are read only to close their fds
+                    fanotify_mark(Fd, FAN_MARK_FLUSH | FAN_MARK_MOUNT, 0, AT_FDCWD, nullptr);
+                    Disabled = true;
+                }
+                if (Disabled) {
+                    if (meta->fd >= 0) {
+                        close(meta->fd);
+                    }
+                    continue;
+                }
+
+                if (meta->mask & FAN_Q_OVERFLOW) {
+                    if (!Overflowed) {
+                        std::cerr << "fanotify queue overflow, report is incomplete" << std::endl;
+                        Overflowed = true;
+                    }
+                    continue;
+                }
+
+                const int fd = ReportFid ? OpenFid(meta) : meta->fd;
+                if (fd >= 0) {
+                    HandleEvent(context, meta->pid, fd, meta->mask);
+                    close(fd);
+                }
+            }
+        }
+    }
+
+    void TFanotifySource::Finish(TContext& context) noexcept {
+        if (Finished) {
+            return;
+        }
+        Finished = true;
+
+        Drain(context);
+        for (auto& it : Files) {
+            if (it.second.File) {
+                context.RegisterFileOutput(it.second.File, it.second.ProcInfo);
+            }
+        }
+        Files.clear();
+    }
+}
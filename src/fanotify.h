@@ -0,0 +1,57 @@
+#pragma once
+
+#include "events.h"
+#include "types.h"
+
+#include <map>
+#include <utility>
+
+#include <sys/fanotify.h>
+#include <sys/types.h>
+#include <time.h>
+
+namespace NOPTrace {
+    // Files are accounted by size delta between the first FAN_MODIFY and FAN_CLOSE_WRITE
+    class TFanotifySource : public TEventSource {
+    public:
+        TFanotifySource() noexcept;
+        ~TFanotifySource();
+
+        bool IsValid() const noexcept override;
+        bool RecordsOpens() const noexcept override;
+        void Opened(TContext& context, pid_t pid, int fd) noexcept override;
+        int GetFd() const noexcept override;
+        void Drain(TContext& context) noexcept override;
+        void Finish(TContext& context) noexcept override;
+
+    private:
+        struct TWrittenFile {
+            // Null while the file is not written
+            TFileStatePtr File;
+            // The last writer
+            TProcInfoPtr ProcInfo;
+            // Size at the last FAN_CLOSE_WRITE or at the last open by a tracee
+            bool SizeKnown = false;
+            size_t Size = 0;
+        };
+
+        // false if fanotify can't be set up in the mode or some mount can't be marked in it
+        bool Init(bool reportFid) noexcept;
+        void Close() noexcept;
+        // Opens the object of the file handle event, -1 if it's gone
+        int OpenFid(const struct fanotify_event_metadata* meta) const noexcept;
+        void HandleEvent(TContext& context, pid_t pid, int fd, unsigned long long mask) noexcept;
+        bool IsCreatedByTracees(int fd) const noexcept;
+
+    private:
+        int Fd = -1;
+        bool ReportFid = false;
+        bool Overflowed = false;
+        bool Disabled = false;
+        bool Finished = false;
+        struct timespec StartTime;
+        // Descriptors of the marked mounts by fsid, file handles are opened relative to them
+        std::map<std::pair<int, int>, int> MountFds;
+        std::map<std::pair<dev_t, ino_t>, TWrittenFile> Files;
+    };
+}
@@ -0,0 +1,350 @@
+#include "glob.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+#include <fnmatch.h>
+
+namespace NOPTrace {
+    namespace {
+        // The cache is dropped and rebuilt from the current state when it grows larger
+        constexpr size_t MAX_DFA_STATES = 4096;
+
+        struct TCharClass {
+            const char* Name;
+            int (*Test)(int);
+        };
+
+        const TCharClass CHAR_CLASSES[] = {
+            {"alnum", isalnum}, {"alpha", isalpha}, {"blank", isblank}, {"cntrl", iscntrl},
+            {"digit", isdigit}, {"graph", isgraph}, {"lower", islower}, {"print", isprint},
+            {"punct", ispunct}, {"space", isspace}, {"upper", isupper}, {"xdigit", isxdigit},
+        };
+
+        // Parses the bracket expression after '[', returns position after the closing ']' or 0 if it isn't closed.
+        // Collating symbols and equivalence classes aren't supported, npos is returned for them.
+        size_t ParseBracket(const std::string& pattern, size_t pos, std::bitset<256>& chars) {
+            bool negate = false;
+            if (pos < pattern.size() && (pattern[pos] == '!' || pattern[pos] == '^')) {
+                negate = true;
+                ++pos;
+            }
+
+            bool first = true;
+            while (pos < pattern.size()) {
+                unsigned char c = pattern[pos];
+                if (c == ']' && !first) {
+                    if (negate) {
+                        chars.flip();
+                    }
+                    return pos + 1;
+                }
+                first = false;
+
+                if (c == '[' && pos + 1 < pattern.size()) {
+                    char kind = pattern[pos + 1];
+                    if (kind == '=' || kind == '.') {
+                        return std::string::npos;
+                    }
+                    if (kind == ':') {
+                        size_t end = pattern.find(":]", pos + 2);
+                        if (end == std::string::npos) {
+                            return 0;
+                        }
+                        const std::string name = pattern.substr(pos + 2, end - pos - 2);
+                        const TCharClass* cls = std::find_if(std::begin(CHAR_CLASSES), std::end(CHAR_CLASSES),
+                            [&name](const TCharClass& cls) { return name == cls.Name; });
+                        if (cls == std::end(CHAR_CLASSES)) {
+                            return std::string::npos;
+                        }
+                        for (int ch = 0; ch < 256; ch++) {
+                            if (cls->Test(ch)) {
+                                chars.set(ch);
+                            }
+                        }
+                        pos = end + 2;
+                        continue;
+                    }
+                }
+
+                if (pos + 2 < pattern.size() && pattern[pos + 1] == '-' && pattern[pos + 2] != ']') {
+                    unsigned char last = pattern[pos + 2];
+                    for (unsigned ch = c; ch <= last; ch++) {
+                        chars.set(ch);
+                    }
+                    pos += 3;
+                } else {
+                    chars.set(c);
+                    ++pos;
+                }
+            }
+            return 0;
+        }
+    }
+
+    TGlobMatcher::TGlobMatcher(const std::vector<std::string>& patterns)
+        : Trie(1)
+        , HasPatterns(!patterns.empty())
+    {
+        for (size_t i = 0; i < patterns.size(); i++) {
+            std::vector<TToken> tokens;
+            const bool compiled = Compile(patterns[i], tokens);
+            if (!compiled) {
+                Fallbacks.emplace_back(i, patterns[i]);
+                tokens.clear();
+            }
+
+            unsigned prefix = 0;
+            while (prefix < tokens.size() && !tokens[prefix].Star && tokens[prefix].Chars.count() == 1) {
+                prefix++;
+            }
+            Patterns.push_back(std::move(tokens));
+            PrefixLengths.push_back(prefix);
+
+            if (prefix) {
+                AddPrefix(i);
+            } else if (compiled) {
+                Unprefixed.push_back(i);
+            }
+        }
+    }
+
+    void TGlobMatcher::AddPrefix(int pattern) noexcept {
+        int node = 0;
+        for (unsigned i = 0; i < PrefixLengths[pattern]; i++) {
+            const std::bitset<256>& chars = Patterns[pattern][i].Chars;
+            unsigned char c = 0;
+            while (!chars.test(c)) {
+                c++;
+            }
+
+            auto& next = Trie[node].Next;
+            auto it = std::lower_bound(next.begin(), next.end(), std::make_pair(c, 0));
+            if (it != next.end() && it->first == c) {
+                node = it->second;
+                continue;
+            }
+            const int child = Trie.size();
+            next.insert(it, std::make_pair(c, child));
+            // Growing the trie may move the nodes, so it's done after the children are updated
+            Trie.emplace_back();
+            node = child;
+        }
+        Trie[node].Ends.push_back(pattern);
+    }
+
+    template <class TFunc>
+    void TGlobMatcher::ForEachPrefixed(const std::string& str, TFunc func) const noexcept {
+        int node = 0;
+        for (size_t pos = 0;; pos++) {
+            for (int pattern : Trie[node].Ends) {
+                func(pattern, pos);
+            }
+            if (pos == str.size()) {
+                return;
+            }
+
+            const auto& next = Trie[node].Next;
+            const auto it = std::lower_bound(next.begin(), next.end(), std::make_pair((unsigned char)str[pos], 0));
+            if (it == next.end() || it->first != (unsigned char)str[pos]) {
+                return;
+            }
+            node = it->second;
+        }
+    }
+
+    bool TGlobMatcher::MatchTokens(const std::vector<TToken>& tokens, size_t token, const std::string& str, size_t pos) noexcept {
+        // On a mismatch the last star takes one more char and the tokens after it are matched again
+        size_t star = std::string::npos;
+        size_t starPos = 0;
+        while (pos < str.size()) {
+            if (token < tokens.size() && tokens[token].Star) {
+                star = token++;
+                starPos = pos;
+            } else if (token < tokens.size() && tokens[token].Chars.test((unsigned char)str[pos])) {
+                token++;
+                pos++;
+            } else if (star != std::string::npos) {
+                token = star + 1;
+                pos = ++starPos;
+            } else {
+                return false;
+            }
+        }
+        while (token < tokens.size() && tokens[token].Star) {
+            token++;
+        }
+        return token == tokens.size();
+    }
+
+    bool TGlobMatcher::Compile(const std::string& pattern, std::vector<TToken>& tokens) {
+        for (size_t pos = 0; pos < pattern.size();) {
+            TToken token{false, {}};
+            unsigned char c = pattern[pos];
+            if (c == '*') {
+                // Adjacent stars are the same as one
+                if (tokens.empty() || !tokens.back().Star) {
+                    token.Star = true;
+                    tokens.push_back(token);
+                }
+                ++pos;
+                continue;
+            }
+
+            if (c == '?') {
+                token.Chars.set();
+                ++pos;
+            } else if (c == '[') {
+                size_t end = ParseBracket(pattern, pos + 1, token.Chars);
+                if (end == std::string::npos) {
+                    return false;
+                }
+                if (end) {
+                    pos = end;
+                } else {
+                    // Unclosed bracket matches itself
+                    token.Chars.reset();
+                    token.Chars.set(c);
+                    ++pos;
+                }
+            } else {
+                token.Chars.set(c);
+                ++pos;
+            }
+            tokens.push_back(token);
+        }
+        return true;
+    }
+
+    int TGlobMatcher::GetState(std::vector<TPosition> positions) const noexcept {
+        // Star may match the empty sequence
+        for (size_t i = 0; i < positions.size(); i++) {
+            const auto& tokens = Patterns[positions[i].first];
+            if (positions[i].second < tokens.size() && tokens[positions[i].second].Star) {
+                positions.emplace_back(positions[i].first, positions[i].second + 1);
+            }
+        }
+        std::sort(positions.begin(), positions.end());
+        positions.erase(std::unique(positions.begin(), positions.end()), positions.end());
+
+        auto it = StateIds.find(positions);
+        if (it != StateIds.end()) {
+            return it->second;
+        }
+
+        TState state;
+        for (const auto& position : positions) {
+            if (position.second == Patterns[position.first].size()) {
+                state.Accepts.push_back(position.first);
+            }
+        }
+        state.Next.fill(-1);
+        state.Positions = positions;
+
+        int id = States.size();
+        States.push_back(std::move(state));
+        StateIds.emplace(std::move(positions), id);
+        return id;
+    }
+
+    int TGlobMatcher::Step(int state, unsigned char c) const noexcept {
+        int next = States[state].Next[c];
+        if (next >= 0) {
+            return next;
+        }
+
+        std::vector<TPosition> positions;
+        for (const auto& position : States[state].Positions) {
+            const auto& tokens = Patterns[position.first];
+            if (position.second == tokens.size()) {
+                continue;
+            }
+            const TToken& token = tokens[position.second];
+            if (token.Star) {
+                positions.push_back(position);
+            } else if (token.Chars.test(c)) {
+                positions.emplace_back(position.first, position.second + 1);
+            }
+        }
+
+        if (States.size() >= MAX_DFA_STATES) {
+            States.clear();
+            StateIds.clear();
+            Start = -1;
+            return GetState(std::move(positions));
+        }
+        next = GetState(std::move(positions));
+        States[state].Next[c] = next;
+        return next;
+    }
+
+    const TGlobMatcher::TState& TGlobMatcher::Run(const std::string& str) const noexcept {
+        if (Start < 0) {
+            std::vector<TPosition> positions;
+            for (int pattern : Unprefixed) {
+                positions.emplace_back(pattern, 0);
+            }
+            Start = GetState(std::move(positions));
+        }
+
+        int state = Start;
+        for (unsigned char c : str) {
+            state = Step(state, c);
+        }
+        return States[state];
+    }
+
+    std::vector<int> TGlobMatcher::Match(const std::string& str) const noexcept {
+        if (!HasPatterns) {
+            return {};
+        }
+
+        std::vector<int> ids;
+        if (!Unprefixed.empty()) {
+            ids = Run(str).Accepts;
+        }
+        ForEachPrefixed(str, [&](int pattern, size_t pos) {
+            if (MatchTokens(Patterns[pattern], PrefixLengths[pattern], str, pos)) {
+                ids.push_back(pattern);
+            }
+        });
+        for (const auto& fallback : Fallbacks) {
+            if (!fnmatch(fallback.second.c_str(), str.c_str(), FNM_NOESCAPE)) {
+                ids.push_back(fallback.first);
+            }
+        }
+        std::sort(ids.begin(), ids.end());
+        return ids;
+    }
+
+    int TGlobMatcher::MatchFirst(const std::string& str) const noexcept {
+        if (!HasPatterns) {
+            return -1;
+        }
+
+        int first = -1;
+        if (!Unprefixed.empty()) {
+            const auto& accepts = Run(str).Accepts;
+            first = accepts.empty() ? -1 : accepts.front();
+        }
+        ForEachPrefixed(str, [&](int pattern, size_t pos) {
+            if ((first < 0 || pattern < first) && MatchTokens(Patterns[pattern], PrefixLengths[pattern], str, pos)) {
+                first = pattern;
+            }
+        });
+        for (const auto& fallback : Fallbacks) {
+            if (first >= 0 && fallback.first > first) {
+                break;
+            }
+            if (!fnmatch(fallback.second.c_str(), str.c_str(), FNM_NOESCAPE)) {
+                return fallback.first;
+            }
+        }
+        return first;
+    }
+
+    bool TGlobMatcher::Empty() const noexcept {
+        return !HasPatterns;
+    }
+}
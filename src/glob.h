@@ -0,0 +1,76 @@
+#pragma once
+
+#include <array>
+#include <bitset>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace NOPTrace {
+    // Set of fnmatch(FNM_NOESCAPE) patterns matched in a single pass over the string.
+    // Patterns starting with literal chars are looked up in a trie of these prefixes and only the found ones
+    // are matched one by one, so paths of unrelated directories cost nothing. The rest are compiled into an NFA,
+    // DFA states are built lazily from its position sets.
+    class TGlobMatcher {
+    public:
+        TGlobMatcher(const std::vector<std::string>& patterns);
+
+        // Indexes of the matching patterns in ascending order
+        std::vector<int> Match(const std::string& str) const noexcept;
+        // Index of the first matching pattern, -1 if there is no such
+        int MatchFirst(const std::string& str) const noexcept;
+        bool Empty() const noexcept;
+
+    private:
+        struct TToken {
+            // '*' matches any sequence, the rest of tokens match a single char
+            bool Star;
+            std::bitset<256> Chars;
+        };
+
+        // Pattern index and the number of its tokens matched
+        using TPosition = std::pair<int, unsigned>;
+
+        struct TTrieNode {
+            // Children sorted by char
+            std::vector<std::pair<unsigned char, int>> Next;
+            // Patterns whose literal prefix ends here
+            std::vector<int> Ends;
+        };
+
+        struct TState {
+            std::vector<TPosition> Positions;
+            std::vector<int> Accepts;
+            // Next state by char, -1 if not built yet
+            std::array<int, 256> Next;
+        };
+
+        static bool Compile(const std::string& pattern, std::vector<TToken>& tokens);
+        // Matches the tokens starting from the given one against the rest of the string
+        static bool MatchTokens(const std::vector<TToken>& tokens, size_t token, const std::string& str, size_t pos) noexcept;
+        void AddPrefix(int pattern) noexcept;
+        // Calls func for the patterns whose literal prefix the string starts with, the rest of them isn't matched
+        template <class TFunc>
+        void ForEachPrefixed(const std::string& str, TFunc func) const noexcept;
+        int GetState(std::vector<TPosition> positions) const noexcept;
+        int Step(int state, unsigned char c) const noexcept;
+        const TState& Run(const std::string& str) const noexcept;
+
+    private:
+        std::vector<std::vector<TToken>> Patterns;
+        // Number of the literal tokens each pattern starts with
+        std::vector<unsigned> PrefixLengths;
+        std::vector<TTrieNode> Trie;
+        // Patterns without a literal prefix are run in the DFA
+        std::vector<int> Unprefixed;
+        // Patterns which can't be compiled are matched by fnmatch
+        std::vector<std::pair<int, std::string>> Fallbacks;
+        bool HasPatterns;
+
+        // Lazily built DFA, it's dropped when grows too large
+        mutable std::vector<TState> States;
+        mutable std::map<std::vector<TPosition>, int> StateIds;
+        mutable int Start = -1;
+    };
+}
@@ -0,0 +1,175 @@
+#include "loop.h"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#ifndef SYS_pidfd_open
+    // The number is the same on all architectures
+    #define SYS_pidfd_open 434
+#endif
+
+namespace NOPTrace {
+    TEventLoop::TEventLoop(const sigset_t& mask, pid_t forwardTo, const std::vector<int>& forwarded, const std::vector<int>& window, int duration) noexcept
+        : Mask(mask)
+        , ForwardTo(forwardTo)
+    {
+        sigemptyset(&Window);
+        sigemptyset(&Forwarded);
+        sigset_t handled;
+        sigemptyset(&handled);
+        sigaddset(&handled, SIGCHLD);
+        for (int signum : window) {
+            sigaddset(&Window, signum);
+            sigaddset(&handled, signum);
+        }
+        // Window signals aren't forwarded even if they are asked to be
+        for (int signum : forwarded) {
+            if (signum != SIGCHLD && !sigismember(&Window, signum)) {
+                sigaddset(&Forwarded, signum);
+                sigaddset(&handled, signum);
+            }
+        }
+
+        sigset_t blocked = mask;
+        sigorset(&blocked, &blocked, &handled);
+        sigprocmask(SIG_SETMASK, &blocked, nullptr);
+
+        EpollFd = epoll_create1(EPOLL_CLOEXEC);
+        // Blocking, so the loop sleeps right in read when there is nothing else to wait for
+        SignalFd = signalfd(-1, &handled, SFD_CLOEXEC);
+        DeadlineTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (EpollFd < 0 || SignalFd < 0 || DeadlineTimerFd < 0) {
+            std::cerr << "Event loop setup failed: " << strerror(errno) << std::endl;
+            Valid = false;
+            return;
+        }
+        AddFd(SignalFd);
+        AddFd(DeadlineTimerFd);
+
+        if (duration > 0) {
+            WindowTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+            struct itimerspec spec = {{0, 0}, {duration, 0}};
+            if (WindowTimerFd < 0 || timerfd_settime(WindowTimerFd, 0, &spec, nullptr) < 0) {
+                std::cerr << "Window timer setup failed: " << strerror(errno) << std::endl;
+                Valid = false;
+                return;
+            }
+            AddFd(WindowTimerFd);
+        }
+    }
+
+    TEventLoop::~TEventLoop() {
+        // Signals which came after the trace are dropped instead of being delivered on unblocking
+        fcntl(SignalFd, F_SETFL, O_NONBLOCK);
+        struct signalfd_siginfo infos[16];
+        while (read(SignalFd, infos, sizeof(infos)) > 0) {
+        }
+        sigprocmask(SIG_SETMASK, &Mask, nullptr);
+
+        for (int fd : PidFds) {
+            close(fd);
+        }
+        for (int fd : {EpollFd, SignalFd, WindowTimerFd, DeadlineTimerFd}) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+    }
+
+    void TEventLoop::AddFd(int fd) noexcept {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        epoll_ctl(EpollFd, EPOLL_CTL_ADD, fd, &ev);
+        if (fd != SignalFd && fd != DeadlineTimerFd) {
+            Fds++;
+        }
+    }
+
+    void TEventLoop::RemoveFd(int fd) noexcept {
+        if (!epoll_ctl(EpollFd, EPOLL_CTL_DEL, fd, nullptr)) {
+            Fds--;
+        }
+    }
+
+    void TEventLoop::WatchProcess(pid_t pid) noexcept {
+        const int fd = syscall(SYS_pidfd_open, pid, 0);
+        if (fd < 0) {
+            return;
+        }
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        PidFds.insert(fd);
+        AddFd(fd);
+    }
+
+    void TEventLoop::SetDeadline(long long deadline) noexcept {
+        if (deadline == Deadline) {
+            return;
+        }
+        Deadline = deadline;
+
+        // Zero value disarms the timer
+        struct itimerspec spec;
+        memset(&spec, 0, sizeof(spec));
+        if (deadline >= 0) {
+            spec.it_value = {deadline / 1000000000, deadline % 1000000000};
+        }
+        timerfd_settime(DeadlineTimerFd, TFD_TIMER_ABSTIME, &spec, nullptr);
+    }
+
+    void TEventLoop::Wait() noexcept {
+        // Stops come one by one when a single tracee is running, so a syscall is saved on each of them
+        if (!Fds && Deadline < 0) {
+            ReadSignals();
+            return;
+        }
+
+        struct epoll_event events[8];
+        const int count = epoll_wait(EpollFd, events, sizeof(events) / sizeof(events[0]), -1);
+
+        for (int i = 0; i < count; i++) {
+            const int fd = events[i].data.fd;
+            unsigned long long expirations;
+            if (fd == SignalFd) {
+                ReadSignals();
+            } else if (fd == WindowTimerFd) {
+                if (read(fd, &expirations, sizeof(expirations)) > 0) {
+                    WindowClosed = true;
+                }
+            } else if (fd == DeadlineTimerFd) {
+                // Timer is one-shot, so the same deadline has to be armed again
+                if (read(fd, &expirations, sizeof(expirations)) > 0) {
+                    Deadline = -1;
+                }
+            } else if (PidFds.erase(fd)) {
+                // pidfd stays readable after the exit
+                RemoveFd(fd);
+                close(fd);
+            }
+        }
+    }
+
+    // Reads once, so it blocks only if nothing is pending. Signals left unread keep the fd readable.
+    void TEventLoop::ReadSignals() noexcept {
+        struct signalfd_siginfo infos[16];
+        const ssize_t len = read(SignalFd, infos, sizeof(infos));
+        for (ssize_t i = 0; i < len / (ssize_t)sizeof(infos[0]); i++) {
+            // SIGCHLD only wakes the tracer up, stops are collected by waitid
+            const int signum = infos[i].ssi_signo;
+            if (sigismember(&Window, signum)) {
+                WindowClosed = true;
+            } else if (sigismember(&Forwarded, signum) && ForwardTo) {
+                kill(ForwardTo, signum);
+            }
+        }
+    }
+}
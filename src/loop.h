@@ -0,0 +1,60 @@
+#pragma once
+
+#include <unordered_set>
+#include <vector>
+
+#include <signal.h>
+#include <sys/types.h>
+
+namespace NOPTrace {
+    // Wakeups of the tracer multiplexed by epoll. Tracee state changes (SIGCHLD), forwarded and window signals
+    // are read from a signalfd, the tracing window duration and the nearest deadline of periodic work are timerfds,
+    // exits of watched processes are pidfds where they are supported, fds of event sources are added by the caller.
+    // The signals stay blocked while the loop exists, no handlers are installed.
+    class TEventLoop {
+    public:
+        // Forwarded signals are sent to forwardTo, window signals and the duration (if positive) close the tracing window.
+        // mask is the signal mask to run with besides the blocked signals, it's restored at destruction.
+        TEventLoop(const sigset_t& mask, pid_t forwardTo, const std::vector<int>& forwarded, const std::vector<int>& window, int duration) noexcept;
+        ~TEventLoop();
+
+        void AddFd(int fd) noexcept;
+        void RemoveFd(int fd) noexcept;
+        // Exit of the process (a thread group leader) wakes the loop, nothing is done without pidfd support
+        void WatchProcess(pid_t pid) noexcept;
+        // Absolute monotonic time (ns) to wake up at, negative for none
+        void SetDeadline(long long deadline) noexcept;
+        // Sleeps until a signal comes, an added fd gets readable, a watched process exits or a timer expires.
+        // Signals, pidfds and timers are handled here, readable fds are left to the caller.
+        void Wait() noexcept;
+
+        bool IsWindowClosed() const noexcept {
+            return WindowClosed;
+        }
+
+        // false if the loop can't be set up, the reason is printed
+        bool IsValid() const noexcept {
+            return Valid;
+        }
+
+    private:
+        void ReadSignals() noexcept;
+
+    private:
+        sigset_t Mask;
+        sigset_t Window;
+        sigset_t Forwarded;
+        pid_t ForwardTo;
+        int EpollFd = -1;
+        int SignalFd = -1;
+        int WindowTimerFd = -1;
+        int DeadlineTimerFd = -1;
+        long long Deadline = -1;
+        // pidfds of the watched processes which haven't exited yet
+        std::unordered_set<int> PidFds;
+        // Number of fds besides the signalfd and the deadline timer
+        size_t Fds = 0;
+        bool WindowClosed = false;
+        bool Valid = true;
+    };
+}
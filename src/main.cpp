@@ -1,33 +1,97 @@
 #include "optrace.h"
 
+#include <cctype>
 #include <cerrno>
 #include <cstring>
 #include <fstream>
 #include <iostream>
+#include <sstream>
 #include <string>
 
 #include <getopt.h>
+#include <sched.h>
 #include <signal.h>
 #include <unistd.h>
 
 NOPTrace::TOptions GetDefaults() {
-    return {
-        .Output="",
-        .AppendOutput=false,
-        .FollowForks=true,
-        .WaitDaemons=false,
-        .JailForks=true,
-        .HumanReadableSizes=false,
-        .FilesInReport=-1,
-        .CommandLengthLimit=120,
-        .UseSecComp=true,
-        .SearchForCoreDumps=true,
-        .ForwardingSignals={SIGINT},
-        .ForwardAllSignals=false,
-        .StoreEmptyFiles=false,
-        .InterruptionTarget="",
-        .InterruptionSignal=0,
+    return NOPTrace::TOptions();
+}
+
+// SIZE[K|M|G|T]
+bool ParseSize(const std::string& str, size_t& size) {
+    char* end;
+    size = strtoull(str.c_str(), &end, 10);
+    if (end == str.c_str()) {
+        return false;
+    }
+
+    const std::string units = "KMGT";
+    if (*end) {
+        auto pos = units.find(toupper(*end));
+        if (pos == std::string::npos || end[1]) {
+            return false;
+        }
+        size <<= 10 * (pos + 1);
+    }
+    return true;
+}
+
+// Signal number or name with or without SIG prefix
+int ParseSignal(const std::string& str) {
+    static const std::pair<const char*, int> signals[] = {
+        {"HUP", SIGHUP}, {"INT", SIGINT}, {"QUIT", SIGQUIT}, {"ABRT", SIGABRT}, {"KILL", SIGKILL},
+        {"USR1", SIGUSR1}, {"USR2", SIGUSR2}, {"TERM", SIGTERM}, {"STOP", SIGSTOP}, {"XFSZ", SIGXFSZ},
     };
+
+    if (isdigit(str[0])) {
+        int signum = atoi(str.c_str());
+        return signum > 0 && signum <= 31 ? signum : 0;
+    }
+
+    const std::string name = str.compare(0, 3, "SIG") ? str : str.substr(3);
+    for (const auto& sig : signals) {
+        if (name == sig.first) {
+            return sig.second;
+        }
+    }
+    return 0;
+}
+
+// SIZE[:SIG], signal is left untouched if it's not given
+bool ParseLimit(const std::string& str, size_t& size, int& signum) {
+    auto colon = str.find(':');
+    if (!ParseSize(str.substr(0, colon), size) || !size) {
+        return false;
+    }
+    if (colon != std::string::npos) {
+        signum = ParseSignal(str.substr(colon + 1));
+    }
+    return signum != 0;
+}
+
+// PATTERN=SIZE[/s]
+bool ParseThrottle(const std::string& str, NOPTrace::TThrottle& throttle) {
+    const auto eq = str.rfind('=');
+    if (eq == std::string::npos || !eq) {
+        return false;
+    }
+    std::string rate = str.substr(eq + 1);
+    if (rate.size() > 2 && !rate.compare(rate.size() - 2, 2, "/s")) {
+        rate.resize(rate.size() - 2);
+    }
+    throttle.Pattern = str.substr(0, eq);
+    return ParseSize(rate, throttle.Rate) && throttle.Rate;
+}
+
+// PERCENT% or SIZE
+bool ParseMinFree(const std::string& str, size_t& size, bool& percent) {
+    percent = !str.empty() && str.back() == '%';
+    if (percent) {
+        char* end;
+        size = strtoull(str.c_str(), &end, 10);
+        return end != str.c_str() && *end == '%' && size > 0 && size < 100;
+    }
+    return ParseSize(str, size) && size;
 }
 
 void printHelp() {
@@ -35,6 +99,8 @@ void printHelp() {
 
     std::cout << "Usage: optrace [-fJhaCDS] [-o FILE] [-c VAL]\n"
               << "               [-r VAL] [-j VAL] [-s SIG] PROG [ARGS]\n"
+              << "       optrace [-fhaD] [-o FILE] [-c VAL] [-r VAL] -p PID[,PID...]\n"
+              << "       optrace [-fhaD] [-o FILE] [-c VAL] [-r VAL] -g PATH\n"
               << "\nOutput format:\n"
               << "  -c|--cmdline-size VAL    maximum string size for cmd lines\n"
               << "                           (negative for unlimited, 0 to disable, default:" << defaultOpts.CommandLengthLimit  << ")\n"
@@ -43,10 +109,26 @@ void printHelp() {
               << "  -o|--output FILE         send report to FILE instead of stderr\n"
               << "  -a|--append              don't overwrite output FILE\n"
               << "  -h|--human-readable      print sizes in human readable format\n"
+              << "  -k|--sink unix:PATH      stream files and totals to optrace-collector instead of printing the report\n"
+              << "                           (the report is printed if the collector is unavailable or lost)\n"
               << "  -i|--interruption-target VAL\n"
-              << "                           send an interrupt signal to a process when it attempts to open a target file (fnmatch) in write mode\n"
+              << "                           send an interrupt signal to a process when it attempts to open a target file (fnmatch) in write mode,\n"
+              << "                           may be repeated\n"
               << "  -I|--interruption-sig VAL\n"
               << "                           signal that will be sent when the interrupt target is found (default: SIGABRT)\n"
+              << "  -q|--quota PATTERN=SIZE[:SIG]\n"
+              << "                           send a signal (default: SIGTERM) to a process writing files matching PATTERN (fnmatch)\n"
+              << "                           when their output exceeds SIZE bytes (K, M, G, T suffixes), the first matching quota is used\n"
+              << "  -m|--max-file-size SIZE[:SIG]\n"
+              << "                           send a signal (default: SIGXFSZ) to a process when a file written by it exceeds SIZE bytes\n"
+              << "  -t|--throttle PATTERN=RATE[/s]\n"
+              << "                           limit writes to files matching PATTERN (fnmatch) to RATE bytes per second (K, M, G, T suffixes)\n"
+              << "                           holding writers after their writes, all matching files share the rate, the first matching throttle is used\n"
+              << "  -T|--throttle-proc PATTERN=RATE[/s]\n"
+              << "                           limit writes by processes whose name (comm) matches PATTERN, all matching processes share the rate\n"
+              << "  -M|--min-free PERCENT%|SIZE\n"
+              << "                           send the interrupt signal to the process with the largest open output on a filesystem\n"
+              << "                           when its free space drops below the limit and print the report right away\n"
               << "\nBehavior:\n"
               << "  -D|--no-coredumps        don't take into account core dump files\n"
               << "  -e|--empty-files         trace empty files\n"
@@ -54,16 +136,34 @@ void printHelp() {
               << "                           (default: [SIGINT])\n"
               << "  -S|--forward-all-signals append signum to the list of forwarding signals to the PROG\n"
               << "\nTracing:\n"
+              << "  -p|--pid PID[,PID...]    attach to already running processes with their threads and children\n"
+              << "                           (SIGINT or SIGTERM detaches and prints the report)\n"
+              << "  -g|--cgroup PATH         attach to all processes of the cgroup v2 and its descendants, including joining later ones\n"
+              << "                           (PATH is either absolute or relative to the hierarchy root, report has per-cgroup totals;\n"
+              << "                           members stop on every syscall, with -E fanotify only at fork, exec and exit)\n"
+              << "  -d|--duration SEC        close tracing window after SEC seconds and print the report\n"
+              << "                           (attached processes are detached, launched ones are not traced anymore)\n"
+              << "  -u|--usr1-stop           close tracing window on the first SIGUSR1 (instead of forwarding it)\n"
               << "  -w|--wait-daemons        wait for daemon processes when following forks\n"
               << "  -F|--no-follow-forks     don't follow forks\n"
               << "  -J|--no-jail-forks       don't kill all created processes, when optrace exits\n"
-              << "  -C|--no-seccomp          don't use seccomp anyway\n";
+              << "  -C|--no-seccomp          don't use seccomp anyway\n"
+              << "  -E|--engine NAME         how writes are accounted: ptrace (default), fanotify or perf\n"
+              << "                           (fanotify requires root, files are accounted by size delta on close;\n"
+              << "                           perf requires raw_syscalls tracepoints, writes are read without stops, PROG only)\n"
+              << "\nTracer scheduling:\n"
+              << "  -P|--tracer-cpu CPU      pin the tracer to CPU (tracees keep their affinity)\n"
+              << "  -R|--tracer-fifo         run the tracer with SCHED_FIFO, so stopped tracees don't wait for it to be scheduled\n"
+              << "                           (requires CAP_SYS_NICE)\n"
+              << "  -B|--busy-wait USEC      poll for the next tracee stop for up to USEC (at most 1000) before sleeping,\n"
+              << "                           only while stops come back-to-back within USEC (default: 0, disabled,\n"
+              << "                           ignored if optrace may run on a single CPU)\n";
 }
 
 int main(int argc, char* argv[]) {
     auto optraceOpts = GetDefaults();
 
-    const char* const short_cli_options = "+FJwho:ac:r:j:CDes:Si:I:h";
+    const char* const short_cli_options = "+FJwho:ac:r:j:k:CDes:Si:I:q:m:t:T:M:p:g:d:uE:P:RB:h";
     const struct option cli_options[] = {
         {"no-follow-forks",     no_argument,        0, 'F'},
         {"no-jail-forks",       no_argument,        0, 'J'},
@@ -73,6 +173,7 @@ int main(int argc, char* argv[]) {
         {"append",              no_argument,        0, 'a'},
         {"cmdline-size",        required_argument,  0, 'c'},
         {"report-size",         required_argument,  0, 'r'},
+        {"sink",                required_argument,  0, 'k'},
         {"threads",             required_argument,  0, 'j'},
         {"no-seccomp",          no_argument,        0, 'C'},
         {"no-coredumps",        no_argument,        0, 'D'},
@@ -81,11 +182,26 @@ int main(int argc, char* argv[]) {
         {"forward-all-signals", no_argument,        0, 'S'},
         {"interruption-target", required_argument,  0, 'i'},
         {"interruption-sig",    required_argument,  0, 'I'},
+        {"quota",               required_argument,  0, 'q'},
+        {"max-file-size",       required_argument,  0, 'm'},
+        {"throttle",            required_argument,  0, 't'},
+        {"throttle-proc",       required_argument,  0, 'T'},
+        {"min-free",            required_argument,  0, 'M'},
+        {"pid",                 required_argument,  0, 'p'},
+        {"cgroup",              required_argument,  0, 'g'},
+        {"duration",            required_argument,  0, 'd'},
+        {"usr1-stop",           no_argument,        0, 'u'},
+        {"engine",              required_argument,  0, 'E'},
+        {"tracer-cpu",          required_argument,  0, 'P'},
+        {"tracer-fifo",         no_argument,        0, 'R'},
+        {"busy-wait",           required_argument,  0, 'B'},
         {"help",                no_argument,        0, 0},
         {0, 0, 0, 0}
     };
 
     int signum;
+    std::string pid;
+    std::stringstream pids;
     int c = 0;
     while (c != -1) {
         c = getopt_long(argc, argv, short_cli_options, cli_options, nullptr);
@@ -125,6 +241,13 @@ int main(int argc, char* argv[]) {
                     optraceOpts.FilesInReport = atoi(optarg);
                 }
                 break;
+            case 'k':
+                optraceOpts.Sink = optarg;
+                if (optraceOpts.Sink.compare(0, 5, "unix:") != 0) {
+                    std::cerr << "Invalid sink: " << optarg << std::endl;
+                    return 1;
+                }
+                break;
             case 'C':
                 optraceOpts.UseSecComp = false;
                 break;
@@ -145,10 +268,7 @@ int main(int argc, char* argv[]) {
                 optraceOpts.StoreEmptyFiles = true;
                 break;
             case 'i':
-                optraceOpts.InterruptionTarget = optarg;
-                if (optraceOpts.InterruptionSignal == 0) {
-                    optraceOpts.InterruptionSignal = SIGABRT;
-                }
+                optraceOpts.InterruptionTargets.push_back(optarg);
                 break;
             case 'I':
                 signum = atoi(optarg);
@@ -157,18 +277,129 @@ int main(int argc, char* argv[]) {
                 }
                 optraceOpts.InterruptionSignal = signum;
                 break;
+            case 'q': {
+                const std::string arg = optarg;
+                const auto eq = arg.rfind('=');
+                NOPTrace::TQuota quota = {arg.substr(0, eq), 0, SIGTERM};
+                if (eq == std::string::npos || quota.Pattern.empty() || !ParseLimit(arg.substr(eq + 1), quota.Limit, quota.Signal)) {
+                    std::cerr << "Invalid quota: " << arg << std::endl;
+                    return 1;
+                }
+                optraceOpts.Quotas.push_back(quota);
+                break;
+            }
+            case 'm':
+                if (!ParseLimit(optarg, optraceOpts.MaxFileSize, optraceOpts.MaxFileSizeSignal)) {
+                    std::cerr << "Invalid file size limit: " << optarg << std::endl;
+                    return 1;
+                }
+                break;
+            case 't':
+            case 'T': {
+                NOPTrace::TThrottle throttle = {"", 0};
+                if (!ParseThrottle(optarg, throttle)) {
+                    std::cerr << "Invalid throttle: " << optarg << std::endl;
+                    return 1;
+                }
+                (c == 't' ? optraceOpts.Throttles : optraceOpts.ProcThrottles).push_back(throttle);
+                break;
+            }
+            case 'M':
+                if (!ParseMinFree(optarg, optraceOpts.MinFree, optraceOpts.MinFreePercent)) {
+                    std::cerr << "Invalid free space limit: " << optarg << std::endl;
+                    return 1;
+                }
+                break;
+            case 'p':
+                pids.clear();
+                pids.str(optarg);
+                while (std::getline(pids, pid, ',')) {
+                    if (atoi(pid.c_str()) <= 0) {
+                        std::cerr << "Invalid pid: " << pid << std::endl;
+                        return 1;
+                    }
+                    optraceOpts.AttachPids.push_back(atoi(pid.c_str()));
+                }
+                break;
+            case 'g':
+                optraceOpts.Cgroups.push_back(optarg);
+                break;
+            case 'd':
+                optraceOpts.Duration = atoi(optarg);
+                if (optraceOpts.Duration <= 0) {
+                    std::cerr << "Invalid duration: " << optarg << std::endl;
+                    return 1;
+                }
+                break;
+            case 'u':
+                optraceOpts.Usr1Stop = true;
+                break;
+            case 'E':
+                if (!strcmp(optarg, "ptrace")) {
+                    optraceOpts.Engine = NOPTrace::EEngine::Ptrace;
+                } else if (!strcmp(optarg, "fanotify")) {
+                    optraceOpts.Engine = NOPTrace::EEngine::Fanotify;
+                } else if (!strcmp(optarg, "perf")) {
+                    optraceOpts.Engine = NOPTrace::EEngine::Perf;
+                } else {
+                    std::cerr << "Invalid engine: " << optarg << std::endl;
+                    return 1;
+                }
+                break;
+            case 'P':
+                optraceOpts.TracerCpu = atoi(optarg);
+                if (!isdigit(optarg[0]) || optraceOpts.TracerCpu >= CPU_SETSIZE) {
+                    std::cerr << "Invalid CPU: " << optarg << std::endl;
+                    return 1;
+                }
+                break;
+            case 'R':
+                optraceOpts.TracerFifo = true;
+                break;
+            case 'B':
+                optraceOpts.BusyWaitUs = atol(optarg);
+                // A longer poll costs more than the sleep it saves
+                if (!isdigit(optarg[0]) || optraceOpts.BusyWaitUs > 1000) {
+                    std::cerr << "Invalid busy wait: " << optarg << std::endl;
+                    return 1;
+                }
+                break;
             // Unknown option/Missing argument (getopt machinery prints error message)
             case '?':
                 return 1;
         }
     }
 
-    if (optind == argc) {
-        std::cerr << "optrace: must have PROG [ARGS]\n"
+    const bool attach = !optraceOpts.AttachPids.empty() || !optraceOpts.Cgroups.empty();
+    if ((optind == argc) != attach) {
+        std::cerr << "optrace: must have either PROG [ARGS] or -p PID or -g PATH\n"
                   << "Try 'optrace --help' for more information." << std::endl;
         return 1;
     }
 
+    if (optraceOpts.Engine != NOPTrace::EEngine::Ptrace && !optraceOpts.InterruptionTargets.empty()) {
+        std::cerr << "optrace: interruption target requires ptrace engine" << std::endl;
+        return 1;
+    }
+
+    // fanotify engine accounts files only when they are closed
+    if (optraceOpts.Engine == NOPTrace::EEngine::Fanotify && (!optraceOpts.Quotas.empty() || optraceOpts.MaxFileSize || optraceOpts.MinFree)) {
+        std::cerr << "optrace: quotas, file size and free space limits can't be used with fanotify engine" << std::endl;
+        return 1;
+    }
+
+    // Writers are held at their syscall stops, other engines don't stop at writes
+    if (optraceOpts.Engine != NOPTrace::EEngine::Ptrace && (!optraceOpts.Throttles.empty() || !optraceOpts.ProcThrottles.empty())) {
+        std::cerr << "optrace: throttling requires ptrace engine" << std::endl;
+        return 1;
+    }
+
+    // Seccomp filter trapping the rest of syscalls can't be installed into running processes
+    if (optraceOpts.Engine == NOPTrace::EEngine::Perf && attach) {
+        std::cerr << "optrace: perf engine can't be used with -p or -g, fanotify engine traces them without syscall stops" << std::endl;
+        return 1;
+    }
+
     // Check permissions for output file
     if (!optraceOpts.Output.empty()) {
         auto flags = std::ofstream::out;
@@ -185,5 +416,8 @@ int main(int argc, char* argv[]) {
         }
     }
 
+    if (attach) {
+        return NOPTrace::TraceProcesses(optraceOpts);
+    }
     return NOPTrace::TraceProgram(argv + optind, optraceOpts);
 }
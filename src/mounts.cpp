@@ -0,0 +1,56 @@
+#include "mounts.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+namespace NOPTrace {
+    TMountTable::TMountTable() noexcept
+        : Fd(-1)
+    {
+    }
+
+    TMountTable::~TMountTable() {
+        if (Fd >= 0) {
+            close(Fd);
+        }
+    }
+
+    TMountInfoPtr TMountTable::Find(dev_t dev) noexcept {
+        if (!Loaded) {
+            Refresh();
+        }
+
+        auto it = Mounts.find(dev);
+        if (it == Mounts.end() && Changed()) {
+            Refresh();
+            it = Mounts.find(dev);
+        }
+        return it != Mounts.end() ? it->second : nullptr;
+    }
+
+    bool TMountTable::Changed() const noexcept {
+        if (Fd < 0) {
+            return true;
+        }
+        struct pollfd pfd = {Fd, POLLPRI, 0};
+        return poll(&pfd, 1, 0) > 0 && (pfd.revents & (POLLPRI | POLLERR));
+    }
+
+    void TMountTable::Refresh() noexcept {
+        // Reopening rearms the change notification
+        if (Fd >= 0) {
+            close(Fd);
+        }
+        Fd = open("/proc/self/mountinfo", O_RDONLY | O_CLOEXEC);
+        Loaded = true;
+
+        Mounts.clear();
+        // Bind mounts share the device, the first mount of the device is kept
+        for (auto& mount : ReadMountInfo(getpid())) {
+            if (Mounts.find(mount.Dev) == Mounts.end()) {
+                Mounts.emplace(mount.Dev, std::make_shared<const TMountInfo>(std::move(mount)));
+            }
+        }
+    }
+}
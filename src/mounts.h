@@ -0,0 +1,33 @@
+#pragma once
+
+#include "utils.h"
+
+#include <memory>
+#include <unordered_map>
+
+#include <sys/types.h>
+
+namespace NOPTrace {
+    using TMountInfoPtr = std::shared_ptr<const TMountInfo>;
+
+    // Mounts of the tracer by device. The table is parsed once and read again only when
+    // the device is unknown and the kernel has reported a change of the mount table.
+    class TMountTable {
+    public:
+        TMountTable() noexcept;
+        ~TMountTable();
+
+        // nullptr if the device isn't mounted
+        TMountInfoPtr Find(dev_t dev) noexcept;
+
+    private:
+        bool Changed() const noexcept;
+        void Refresh() noexcept;
+
+    private:
+        // mountinfo reports POLLPRI when the table is changed since it was opened
+        int Fd;
+        bool Loaded = false;
+        std::unordered_map<dev_t, TMountInfoPtr> Mounts;
+    };
+}
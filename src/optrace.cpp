@@ -1,6 +1,12 @@
 #include "optrace.h"
 #include "bpf_program.h"
+#include "cgroup.h"
 #include "context.h"
+#include "events.h"
+#include "fanotify.h"
+#include "loop.h"
+#include "perf.h"
+#include "pidtable.h"
 #include "ptrace.h"
 #include "regs.h"
 #include "utils.h"
@@ -10,100 +16,361 @@
 #include <cerrno>
 #include <cstring>
 #include <iostream>
+#include <memory>
 #include <unordered_map>
+#include <unordered_set>
 
 #include <sched.h>
 #include <sys/user.h>
 #include <sys/wait.h>
 
-namespace {
-    pid_t TraceePid;
-}
-
 namespace NOPTrace {
     const unsigned SEC_COMP_V1 = 1;
     const unsigned SEC_COMP_V2 = 2;
-    const int EXIT_CODE_UNKNOWN = -1;
     const int SYSCALL_UNDEFINED = -1;
-
-    int TraceMe(const struct TOptions opts) {
-        return TraceProgram(nullptr, opts);
-    }
-
-    void SetupTracee(bool useSecComp) {
-        if (useSecComp) {
-            InstallBpfProgram();
+    const int EXIT_CODE_UNKNOWN = -1;
+    const long CGROUP_RESCAN_PERIOD_MS = 100;
+
+    // Cgroups whose processes are seized as soon as they are found
+    struct TCgroupWatch {
+        std::vector<std::string> Dirs;
+        long PtraceOpts;
+        bool FollowForks;
+    };
+
+    // Filter is empty if syscalls are not filtered
+    void SetupTracee(const TBpfProgram& filter) {
+        if (!filter.empty()) {
+            InstallBpfProgram(filter);
         }
 
         PtraceTraceMe();
 
         if (kill(getpid(), SIGTRAP) < 0) {
             std::cerr << "kill(" << getpid() << ", SIGTRAP) failed: " << strerror(errno) << std::endl;
-            exit(2);
+            _exit(2);
         }
     }
 
-    void RunTracee(char** argv, bool useSecComp) {
-        SetupTracee(useSecComp);
+    // Runs in the forked child, so errors end it with _exit and the handlers of the tracer aren't run
+    void RunTracee(char** argv, const TBpfProgram& filter) {
+        SetupTracee(filter);
 
         if (argv) {
             execvp(argv[0], argv);
             std::cerr << "execvp(" << argv[0] << ", ...) failed: " << strerror(errno) << std::endl;
-            exit(2);
+            _exit(2);
+        }
+    }
+
+    // Source is null for the ptrace engine, false if the source of another engine can't be set up
+    bool CreateEventSource(const struct TOptions& opts, std::unique_ptr<TEventSource>& events) {
+        switch (opts.Engine) {
+            case EEngine::Fanotify:
+                events.reset(new TFanotifySource());
+                break;
+            case EEngine::Perf:
+                events.reset(new TPerfSource());
+                break;
+            default:
+                events.reset();
+                return true;
         }
+        return events->IsValid();
     }
 
-    void ForwardSignal(int sig) {
-        if (TraceePid) {
-            kill(TraceePid, sig);
+    // Called after the tracee is forked, so it doesn't inherit the affinity and the policy.
+    // Sets the busy wait window, it's 0 unless the process may run on more than one CPU.
+    bool SetupTracerScheduling(const struct TOptions& opts, long long& busyWaitNs) {
+        cpu_set_t allowed;
+        busyWaitNs = 0;
+        if (opts.BusyWaitUs > 0 && !sched_getaffinity(0, sizeof(allowed), &allowed) && CPU_COUNT(&allowed) > 1) {
+            busyWaitNs = opts.BusyWaitUs * 1000LL;
+        }
+        if (opts.TracerCpu >= 0) {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(opts.TracerCpu, &cpus);
+            if (sched_setaffinity(0, sizeof(cpus), &cpus) < 0) {
+                std::cerr << "sched_setaffinity(" << opts.TracerCpu << ") failed: " << strerror(errno) << std::endl;
+                return false;
+            }
+        }
+        if (opts.TracerFifo) {
+            struct sched_param param = {sched_get_priority_min(SCHED_FIFO)};
+            if (sched_setscheduler(0, SCHED_FIFO, &param) < 0) {
+                std::cerr << "sched_setscheduler(SCHED_FIFO) failed: " << strerror(errno) << std::endl;
+                return false;
+            }
         }
+        return true;
     }
 
-    void SetupSignalForwarding(const std::vector<int>& signums) {
-        struct sigaction sa;
-        memset(&sa, 0, sizeof(sa));
-        sa.sa_flags = SA_RESTART;
-        sa.sa_handler = ForwardSignal;
+    long GetPtraceOptions(const struct TOptions& opts, bool useSecComp, bool seized) {
+        long ptraceOpts = PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACEEXEC | PTRACE_O_TRACEEXIT;
+        if (opts.FollowForks) {
+            ptraceOpts |= PTRACE_O_TRACECLONE | PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK;
+        }
+        // Never kill processes we didn't create
+        if (opts.JailForks && !seized) {
+            ptraceOpts |= PTRACE_O_EXITKILL;
+        }
+        if (useSecComp) {
+            ptraceOpts |= PTRACE_O_TRACESECCOMP;
+        }
+        return ptraceOpts;
+    }
+
+    // Seizes all threads of the process and then its children recursively.
+    // Returns false if process leader can't be seized.
+    bool SeizeProcessTree(TContext& context, pid_t pid, pid_t ppid, long ptraceOpts, bool followForks, std::unordered_set<pid_t>& seized) {
+        std::vector<pid_t> threads;
+        bool leaderSeized = false;
+
+        // New threads might be spawned while we are seizing, so repeat until none appears
+        bool found = true;
+        while (found) {
+            found = false;
+            for (pid_t tid : ListProcessTasks(pid)) {
+                if (seized.find(tid) != seized.end()) {
+                    continue;
+                }
+                if (PtraceSeize(tid, ptraceOpts) < 0) {
+                    if (tid == pid) {
+                        return false;
+                    }
+                    continue;
+                }
+                PtraceInterrupt(tid);
+
+                seized.emplace(tid);
+                threads.push_back(tid);
+                leaderSeized |= tid == pid;
+                found = true;
+            }
+        }
+
+        if (!leaderSeized) {
+            errno = ESRCH;
+            return false;
+        }
+
+        context.RegisterAttached(pid, ppid);
+        for (pid_t tid : threads) {
+            if (tid != pid) {
+                context.RegisterThread(pid, tid);
+            }
+        }
+
+        if (followForks) {
+            for (pid_t tid : threads) {
+                for (pid_t child : ListProcessChildren(pid, tid)) {
+                    // Children forked after seizing are registered by fork events
+                    if (seized.find(child) == seized.end()) {
+                        SeizeProcessTree(context, child, pid, ptraceOpts, followForks, seized);
+                    }
+                }
+            }
+        }
+        return true;
+    }
+
+    // Seizes processes of the cgroups which are not seized yet
+    void SeizeCgroupProcesses(TContext& context, const TCgroupWatch& cgroups, std::unordered_set<pid_t>& seized) {
+        for (const auto& dir : cgroups.Dirs) {
+            for (pid_t pid : ListCgroupProcesses(dir)) {
+                // Processes might exit or be traced by someone else
+                if (pid != getpid() && seized.find(pid) == seized.end()) {
+                    SeizeProcessTree(context, pid, 0, cgroups.PtraceOpts, cgroups.FollowForks, seized);
+                }
+            }
+        }
+    }
 
-        for (auto signum : signums) {
-            assert(sigaction(signum, &sa, nullptr) == 0);
+    // waitid reports the stop code or the exit status alone, wait3 packs it with the kind of the change
+    int GetWaitStatus(const siginfo_t& info) {
+        switch (info.si_code) {
+            case CLD_EXITED:
+                return info.si_status << 8;
+            case CLD_KILLED:
+                return info.si_status;
+            case CLD_DUMPED:
+                return info.si_status | 0x80;
+            default:
+                // CLD_TRAPPED, the code of a ptrace-stop holds the event above the signal
+                return (info.si_status << 8) | 0x7f;
         }
     }
 
-    void SetupTracer(pid_t pid, const struct TOptions& opts, bool useSecComp) {
+    // Collects a pending stop or exit of the tracee, returns 0 if nothing is pending and options have WNOHANG
+    pid_t WaitTracee(idtype_t idtype, pid_t pid, int options, int& status) {
+        siginfo_t info;
+        info.si_pid = 0;
+        if (waitid(idtype, pid, &info, WEXITED | __WALL | options) < 0) {
+            return -1;
+        }
+        if (info.si_pid) {
+            status = GetWaitStatus(info);
+        }
+        return info.si_pid;
+    }
+
+    // Collects a pending stop or exit of a tracee without blocking. Other children of the process aren't reaped,
+    // the library runs the tracer in processes which might have them.
+    // Returns its pid and the status as wait3 does, 0 if nothing is pending, -1 with ECHILD if no tracees are left.
+    pid_t WaitPending(TPidTable<TContext::TProcSlot>& threads, int& status) {
+        // The first waitable child is peeked. Initial stops of new threads come before they are known,
+        // nothing but tracees reports ptrace-stops.
+        siginfo_t info;
+        info.si_pid = 0;
+        if (waitid(P_ALL, 0, &info, WEXITED | __WALL | WNOHANG | WNOWAIT) < 0) {
+            return -1;
+        }
+        if (info.si_pid && (info.si_code == CLD_TRAPPED || threads.Find(info.si_pid))) {
+            return WaitTracee(P_PID, info.si_pid, WNOHANG, status);
+        }
+
+        // Another child is peeked until the process reaps it, tracees are checked one by one meanwhile
+        pid_t pid = 0;
+        if (info.si_pid) {
+            threads.ForEach([&pid, &status](pid_t tid, TContext::TProcSlot&) {
+                if (!pid && WaitTracee(P_PID, tid, WNOHANG, status) > 0) {
+                    pid = tid;
+                }
+            });
+        }
+        if (!pid && threads.Empty()) {
+            errno = ECHILD;
+            return -1;
+        }
+        return pid;
+    }
+
+    // Polls for a pending stop until the deadline (monotonic ns), 0 if none comes
+    pid_t PollPending(TPidTable<TContext::TProcSlot>& threads, int& status, long long deadline) {
+        pid_t pid;
+        while (!(pid = WaitPending(threads, status)) && GetMonotonicTime() < deadline) {
+        }
+        return pid;
+    }
+
+    // Callers block SIGCHLD
+    int DetachTracees(TContext& context) {
+        auto& threads = context.GetThreads();
+        std::unordered_set<pid_t> detached;
+        threads.ForEach([&threads, &detached](pid_t pid, TContext::TProcSlot& slot) {
+            // Suspended threads are already in ptrace-stop
+            if (slot.Thread.Suspended) {
+                PtraceDetach(pid, 0);
+                threads.Erase(pid);
+                detached.insert(pid);
+            } else {
+                PtraceInterrupt(pid);
+            }
+        });
+
+        // Tracee must be in ptrace-stop to be detached
+        sigset_t sigchld;
+        sigemptyset(&sigchld);
+        sigaddset(&sigchld, SIGCHLD);
+        int status, pid;
+        while (!threads.Empty()) {
+            pid = WaitPending(threads, status);
+            if (pid == 0) {
+                // SIGCHLD of a stop coming after the check stays pending
+                sigwaitinfo(&sigchld, nullptr);
+                continue;
+            }
+            if (pid < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                break;
+            }
+
+            const TContext::TProcSlot* slot = threads.Find(pid);
+            if (WIFSTOPPED(status)) {
+                // Children forked right before are traced already, they are detached once they stop
+                const unsigned int event = (unsigned int)status >> 16;
+                if (event == PTRACE_EVENT_CLONE || event == PTRACE_EVENT_FORK || event == PTRACE_EVENT_VFORK) {
+                    const long child = PtraceGetEventMsg(pid);
+                    if (child > 0 && !detached.count(child)) {
+                        threads.Emplace(child);
+                    }
+                }
+                int sig = 0;
+                // Don't lose signal which is going to be delivered
+                if ((status >> 16) == 0 && WSTOPSIG(status) != (SIGTRAP | 0x80)) {
+                    sig = WSTOPSIG(status);
+                }
+                PtraceDetach(pid, sig);
+            }
+
+            // Files of detached processes are accounted as if they exited
+            if (slot) {
+                if (slot->Proc) {
+                    context.VanishProcess(pid);
+                }
+                threads.Erase(pid);
+            }
+        }
+        return 0;
+    }
+
+    bool SetupTracer(pid_t pid, const struct TOptions& opts, bool useSecComp) {
         int status, res;
         while ((res = waitpid(pid, &status, __WALL)) < 0 && errno == EINTR) {
         }
         if (res < 0) {
             std::cerr << "waitpid(" << pid << ", ...) failed: " << strerror(errno) << std::endl;
-            exit(2);
+            return false;
         }
 
         if ((WIFSTOPPED(status) != true) && (WSTOPSIG(status) != SIGTRAP)) {
             std::cerr << "Unexpected child status: " << status << std::endl;
-            exit(2);
+            return false;
         }
 
-        long ptraceOpts = PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACEEXEC | PTRACE_O_TRACEEXIT;
-        if (opts.FollowForks) {
-            ptraceOpts |= PTRACE_O_TRACECLONE | PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK;
-        }
-        if (opts.JailForks) {
-            ptraceOpts |= PTRACE_O_EXITKILL;
-        }
-        if (useSecComp) {
-            ptraceOpts |= PTRACE_O_TRACESECCOMP;
+        return PtraceSetOptions(pid, GetPtraceOptions(opts, useSecComp, false));
+    }
+
+    // Seized processes are detached untouched if the trace can't be set up
+    int ReleaseSeized(TContext& context, const std::unordered_set<pid_t>& seized, const sigset_t& mask) {
+        auto& threads = context.GetThreads();
+        for (pid_t pid : seized) {
+            threads[pid];
         }
+        DetachTracees(context);
+        sigprocmask(SIG_SETMASK, &mask, nullptr);
+        return 2;
+    }
 
-        PtraceSetOptions(pid, ptraceOpts);
+    // Launched tracee is killed if the trace can't be set up, so it never runs untraced
+    int AbortTracee(pid_t pid, const sigset_t& mask) {
+        kill(pid, SIGKILL);
+        int status;
+        while (waitpid(pid, &status, __WALL) < 0 && errno == EINTR) {
+        }
+        sigprocmask(SIG_SETMASK, &mask, nullptr);
+        return 2;
     }
 
-    int RunTracer(TContext& context, pid_t traceePid, bool followForks, bool waitDaemons, bool useSecComp) {
+    // traceePid is 0 when tracees are seized, they are restarted from their PTRACE_EVENT_STOP.
+    // Writes are accounted by events when they are given, tracees are never stopped at syscalls then.
+    // Processes joining the cgroups are seized periodically if cgroups are given.
+    // Writers exceeding throttles are held at their syscall-exit-stop while the rest of tracees are serviced.
+    // Pending stops are drained with waitid(WNOHANG) after every wakeup and every handled stop,
+    // the loop sleeps only when there are none left. Seized processes are watched by pidfds.
+    // Stops are polled for busyWaitNs before sleeping as long as they come back-to-back.
+    int RunTracer(TContext& context, pid_t traceePid, const std::unordered_set<pid_t>& seized, bool followForks, bool waitDaemons, bool useSecComp,
+                  TEventSource* events, const TCgroupWatch* cgroups, TEventLoop& loop, long long busyWaitNs) {
         // Restart tracee signal-delivery-stop
-        if (useSecComp) {
-            assert(!PtraceContinueSyscall(traceePid, 0));
-        } else {
-            assert(!PtraceRestartSyscall(traceePid, 0));
+        if (traceePid) {
+            if (useSecComp) {
+                assert(!PtraceContinueSyscall(traceePid, 0));
+            } else {
+                assert(!PtraceRestartSyscall(traceePid, 0));
+            }
         }
 
         unsigned secCompVer = SEC_COMP_V1;
@@ -113,19 +380,97 @@ namespace NOPTrace {
 
         int status, pid, traceeExitCode = EXIT_CODE_UNKNOWN;
         struct user_regs_struct registers;
+        bool passThrough = false;
+        // The previous stop came within busyWaitNs after the one before it was handled, so the next one is likely
+        // to come soon too. The time the tracer started to wait is 0 while a stop is handled.
+        bool backToBack = false;
+        long long waitStart = 0;
+
+        // Slots of the context are shared with it, so a stop costs one lookup
+        auto& threads = context.GetThreads();
+        // Threads held at syscall-exit-stop, the deadline is in their slots. Entries of the threads which are
+        // released or vanished in the meantime are dropped on the next walk.
+        std::vector<pid_t> heldThreads;
+        if (traceePid) {
+            threads[traceePid];
+        }
+        for (pid_t pid : seized) {
+            threads[pid];
+        }
+        auto watchSeized = [&](pid_t pid) {
+            const TContext::TProcSlot* slot = threads.Find(pid);
+            if (slot && slot->Leader) {
+                loop.WatchProcess(pid);
+            }
+        };
+        for (pid_t pid : seized) {
+            watchSeized(pid);
+        }
+
+        if (events) {
+            loop.AddFd(events->GetFd());
+        }
+
+        long long nextScan = GetMonotonicTime() + CGROUP_RESCAN_PERIOD_MS * 1000000;
+        auto rescanCgroups = [&]() {
+            const long long now = GetMonotonicTime();
+            if (now < nextScan) {
+                return;
+            }
+            nextScan = now + CGROUP_RESCAN_PERIOD_MS * 1000000;
+
+            std::unordered_set<pid_t> traced;
+            threads.ForEach([&traced](pid_t pid, TContext::TProcSlot&) {
+                traced.emplace(pid);
+            });
+            SeizeCgroupProcesses(context, *cgroups, traced);
+            // New tracees are restarted from their PTRACE_EVENT_STOP
+            for (pid_t pid : traced) {
+                if (threads.Emplace(pid).second) {
+                    watchSeized(pid);
+                }
+            }
+        };
 
-        std::unordered_map<pid_t, int> suspendedThreads;
-        std::unordered_map<pid_t, int> syscallStateMap = {{traceePid, SYSCALL_UNDEFINED}};
+        // Resumes held threads whose deadline has passed or all of them if forced.
+        // Returns the nearest remaining deadline, -1 if none is held.
+        auto releaseThreads = [&](bool force) {
+            const long long now = GetMonotonicTime();
+            long long nearest = -1;
+            for (size_t i = 0; i < heldThreads.size();) {
+                const pid_t pid = heldThreads[i];
+                TContext::TProcSlot* slot = threads.Find(pid);
+                if (slot && slot->Thread.HeldUntil && (force || slot->Thread.HeldUntil <= now)) {
+                    if (useSecComp) {
+                        PtraceContinueSyscall(pid, 0);
+                    } else {
+                        PtraceRestartSyscall(pid, 0);
+                    }
+                    slot->Thread.HeldUntil = 0;
+                }
+                if (!slot || !slot->Thread.HeldUntil) {
+                    heldThreads[i] = heldThreads.back();
+                    heldThreads.pop_back();
+                    continue;
+                }
+                if (nearest < 0 || slot->Thread.HeldUntil < nearest) {
+                    nearest = slot->Thread.HeldUntil;
+                }
+                ++i;
+            }
+            return nearest;
+        };
 
         // Thread might be vanished in case of exit/death
         // and sudden death (when execve is called by thread which is not a group leader).
         auto vanishThread = [&](int pid, bool notify) {
-            assert(syscallStateMap.find(pid) != syscallStateMap.end());
-            syscallStateMap.erase(pid);
-
-            if (notify) {
+            const TContext::TProcSlot* slot = threads.Find(pid);
+            assert(slot);
+            // Suspended thread is unknown to the context
+            if (notify && slot->Proc) {
                 context.VanishProcess(pid);
             }
+            threads.Erase(pid);
             // There might be case when group leader thread is dead (a zombie),
             // but other threads are not dead and can generate an event in time.
             // Just restart syscall stop last time.
@@ -133,13 +478,78 @@ namespace NOPTrace {
         };
 
         while (1) {
-            pid = wait3(&status, __WALL, 0);
+            if (loop.IsWindowClosed() && !passThrough) {
+                releaseThreads(true);
+                if (!traceePid) {
+                    return DetachTracees(context);
+                }
+                // Launched tracees can't be detached: syscalls trapped by the seccomp filter
+                // would fail without a tracer. So the report is printed right now and
+                // all following stops are resumed without any accounting.
+                if (events) {
+                    events->Finish(context);
+                    loop.RemoveFd(events->GetFd());
+                }
+                context.PostProcess(0);
+                passThrough = true;
+
+                threads.ForEach([](pid_t pid, TContext::TProcSlot& slot) {
+                    if (slot.Thread.Suspended) {
+                        PtraceContinueSyscall(pid, 0);
+                        slot.Thread = TThreadState();
+                    }
+                });
+            }
+
+            if (cgroups && !passThrough) {
+                rescanCgroups();
+            }
+
+            long long deadline = heldThreads.empty() ? -1 : releaseThreads(false);
+            if (cgroups && (deadline < 0 || nextScan < deadline)) {
+                deadline = nextScan;
+            }
+            loop.SetDeadline(passThrough ? -1 : deadline);
+            if (busyWaitNs && !waitStart) {
+                waitStart = GetMonotonicTime();
+            }
+            pid = WaitPending(threads, status);
+            if (pid == 0 && backToBack) {
+                pid = PollPending(threads, status, waitStart + busyWaitNs);
+            }
+            if (busyWaitNs && pid > 0) {
+                backToBack = GetMonotonicTime() - waitStart <= busyWaitNs;
+                waitStart = 0;
+            }
+            if (pid == 0) {
+                backToBack = false;
+                // No stops are pending, sleep until SIGCHLD, a window signal, events or the deadline
+                loop.Wait();
+                if (events && !passThrough) {
+                    events->Drain(context);
+                }
+                continue;
+            }
+            // Events of the process must be accounted before its exit is handled
+            if (pid > 0 && events && !passThrough) {
+                events->Drain(context);
+            }
             if (pid < 0) {
                 switch (errno) {
                     case EINTR:
                         continue;
                     // No child alive left
                     case ECHILD:
+                        // Seized processes are not our children, their exit codes are meaningless.
+                        // Watched cgroups might get new processes until the tracing window is closed.
+                        if (!traceePid) {
+                            if (cgroups) {
+                                loop.SetDeadline(nextScan);
+                                loop.Wait();
+                                continue;
+                            }
+                            return 0;
+                        }
                         if (traceeExitCode == EXIT_CODE_UNKNOWN) {
                             // By default we assume that all children we killed using SIGKILL
                             // and we do not know real exitCode.
@@ -147,8 +557,9 @@ namespace NOPTrace {
                         }
                         return traceeExitCode;
                     default:
-                        std::cerr << "wait3 failed: " << strerror(errno) << std::endl;
-                        exit(2);
+                        std::cerr << "waitid failed: " << strerror(errno) << std::endl;
+                        DetachTracees(context);
+                        return 2;
                 }
             }
 
@@ -167,18 +578,22 @@ namespace NOPTrace {
             } else if (WIFSIGNALED(status)) {
                 int termSig = WTERMSIG(status);
                 exitCode = 128 + termSig;
-                if (WCOREDUMP(status)) {
+                if (WCOREDUMP(status) && !passThrough) {
                     context.RegisterCoreDump(pid, termSig);
                 }
             } else if (WIFEXITED(status)) {
                 exitCode = WEXITSTATUS(status);
             } else {
                 std::cerr << pid << " got unknown status: "<< status << " (event:" << event << ")" << std::endl;
-                exit(2);
+                continue;
             }
 
             if (exitCode != EXIT_CODE_UNKNOWN) {
-                vanishThread(pid, true);
+                if (passThrough) {
+                    threads.Erase(pid);
+                } else {
+                    vanishThread(pid, true);
+                }
                 if (pid == traceePid) {
                     // Exit immediately if daemon processes waiting wasn't requested
                     if (followForks && waitDaemons) {
@@ -193,14 +608,37 @@ namespace NOPTrace {
                 continue;
             }
 
-            if (syscallStateMap.find(pid) == syscallStateMap.end()) {
+            if (passThrough) {
+                // Initial stop of a new thread and event stops have nothing to deliver
+                if (event || threads.Emplace(pid).second) {
+                    transmittedSignal = 0;
+                }
+                PtraceContinueSyscall(pid, transmittedSignal);
+                continue;
+            }
+
+            // Slots are never moved, it stays valid until the thread is vanished
+            TContext::TProcSlot* slot = threads.Find(pid);
+            if (!slot || slot->Thread.Suspended) {
                 // This is a new thread, we do not know who created it.
                 // Suspend it until proper event occurs.
-                suspendedThreads[pid] = status;
+                threads[pid].Thread.Suspended = true;
                 continue;
             }
-
-            if (event) {
+            TThreadState* thread = &slot->Thread;
+            // Held thread is reported only if it's killed
+            thread->HeldUntil = 0;
+
+            if (event == PTRACE_EVENT_STOP) {
+                // Seized tracee is in group-stop, keep it stopped until SIGCONT
+                const int sig = WSTOPSIG(status);
+                if (sig == SIGSTOP || sig == SIGTSTP || sig == SIGTTIN || sig == SIGTTOU) {
+                    PtraceListen(pid);
+                    continue;
+                }
+                // PTRACE_INTERRUPT or initial stop of the auto-attached child - nothing to deliver
+                transmittedSignal = 0;
+            } else if (event) {
                 long reportedPid = PtraceGetEventMsg(pid);
                 if (reportedPid < 0) {
                     // Looks like process is dead or refusing ptrace requests
@@ -226,16 +664,16 @@ namespace NOPTrace {
                         context.RegisterProcess(pid, reportedPid);
                     }
 
-                    syscallStateMap[reportedPid] = SYSCALL_UNDEFINED;
-                    if (suspendedThreads.find(reportedPid) != suspendedThreads.end()) {
-                        suspendedThreads.erase(reportedPid);
+                    TThreadState& child = threads[reportedPid].Thread;
+                    child.Syscall = SYSCALL_UNDEFINED;
+                    if (child.Suspended) {
+                        child.Suspended = false;
                         // Resuming previously suspended thread - now it's properly registered.
                         if (useSecComp) {
                             PtraceContinueSyscall(reportedPid, 0);
                         } else {
                             PtraceRestartSyscall(reportedPid, 0);
                         }
-                        syscallStateMap[reportedPid] = SYSCALL_UNDEFINED;
                     }
                 } else if (event == PTRACE_EVENT_EXEC) {
                     context.RegisterExec(pid, reportedPid);
@@ -252,7 +690,7 @@ namespace NOPTrace {
                         // Since Linux 4.8: a PTRACE_EVENT_SECCOMP stop functions comparably to a syscall-entry-stop.
                     } else {
                         syscallStop = true;
-                        syscallStateMap[pid] = SYSCALL_UNDEFINED;
+                        thread->Syscall = SYSCALL_UNDEFINED;
                     }
                 }
             }
@@ -264,31 +702,52 @@ namespace NOPTrace {
                     continue;
                 }
 
-                // Process must be already registered
-                assert(syscallStateMap.find(pid) != syscallStateMap.end());
-                int& threadPrevSyscall = syscallStateMap[pid];
+                int& threadPrevSyscall = thread->Syscall;
+                const ESyscallClass syscallClass = GetSyscallInfo(SYSCALL_NR(registers)).Class;
+                // Opens are passed to the source if it records them
+                const bool opened = events && syscallClass == ESyscallClass::Open && events->RecordsOpens();
+                // Such syscalls are stopped at only without seccomp, they are accounted by events
+                const bool deferred = opened || (events && IsDeferrableSyscall(syscallClass));
 
                 if (threadPrevSyscall == SYSCALL_UNDEFINED) {
                     threadPrevSyscall = GetSyscallNumber(registers);
                     // For more info see GetSyscallNumber
                     if ((int)threadPrevSyscall == -2) {
-                        return -2;
+                        if (traceePid) {
+                            return -2;
+                        }
+                        // Thread was seized in the middle of a syscall, this is its exit stop
+                        threadPrevSyscall = SYSCALL_UNDEFINED;
+                        PtraceRestartSyscall(pid, 0);
+                        continue;
                     }
-                    context.SyscallEnter(pid, registers);
 #if defined(__aarch64__)
                     // We need to save first parameter of syscall as it is replaced by retdata after syscall processing.
                     // We are storing data at r9, which is one of temporary data registers.
                     registers.regs[9] = registers.regs[0];
                     PtraceSetRegs(pid, registers);
 #endif
+                    if (!deferred) {
+                        context.SyscallEnter(pid, registers);
+                    }
                 } else {
                     threadPrevSyscall = SYSCALL_UNDEFINED;
-                    context.SyscallExit(pid, registers);
+                    if (opened) {
+                        events->Opened(context, pid, (int)SYSCALL_RETDATA(registers));
+                    } else if (!deferred) {
+                        context.SyscallExit(pid, registers);
+                        const long long delay = context.TakeThrottleDelay();
+                        if (delay > 0) {
+                            thread->HeldUntil = GetMonotonicTime() + delay;
+                            heldThreads.push_back(pid);
+                            continue;
+                        }
+                    }
                 }
             }
 
             if (useSecComp) {
-                if (syscallStop && syscallStateMap[pid] != SYSCALL_UNDEFINED) {
+                if (syscallStop && thread->Syscall != SYSCALL_UNDEFINED) {
                     PtraceRestartSyscall(pid, transmittedSignal);
                 } else {
                     PtraceContinueSyscall(pid, transmittedSignal);
@@ -302,48 +761,159 @@ namespace NOPTrace {
     }
 
     int TraceProgram(char** argv, const struct TOptions opts) {
+        return TraceProgram(argv, opts, {}, nullptr);
+    }
+
+    // traced is set in the tracer once the trace has run, the forked tracee returns 0 if argv is null
+    int TraceLaunched(char** argv, const struct TOptions& opts, const TCallbacks& callbacks, TReport* report, bool& traced) {
         bool useSecComp = false;
         if (opts.UseSecComp && KernelVerGreaterOrEqual("3.5.0-0")) {
             useSecComp = true;
         }
 
+        // Writes accounted by events are not trapped. The perf engine still traps syscalls that can't be accounted
+        // after they are done, the fanotify one traps only write-mode opens to record the sizes files are opened with.
+        std::unique_ptr<TEventSource> events;
+        if (!CreateEventSource(opts, events)) {
+            return 2;
+        }
+        const bool recordsOpens = events && events->RecordsOpens();
+        // The filter is compiled before fork, so the tracee isn't lost if it can't be
+        TBpfProgram filter;
+        if (useSecComp) {
+            filter = CompileBpfProgram(recordsOpens ? GetOpenRules() : GetTracingRules(!!events));
+            if (filter.empty()) {
+                std::cerr << "Seccomp filter is too long, all syscalls are trapped" << std::endl;
+                useSecComp = false;
+            }
+        }
+        // Without seccomp such tracees get no filter and are always resumed with PTRACE_CONT,
+        // sizes of the opened files are guessed then
+        if (recordsOpens) {
+            useSecComp = true;
+        }
+
         sigset_t oldmask, newmask;
         sigfillset(&newmask);
         // block all signals
         assert(sigprocmask(SIG_SETMASK, &newmask, &oldmask) == 0);
 
-        TraceePid = fork();
-        if (TraceePid < 0) {
+        const pid_t traceePid = fork();
+        if (traceePid < 0) {
             std::cerr << "fork failed: " << strerror(errno) << std::endl;
-            exit(2);
-        } else if (TraceePid == 0) {
+            sigprocmask(SIG_SETMASK, &oldmask, nullptr);
+            return 2;
+        } else if (traceePid == 0) {
             // restore signal mask in the child
             assert(sigprocmask(SIG_SETMASK, &oldmask, nullptr) == 0);
-            RunTracee(argv, useSecComp);
+            RunTracee(argv, filter);
             return 0;
         }
 
-        SetupTracer(TraceePid, opts, useSecComp);
+        long long busyWaitNs;
+        if (!SetupTracer(traceePid, opts, useSecComp) || !SetupTracerScheduling(opts, busyWaitNs) ||
+            (events && !events->Follow(traceePid))) {
+            return AbortTracee(traceePid, oldmask);
+        }
 
+        std::vector<int> forwarded = opts.ForwardingSignals;
         if (opts.ForwardAllSignals) {
-            std::vector<int> signals {SIGHUP, SIGINT, SIGQUIT, SIGILL, SIGABRT, SIGFPE, SIGSEGV, SIGPIPE, SIGALRM, SIGTERM, SIGUSR1, SIGUSR2};
-            SetupSignalForwarding(signals);
-        } else if (!opts.ForwardingSignals.empty()) {
-            SetupSignalForwarding(opts.ForwardingSignals);
+            forwarded = {SIGHUP, SIGINT, SIGQUIT, SIGILL, SIGABRT, SIGFPE, SIGSEGV, SIGPIPE, SIGALRM, SIGTERM, SIGUSR1, SIGUSR2};
+        }
+        std::vector<int> window;
+        if (opts.Usr1Stop) {
+            window.push_back(SIGUSR1);
         }
-        // restore signal mask in the parent
-        assert(sigprocmask(SIG_SETMASK, &oldmask, nullptr) == 0);
+        // Restores the signal mask in the parent except for the signals read by the loop
+        TEventLoop loop(oldmask, traceePid, forwarded, window, opts.Duration);
+        if (!loop.IsValid()) {
+            return AbortTracee(traceePid, oldmask);
+        }
+
+        TContext context(opts, callbacks, report);
+        context.RegisterTracee(traceePid);
 
-        TContext context(opts);
-        context.RegisterTracee(TraceePid);
+        int rc = RunTracer(context, traceePid, {}, opts.FollowForks, opts.WaitDaemons, useSecComp, events.get(), nullptr, loop, busyWaitNs);
+        if (events) {
+            events->Finish(context);
+        }
+        traced = true;
+        return context.PostProcess(rc);
+    }
 
-        int rc = RunTracer(context, TraceePid, opts.FollowForks, opts.WaitDaemons, useSecComp);
-        rc = context.PostProcess(rc);
+    int TraceProgram(char** argv, const struct TOptions opts, const TCallbacks& callbacks, TReport* report) {
+        bool traced = false;
+        return TraceLaunched(argv, opts, callbacks, report, traced);
+    }
 
-        if (argv) {
-            return rc;
-        } else {
+    int TraceMe(const struct TOptions opts) {
+        bool traced = false;
+        const int rc = TraceLaunched(nullptr, opts, {}, nullptr, traced);
+        // The caller goes on as the tracee, or untraced if the trace can't be set up
+        if (traced) {
             _exit(rc);
         }
+        return rc;
+    }
+
+    int TraceProcesses(const struct TOptions opts) {
+        return TraceProcesses(opts, {}, nullptr);
+    }
+
+    int TraceProcesses(const struct TOptions opts, const TCallbacks& callbacks, TReport* report) {
+        const long ptraceOpts = GetPtraceOptions(opts, false, true);
+        std::unique_ptr<TEventSource> events;
+        long long busyWaitNs;
+        if (!CreateEventSource(opts, events) || !SetupTracerScheduling(opts, busyWaitNs)) {
+            return 2;
+        }
+
+        TCgroupWatch cgroups = {{}, ptraceOpts, opts.FollowForks};
+        for (const auto& path : opts.Cgroups) {
+            std::string dir = ResolveCgroupDir(path);
+            if (dir.empty()) {
+                std::cerr << "Cgroup " << path << " is not found in the unified hierarchy" << std::endl;
+                return 2;
+            }
+            cgroups.Dirs.push_back(dir);
+        }
+
+        sigset_t oldmask, newmask;
+        sigfillset(&newmask);
+        // block all signals while seizing
+        assert(sigprocmask(SIG_SETMASK, &newmask, &oldmask) == 0);
+
+        TContext context(opts, callbacks, report);
+        std::unordered_set<pid_t> seized;
+
+        for (pid_t pid : opts.AttachPids) {
+            if (seized.find(pid) != seized.end()) {
+                continue;
+            }
+            if (!SeizeProcessTree(context, pid, 0, ptraceOpts, opts.FollowForks, seized)) {
+                std::cerr << "ptrace(PTRACE_SEIZE, " << pid << ", ...) failed: " << strerror(errno) << std::endl;
+                return ReleaseSeized(context, seized, oldmask);
+            }
+        }
+
+        SeizeCgroupProcesses(context, cgroups, seized);
+
+        // Processes are not ours, so stop tracing them instead of forwarding the signal
+        std::vector<int> window = {SIGINT, SIGTERM};
+        if (opts.Usr1Stop) {
+            window.push_back(SIGUSR1);
+        }
+        TEventLoop loop(oldmask, 0, {}, window, opts.Duration);
+        if (!loop.IsValid()) {
+            return ReleaseSeized(context, seized, oldmask);
+        }
+
+        // Seized tracees have no filter, so PTRACE_CONT keeps them running between lifecycle events
+        int rc = RunTracer(context, 0, seized, opts.FollowForks, opts.WaitDaemons, !!events, events.get(),
+                           cgroups.Dirs.empty() ? nullptr : &cgroups, loop, busyWaitNs);
+        if (events) {
+            events->Finish(context);
+        }
+        return context.PostProcess(rc);
     }
 }
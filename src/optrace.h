@@ -1,27 +1,140 @@
 #pragma once
 
+#include <functional>
+#include <map>
 #include <string>
 #include <vector>
 
+#include <csignal>
+
+#include <sys/types.h>
+
 namespace NOPTrace {
+    // How writes are accounted
+    enum class EEngine {
+        // Syscalls are trapped by ptrace with seccomp filter
+        Ptrace,
+        // fanotify events, ptrace follows process lifecycle and write-mode opens of launched programs
+        Fanotify,
+        // raw_syscalls tracepoints read by perf, ptrace follows only process lifecycle
+        Perf,
+    };
+
+    // Budget for the output of files matching Pattern (fnmatch), writer gets Signal when it's exceeded
+    struct TQuota {
+        std::string Pattern;
+        size_t Limit;
+        int Signal;
+    };
+
+    // Bandwidth of writes to files or by processes matching Pattern (fnmatch)
+    struct TThrottle {
+        std::string Pattern;
+        // Bytes per second
+        size_t Rate;
+    };
+
+    // Defaults are the ones of the command line
     struct TOptions {
         std::string Output;
-        bool AppendOutput;
-        bool FollowForks;
-        bool WaitDaemons;
-        bool JailForks;
-        bool HumanReadableSizes;
-        int FilesInReport;
-        int CommandLengthLimit;
-        bool UseSecComp;
-        bool SearchForCoreDumps;
-        std::vector<int> ForwardingSignals;
-        bool ForwardAllSignals;
-        bool StoreEmptyFiles;
-        std::string InterruptionTarget;
-        int InterruptionSignal;
+        bool AppendOutput = false;
+        bool FollowForks = true;
+        bool WaitDaemons = false;
+        bool JailForks = true;
+        bool HumanReadableSizes = false;
+        int FilesInReport = -1;
+        int CommandLengthLimit = 120;
+        bool UseSecComp = true;
+        bool SearchForCoreDumps = true;
+        std::vector<int> ForwardingSignals = {SIGINT};
+        bool ForwardAllSignals = false;
+        bool StoreEmptyFiles = false;
+        // Opening any of these files (fnmatch) in write mode interrupts the process
+        std::vector<std::string> InterruptionTargets;
+        int InterruptionSignal = SIGABRT;
+        std::vector<pid_t> AttachPids;
+        std::vector<std::string> Cgroups;
+        // The first matching quota is applied to a file
+        std::vector<TQuota> Quotas;
+        // 0 for unlimited
+        size_t MaxFileSize = 0;
+        int MaxFileSizeSignal = SIGXFSZ;
+        // Throttles of file paths and of process names (comm), the first matching one of each kind is applied
+        std::vector<TThrottle> Throttles;
+        std::vector<TThrottle> ProcThrottles;
+        // Free space of filesystems with traced files below which the largest writer is interrupted,
+        // either in bytes or in percent of the filesystem size, 0 if unset
+        size_t MinFree = 0;
+        bool MinFreePercent = false;
+        int Duration = 0;
+        // SIGUSR1 closes the tracing window, it is not reopened by later signals
+        bool Usr1Stop = false;
+        EEngine Engine = EEngine::Ptrace;
+        // CPU the tracer is pinned to, -1 for any
+        int TracerCpu = -1;
+        // Tracer runs with SCHED_FIFO, so it preempts tracees waiting for it
+        bool TracerFifo = false;
+        // Tracee stops are polled for this long before the tracer sleeps, while they come back-to-back.
+        // Ignored if the process may run on a single CPU, the tracee couldn't run while the tracer polls then.
+        long BusyWaitUs = 0;
+        // Collector address ("unix:PATH") the files and totals are streamed to instead of the report,
+        // empty for the local report
+        std::string Sink;
     };
 
+    // Output of a file as in the report
+    struct TReportFile {
+        std::string Filename;
+        size_t Size;
+        // Size is taken from the file size, not from traced writes
+        bool Estimated;
+        pid_t Pid;
+        pid_t Ppid;
+        std::string CommandLine;
+        // Known only if cgroups are traced
+        std::string Cgroup;
+        // Empty if the mount is unknown
+        std::string MountPoint;
+    };
+
+    // Result of the trace, files are sorted by size in descending order and limited by FilesInReport
+    struct TReport {
+        std::vector<TReportFile> Files;
+        size_t TotalOutput = 0;
+        std::map<std::string, size_t> CgroupOutput;
+        std::map<std::string, size_t> MountOutput;
+    };
+
+    enum class ELimit {
+        Quota,
+        MaxFileSize,
+        MinFree,
+    };
+
+    // Callbacks are called by the tracer loop as events are accounted, any of them may be empty.
+    // Writes aren't reported with fanotify engine, files are reported only when they are closed then.
+    struct TCallbacks {
+        // File is opened in write mode
+        std::function<void(pid_t pid, int fd, const std::string& filename)> OnOpen;
+        std::function<void(pid_t pid, int fd, const std::string& filename, size_t nbytes)> OnWrite;
+        // The last descriptor of the file is closed, its output is final
+        std::function<void(const TReportFile& file)> OnClose;
+        std::function<void(pid_t pid, const std::string& commandLine)> OnExec;
+        // Process writing the file is signalled for exceeding the limit
+        std::function<void(pid_t pid, ELimit limit, const std::string& filename)> OnLimit;
+    };
+
+    // Calling process goes on as the tracee, the tracer is its forked parent which exits with the result of the trace
     int TraceMe(const struct TOptions opts);
     int TraceProgram(char** argv, const struct TOptions opts);
+    int TraceProcesses(const struct TOptions opts);
+
+    // Tracer runs in the calling process, the report is returned in report instead of being printed if it's given.
+    // SIGCHLD, the window and the forwarded signals are blocked and read from a signalfd while tracing,
+    // signal handlers are left untouched.
+    // Only tracees are waited for, other children of the process are left to it, but their SIGCHLD is consumed.
+    // With null argv the process is forked: the child returns 0 and goes on as the tracee, the parent traces it.
+    // Setup errors are printed and 2 is returned, the launched program is killed then and seized ones are detached.
+    int TraceProgram(char** argv, const struct TOptions opts, const TCallbacks& callbacks, TReport* report);
+    int TraceProcesses(const struct TOptions opts, const TCallbacks& callbacks, TReport* report);
 }
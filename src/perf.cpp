@@ -0,0 +1,291 @@
+#include "perf.h"
+#include "context.h"
+#include "syscall.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include <linux/perf_event.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Support ubuntu-10
+#ifndef PERF_FLAG_FD_CLOEXEC
+    #define PERF_FLAG_FD_CLOEXEC (1UL << 3)
+#endif
+
+namespace NOPTrace {
+    namespace {
+        // Ring buffer size in pages, must be a power of two
+        const size_t RING_PAGES = 256;
+        // Tracer is woken up when a quarter of the ring is filled
+        const size_t WAKEUP_PAGES = RING_PAGES / 4;
+
+        // Layout of raw_syscalls:sys_enter and raw_syscalls:sys_exit records
+        struct TRawSyscall {
+            uint16_t CommonType;
+            uint8_t CommonFlags;
+            uint8_t CommonPreemptCount;
+            int32_t CommonPid;
+            int64_t Id;
+            // Return value for sys_exit
+            uint64_t Args[6];
+        };
+
+        // PERF_SAMPLE_TID | PERF_SAMPLE_TIME | PERF_SAMPLE_RAW
+        struct TSampleRecord {
+            struct perf_event_header Header;
+            uint32_t Pid;
+            uint32_t Tid;
+            uint64_t Time;
+            uint32_t Size;
+        };
+        // Raw data is not aligned, it follows the size field right away
+        const size_t RAW_OFFSET = offsetof(TSampleRecord, Size) + sizeof(uint32_t);
+
+        size_t GetPageSize() {
+            static const size_t pageSize = sysconf(_SC_PAGESIZE);
+            return pageSize;
+        }
+
+        // 0 if the tracepoint isn't found
+        unsigned ReadTracepointId(const std::string& name) {
+            for (const char* tracefs : {"/sys/kernel/tracing", "/sys/kernel/debug/tracing"}) {
+                std::ifstream file(std::string(tracefs) + "/events/" + name + "/id");
+                unsigned id;
+                if (file >> id) {
+                    return id;
+                }
+            }
+            std::cerr << "Tracepoint " << name << " is not found, tracefs must be mounted" << std::endl;
+            return 0;
+        }
+
+        // Copies data out of the ring, which might wrap at its end
+        void CopyFromRing(const char* data, size_t size, uint64_t pos, void* buff, size_t len) {
+            const size_t offset = pos & (size - 1);
+            const size_t head = std::min(len, size - offset);
+            memcpy(buff, data + offset, head);
+            memcpy(static_cast<char*>(buff) + head, data, len - head);
+        }
+    }
+
+    TPerfSource::TPerfSource() noexcept {
+        EnterId = ReadTracepointId("raw_syscalls/sys_enter");
+        ExitId = ReadTracepointId("raw_syscalls/sys_exit");
+
+        std::stringstream filter;
+        for (const auto& info : SyscallTable) {
+            if (IsDeferrableSyscall(info.Class)) {
+                filter << (filter.tellp() ? " || " : "") << "id == " << info.Nr;
+            }
+        }
+        Filter = filter.str();
+
+        Rings.resize(sysconf(_SC_NPROCESSORS_CONF));
+
+        EpollFd = epoll_create1(EPOLL_CLOEXEC);
+        if (EpollFd < 0) {
+            std::cerr << "epoll_create1 failed: " << strerror(errno) << std::endl;
+        }
+    }
+
+    bool TPerfSource::IsValid() const noexcept {
+        return EnterId && ExitId && EpollFd >= 0;
+    }
+
+    TPerfSource::~TPerfSource() {
+        Close();
+        close(EpollFd);
+    }
+
+    int TPerfSource::OpenEvent(unsigned id, pid_t pid, int cpu) const noexcept {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_TRACEPOINT;
+        attr.size = sizeof(attr);
+        attr.config = id;
+        attr.sample_period = 1;
+        attr.sample_type = PERF_SAMPLE_TID | PERF_SAMPLE_TIME | PERF_SAMPLE_RAW;
+        attr.inherit = 1;
+        attr.watermark = 1;
+        attr.wakeup_watermark = WAKEUP_PAGES * GetPageSize();
+        // Samples of all cpus are merged, so they need the same clock
+        attr.use_clockid = 1;
+        attr.clockid = CLOCK_MONOTONIC;
+
+        int fd = syscall(SYS_perf_event_open, &attr, pid, cpu, -1, PERF_FLAG_FD_CLOEXEC);
+        if (fd < 0) {
+            return -1;
+        }
+        // Syscalls are filtered by the tracer anyway, so the kernel filter is an optimization only
+        ioctl(fd, PERF_EVENT_IOC_SET_FILTER, Filter.c_str());
+        return fd;
+    }
+
+    bool TPerfSource::Follow(pid_t pid) noexcept {
+        if (Finished) {
+            return true;
+        }
+
+        for (size_t cpu = 0; cpu < Rings.size(); cpu++) {
+            for (unsigned id : {EnterId, ExitId}) {
+                int fd = OpenEvent(id, pid, cpu);
+                if (fd < 0) {
+                    // Offline cpu
+                    if (errno == ENODEV) {
+                        break;
+                    }
+                    std::cerr << "perf_event_open(" << pid << ", " << cpu << ") failed: " << strerror(errno) << std::endl;
+                    return false;
+                }
+                Fds.push_back(fd);
+
+                auto& ring = Rings[cpu];
+                if (ring.Fd >= 0) {
+                    if (ioctl(fd, PERF_EVENT_IOC_SET_OUTPUT, ring.Fd) < 0) {
+                        std::cerr << "PERF_EVENT_IOC_SET_OUTPUT failed: " << strerror(errno) << std::endl;
+                        return false;
+                    }
+                    continue;
+                }
+
+                void* base = mmap(nullptr, (RING_PAGES + 1) * GetPageSize(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                if (base == MAP_FAILED) {
+                    std::cerr << "mmap of perf ring buffer failed: " << strerror(errno) << std::endl;
+                    return false;
+                }
+                ring.Fd = fd;
+                ring.Base = static_cast<char*>(base);
+
+                struct epoll_event ev;
+                memset(&ev, 0, sizeof(ev));
+                ev.events = EPOLLIN;
+                ev.data.fd = fd;
+                epoll_ctl(EpollFd, EPOLL_CTL_ADD, fd, &ev);
+            }
+        }
+        return true;
+    }
+
+    int TPerfSource::GetFd() const noexcept {
+        return EpollFd;
+    }
+
+    void TPerfSource::ReadRing(TRing& ring, std::vector<TSample>& samples) noexcept {
+        auto meta = reinterpret_cast<struct perf_event_mmap_page*>(ring.Base);
+        const char* data = ring.Base + GetPageSize();
+        const size_t size = RING_PAGES * GetPageSize();
+
+        const uint64_t head = __atomic_load_n(&meta->data_head, __ATOMIC_ACQUIRE);
+        uint64_t tail = meta->data_tail;
+
+        while (tail < head) {
+            struct perf_event_header header;
+            CopyFromRing(data, size, tail, &header, sizeof(header));
+
+            if (header.type == PERF_RECORD_LOST && !Lost) {
+                std::cerr << "perf ring buffer overflow, report is incomplete" << std::endl;
+                Lost = true;
+            } else if (header.type == PERF_RECORD_SAMPLE && header.size >= RAW_OFFSET) {
+                TSampleRecord record;
+                TRawSyscall raw;
+                CopyFromRing(data, size, tail, &record, RAW_OFFSET);
+
+                // sys_exit has only the return value after the id
+                const size_t rawSize = std::min<size_t>({record.Size, sizeof(raw), header.size - RAW_OFFSET});
+                if (rawSize <= offsetof(TRawSyscall, Args)) {
+                    tail += header.size;
+                    continue;
+                }
+                memset(&raw, 0, sizeof(raw));
+                CopyFromRing(data, size, tail + RAW_OFFSET, &raw, rawSize);
+
+                TSample sample;
+                sample.Time = record.Time;
+                sample.Tid = record.Tid;
+                sample.Exit = raw.CommonType == ExitId;
+                sample.Nr = raw.Id;
+                memcpy(sample.Args, raw.Args, sizeof(sample.Args));
+                samples.push_back(sample);
+            }
+            tail += header.size;
+        }
+
+        __atomic_store_n(&meta->data_tail, tail, __ATOMIC_RELEASE);
+    }
+
+    void TPerfSource::Drain(TContext& context) noexcept {
+        if (Finished) {
+            return;
+        }
+
+        std::vector<TSample> samples;
+        for (auto& ring : Rings) {
+            if (ring.Base) {
+                ReadRing(ring, samples);
+            }
+        }
+
+        // Thread might migrate between cpus in the middle of a syscall
+        std::stable_sort(samples.begin(), samples.end(), [](const TSample& lhs, const TSample& rhs) {
+            return lhs.Time < rhs.Time;
+        });
+
+        for (const auto& sample : samples) {
+            if (!IsDeferrableSyscall(GetSyscallInfo(sample.Nr).Class) || !context.GetProcInfo(sample.Tid)) {
+                continue;
+            }
+
+            if (!sample.Exit) {
+                struct user_regs_struct& registers = Pending[sample.Tid];
+                memset(&registers, 0, sizeof(registers));
+                SetSyscallArgs(registers, sample.Args);
+                SYSCALL_NR(registers) = sample.Nr;
+                context.SyscallEnter(sample.Tid, registers);
+                continue;
+            }
+
+            // Syscall entered before the events were opened
+            auto it = Pending.find(sample.Tid);
+            if (it == Pending.end() || SYSCALL_NR(it->second) != sample.Nr) {
+                continue;
+            }
+            SYSCALL_RETDATA(it->second) = sample.Args[0];
+            context.SyscallExit(sample.Tid, it->second);
+            Pending.erase(it);
+        }
+    }
+
+    void TPerfSource::Close() noexcept {
+        for (auto& ring : Rings) {
+            if (ring.Base) {
+                munmap(ring.Base, (RING_PAGES + 1) * GetPageSize());
+                ring.Base = nullptr;
+            }
+        }
+        for (int fd : Fds) {
+            close(fd);
+        }
+        Fds.clear();
+    }
+
+    void TPerfSource::Finish(TContext& context) noexcept {
+        if (Finished) {
+            return;
+        }
+
+        Drain(context);
+        Finished = true;
+        // Tracees might still run in pass-through mode
+        Close();
+    }
+}
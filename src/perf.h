@@ -0,0 +1,60 @@
+#pragma once
+
+#include "events.h"
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/user.h>
+
+namespace NOPTrace {
+    // Deferrable syscalls are read from raw_syscalls tracepoints through per-CPU perf ring buffers,
+    // the rest of syscalls is trapped by ptrace. Events are inherited by all children and threads
+    // of the followed tracees.
+    class TPerfSource : public TEventSource {
+    public:
+        TPerfSource() noexcept;
+        ~TPerfSource();
+
+        bool IsValid() const noexcept override;
+        bool Follow(pid_t pid) noexcept override;
+        int GetFd() const noexcept override;
+        void Drain(TContext& context) noexcept override;
+        void Finish(TContext& context) noexcept override;
+
+    private:
+        struct TRing {
+            int Fd = -1;
+            char* Base = nullptr;
+        };
+
+        struct TSample {
+            unsigned long long Time;
+            pid_t Tid;
+            bool Exit;
+            unsigned long long Nr;
+            // Return value is the first one at exit
+            unsigned long long Args[6];
+        };
+
+        int OpenEvent(unsigned id, pid_t pid, int cpu) const noexcept;
+        void ReadRing(TRing& ring, std::vector<TSample>& samples) noexcept;
+        void Close() noexcept;
+
+    private:
+        int EpollFd;
+        unsigned EnterId;
+        unsigned ExitId;
+        // Only deferrable syscalls are sampled
+        std::string Filter;
+        // Indexed by cpu, the buffer is owned by the first sys_enter event on the cpu
+        std::vector<TRing> Rings;
+        std::vector<int> Fds;
+        // Registers of the syscalls being executed, arguments are not sampled at exit
+        std::unordered_map<pid_t, struct user_regs_struct> Pending;
+        bool Lost = false;
+        bool Finished = false;
+    };
+}
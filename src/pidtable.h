@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cassert>
+#include <memory>
+#include <vector>
+
+#include <sys/types.h>
+
+namespace NOPTrace {
+    // Table indexed by pid. Pids are dense numbers bounded by pid_max, so entries are kept in pages
+    // which are allocated on the first use and freed when they get empty. Lookup is two loads.
+    template <class T>
+    class TPidTable {
+    public:
+        // nullptr if there is no such entry
+        T* Find(pid_t pid) noexcept {
+            TPage* page = GetPage(pid);
+            if (!page || !page->Used[pid & PID_PAGE_MASK]) {
+                return nullptr;
+            }
+            return &page->Values[pid & PID_PAGE_MASK];
+        }
+
+        const T* Find(pid_t pid) const noexcept {
+            return const_cast<TPidTable*>(this)->Find(pid);
+        }
+
+        // Default constructed entry is inserted if there is no such
+        T& operator[](pid_t pid) noexcept {
+            return Emplace(pid).first;
+        }
+
+        // Returns the entry and whether it's inserted
+        std::pair<T&, bool> Emplace(pid_t pid) noexcept {
+            assert(pid >= 0);
+            const size_t index = pid >> PID_PAGE_BITS;
+            if (index >= Pages.size()) {
+                Pages.resize(index + 1);
+            }
+            if (!Pages[index]) {
+                Pages[index].reset(new TPage());
+            }
+
+            TPage& page = *Pages[index];
+            const size_t slot = pid & PID_PAGE_MASK;
+            if (page.Used[slot]) {
+                return {page.Values[slot], false};
+            }
+            page.Used[slot] = true;
+            page.Count++;
+            Size++;
+            return {page.Values[slot], true};
+        }
+
+        void Erase(pid_t pid) noexcept {
+            TPage* page = GetPage(pid);
+            if (!page || !page->Used[pid & PID_PAGE_MASK]) {
+                return;
+            }
+            page->Values[pid & PID_PAGE_MASK] = T();
+            page->Used[pid & PID_PAGE_MASK] = false;
+            Size--;
+            if (!--page->Count) {
+                Pages[pid >> PID_PAGE_BITS].reset();
+            }
+        }
+
+        // Calls func(pid, value) for every entry, the current one may be erased by func
+        template <class TFunc>
+        void ForEach(TFunc func) {
+            for (size_t index = 0; index < Pages.size(); index++) {
+                for (size_t slot = 0; slot < PID_PAGE_SLOTS && Pages[index]; slot++) {
+                    if (Pages[index]->Used[slot]) {
+                        func(pid_t(index << PID_PAGE_BITS | slot), Pages[index]->Values[slot]);
+                    }
+                }
+            }
+        }
+
+        size_t GetSize() const noexcept {
+            return Size;
+        }
+
+        bool Empty() const noexcept {
+            return !Size;
+        }
+
+    private:
+        static const size_t PID_PAGE_BITS = 10;
+        static const size_t PID_PAGE_SLOTS = 1 << PID_PAGE_BITS;
+        static const size_t PID_PAGE_MASK = PID_PAGE_SLOTS - 1;
+
+        struct TPage {
+            T Values[PID_PAGE_SLOTS];
+            bool Used[PID_PAGE_SLOTS] = {};
+            size_t Count = 0;
+        };
+
+        TPage* GetPage(pid_t pid) const noexcept {
+            const size_t index = pid >> PID_PAGE_BITS;
+            return index < Pages.size() ? Pages[index].get() : nullptr;
+        }
+
+    private:
+        std::vector<std::unique_ptr<TPage>> Pages;
+        size_t Size = 0;
+    };
+}
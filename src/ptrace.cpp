@@ -8,12 +8,12 @@
 #include <sys/uio.h>
 
 namespace NOPTrace {
+    // Errors other than a vanished tracee are printed, the caller handles both as a lost tracee
     long PtraceSafeCall(decltype(PTRACE_SYSCALL) request, pid_t pid, void* addr, void* data) noexcept {
         long res = ptrace(request, pid, addr, data);
         if (res == -1) {
             if (errno != ESRCH) {
                 std::cerr << "ptrace(" << request << ", " << pid << ", ...) failed: " << strerror(errno) << std::endl;
-                exit(2);
             }
             return -1;
         }
@@ -28,6 +28,23 @@ namespace NOPTrace {
         return PtraceSafeCall(PTRACE_CONT, pid, 0, reinterpret_cast<void*>(signal));
     }
 
+    long PtraceSeize(pid_t pid, long opts) noexcept {
+        // Process might be already traced or not permitted to be traced - let the caller decide
+        return ptrace(PTRACE_SEIZE, pid, 0, reinterpret_cast<void*>(opts));
+    }
+
+    long PtraceInterrupt(pid_t pid) noexcept {
+        return PtraceSafeCall(PTRACE_INTERRUPT, pid, 0, 0);
+    }
+
+    long PtraceListen(pid_t pid) noexcept {
+        return PtraceSafeCall(PTRACE_LISTEN, pid, 0, 0);
+    }
+
+    long PtraceDetach(pid_t pid, int signal) noexcept {
+        return PtraceSafeCall(PTRACE_DETACH, pid, 0, reinterpret_cast<void*>(signal));
+    }
+
     long PtraceGetEventMsg(pid_t pid) noexcept {
         long data = 0;
         if (PtraceSafeCall(PTRACE_GETEVENTMSG, pid, 0, reinterpret_cast<void*>(&data)) < 0) {
@@ -58,18 +75,20 @@ namespace NOPTrace {
         return PtraceSafeCall(PTRACE_SETREGSET, pid, reinterpret_cast<void*>(1), reinterpret_cast<void*>(&iov));
     }
 
+    // Called by the forked tracee, which exits without running the handlers of the tracer
     void PtraceTraceMe() noexcept {
         if (ptrace(PTRACE_TRACEME, 0, 0, 0) < 0) {
             perror("ptrace(PTRACE_TRACEME, ...) failed:");
-            exit(2);
+            _exit(2);
         }
     }
 
-    void PtraceSetOptions(pid_t pid, long opts) noexcept {
+    bool PtraceSetOptions(pid_t pid, long opts) noexcept {
         if (ptrace(PTRACE_SETOPTIONS, pid, 0, opts) < 0) {
             std::cerr << "ptrace(PTRACE_SETOPTIONS, " << pid << ", 0, " << opts << ") failed: " << strerror(errno) << std::endl;
-            exit(2);
+            return false;
         }
+        return true;
     }
 
 #define PTRACE_EVENT_CASE(x) \
@@ -83,6 +102,7 @@ namespace NOPTrace {
             PTRACE_EVENT_CASE(PTRACE_EVENT_EXIT);
             PTRACE_EVENT_CASE(PTRACE_EVENT_FORK);
             PTRACE_EVENT_CASE(PTRACE_EVENT_SECCOMP);
+            PTRACE_EVENT_CASE(PTRACE_EVENT_STOP);
             PTRACE_EVENT_CASE(PTRACE_EVENT_VFORK);
             PTRACE_EVENT_CASE(PTRACE_EVENT_VFORK_DONE);
             default:
@@ -17,9 +17,23 @@
     #define PTRACE_O_TRACESECCOMP 0x80
 #endif
 
+#ifndef PTRACE_SEIZE
+    #define PTRACE_SEIZE 0x4206
+    #define PTRACE_INTERRUPT 0x4207
+    #define PTRACE_LISTEN 0x4208
+#endif
+
+#ifndef PTRACE_EVENT_STOP
+    #define PTRACE_EVENT_STOP 128
+#endif
+
 namespace NOPTrace {
     void PtraceTraceMe() noexcept;
-    void PtraceSetOptions(pid_t pid, long opts) noexcept;
+    bool PtraceSetOptions(pid_t pid, long opts) noexcept;
+    long PtraceSeize(pid_t pid, long opts) noexcept;
+    long PtraceInterrupt(pid_t pid) noexcept;
+    long PtraceListen(pid_t pid) noexcept;
+    long PtraceDetach(pid_t pid, int signal) noexcept;
     long PtraceRestartSyscall(pid_t pid, int signal) noexcept;
     long PtraceContinueSyscall(pid_t pid, int signal) noexcept;
     long PtraceGetEventMsg(pid_t pid) noexcept;
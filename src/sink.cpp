@@ -0,0 +1,155 @@
+#include "sink.h"
+#include "utils.h"
+
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+
+#include <sys/time.h>
+#include <unistd.h>
+
+namespace NOPTrace {
+    // Tracees wait while the tracer is blocked in send, a stuck collector is dropped after this
+    const long SINK_SEND_TIMEOUT_MS = 100;
+
+    void TSinkWriter::Put(uint64_t value) noexcept {
+        do {
+            char byte = value & 0x7f;
+            value >>= 7;
+            Data.push_back(value ? byte | 0x80 : byte);
+        } while (value);
+    }
+
+    void TSinkWriter::Put(const std::string& value) noexcept {
+        Put(value.size());
+        Data.append(value);
+    }
+
+    bool TSinkReader::Get(ESinkRecord& type) noexcept {
+        if (Pos == End) {
+            return false;
+        }
+        type = static_cast<ESinkRecord>(*Pos++);
+        return true;
+    }
+
+    bool TSinkReader::Get(uint64_t& value) noexcept {
+        value = 0;
+        for (unsigned shift = 0; Pos != End && shift < 64; shift += 7) {
+            const unsigned char byte = *Pos++;
+            value |= uint64_t(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool TSinkReader::Get(std::string& value) noexcept {
+        uint64_t len;
+        if (!Get(len) || len > uint64_t(End - Pos)) {
+            return false;
+        }
+        value.assign(Pos, len);
+        Pos += len;
+        return true;
+    }
+
+    void PutReportFile(TSinkWriter& writer, const TReportFile& file) noexcept {
+        writer.Put(file.Size);
+        writer.Put(file.Estimated);
+        writer.Put(file.Pid);
+        writer.Put(file.Ppid);
+        writer.Put(file.Filename);
+        writer.Put(file.CommandLine);
+        writer.Put(file.Cgroup);
+        writer.Put(file.MountPoint);
+    }
+
+    bool GetReportFile(TSinkReader& reader, TReportFile& file) noexcept {
+        uint64_t size, estimated, pid, ppid;
+        if (!reader.Get(size) || !reader.Get(estimated) || !reader.Get(pid) || !reader.Get(ppid)) {
+            return false;
+        }
+        file.Size = size;
+        file.Estimated = estimated;
+        file.Pid = pid;
+        file.Ppid = ppid;
+        return reader.Get(file.Filename) && reader.Get(file.CommandLine) && reader.Get(file.Cgroup) && reader.Get(file.MountPoint);
+    }
+
+    bool ParseSinkAddress(const std::string& address, struct sockaddr_un& addr, socklen_t& len) noexcept {
+        const std::string scheme = "unix:";
+        if (address.compare(0, scheme.size(), scheme) != 0) {
+            return false;
+        }
+        std::string path = address.substr(scheme.size());
+        if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+            return false;
+        }
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        memcpy(addr.sun_path, path.data(), path.size());
+        if (path[0] == '@') {
+            addr.sun_path[0] = '\0';
+        }
+        len = offsetof(struct sockaddr_un, sun_path) + path.size() + (path[0] == '@' ? 0 : 1);
+        return true;
+    }
+
+    int ConnectSink(const std::string& address) noexcept {
+        struct sockaddr_un addr;
+        socklen_t len;
+        if (!ParseSinkAddress(address, addr, len)) {
+            errno = EINVAL;
+            return -1;
+        }
+
+        int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            return -1;
+        }
+        if (connect(fd, (struct sockaddr*)&addr, len) < 0) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    TSink::TSink(const std::string& address) noexcept
+        : Address(address)
+        , Fd(ConnectSink(address))
+    {
+        if (Fd < 0) {
+            std::cerr << "optrace: collector at " << Address << " is unavailable (" << strerror(errno) << "), reporting locally" << std::endl;
+            return;
+        }
+
+        struct timeval timeout = {0, SINK_SEND_TIMEOUT_MS * 1000};
+        setsockopt(Fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        TSinkWriter session(ESinkRecord::Session);
+        session.Put(getpid());
+        session.Put(GetCommandLine(getpid(), -1));
+        Send(session);
+    }
+
+    TSink::~TSink() {
+        if (Fd >= 0) {
+            close(Fd);
+        }
+    }
+
+    void TSink::Send(const TSinkWriter& record) noexcept {
+        if (Fd < 0) {
+            return;
+        }
+        const std::string& data = record.GetData();
+        if (send(Fd, data.data(), data.size(), MSG_NOSIGNAL) != (ssize_t)data.size()) {
+            std::cerr << "optrace: collector at " << Address << " is lost (" << strerror(errno) << "), reporting locally" << std::endl;
+            close(Fd);
+            Fd = -1;
+        }
+    }
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "optrace.h"
+
+#include <cstdint>
+#include <string>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+namespace NOPTrace {
+    // Collector protocol: one record per message of a unix seqpacket socket. A record is its type followed by
+    // varint numbers and length-prefixed strings. Tracing sessions send Session once, File for every accounted file
+    // and Totals at the end. Readers send Query and read the report as text until the collector closes the socket.
+    enum class ESinkRecord : uint8_t {
+        // Tracer pid, tracer command line
+        Session = 1,
+        // TReportFile fields
+        File = 2,
+        // Total output
+        Totals = 3,
+        // Number of entries to print, session id or 0 for the whole host
+        Query = 4,
+    };
+
+    class TSinkWriter {
+    public:
+        explicit TSinkWriter(ESinkRecord type) noexcept {
+            Data.push_back(static_cast<char>(type));
+        }
+
+        void Put(uint64_t value) noexcept;
+        void Put(const std::string& value) noexcept;
+
+        const std::string& GetData() const noexcept {
+            return Data;
+        }
+
+    private:
+        std::string Data;
+    };
+
+    class TSinkReader {
+    public:
+        TSinkReader(const char* data, size_t size) noexcept
+            : Pos(data)
+            , End(data + size)
+        {
+        }
+
+        // false if the record is truncated
+        bool Get(ESinkRecord& type) noexcept;
+        bool Get(uint64_t& value) noexcept;
+        bool Get(std::string& value) noexcept;
+
+    private:
+        const char* Pos;
+        const char* End;
+    };
+
+    void PutReportFile(TSinkWriter& writer, const TReportFile& file) noexcept;
+    bool GetReportFile(TSinkReader& reader, TReportFile& file) noexcept;
+
+    // Address is "unix:PATH" or "unix:@NAME" for the abstract namespace
+    bool ParseSinkAddress(const std::string& address, struct sockaddr_un& addr, socklen_t& len) noexcept;
+    // Socket fd, -1 on errors
+    int ConnectSink(const std::string& address) noexcept;
+
+    // Connection of the tracing session to the collector. It's closed on the first failed send,
+    // so a session whose collector is absent or stuck falls back to the local report.
+    class TSink {
+    public:
+        explicit TSink(const std::string& address) noexcept;
+        ~TSink();
+
+        void Send(const TSinkWriter& record) noexcept;
+
+        bool IsConnected() const noexcept {
+            return Fd >= 0;
+        }
+
+    private:
+        std::string Address;
+        int Fd;
+    };
+}
@@ -19,6 +19,17 @@ namespace NOPTrace {
         }
 
         OutputSize += size;
+        if (!file->ProcInfo->Cgroup.empty()) {
+            CgroupOutputSizes[file->ProcInfo->Cgroup] += size;
+        }
+        if (file->Mount) {
+            auto& mount = MountOutputs[file->Mount->MountPoint];
+            mount.Size += size;
+            mount.Files++;
+            if (!mount.Largest || mount.Largest->Size < size) {
+                mount.Largest = file;
+            }
+        }
     }
 
     std::vector<TOutputFilePtr> TFileStorage::GetLargestFiles() const noexcept {
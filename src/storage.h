@@ -2,7 +2,9 @@
 
 #include "types.h"
 
+#include <map>
 #include <queue>
+#include <string>
 #include <vector>
 
 namespace NOPTrace {
@@ -12,6 +14,13 @@ namespace NOPTrace {
         }
     };
 
+    // Output of the files on a mount
+    struct TMountOutput {
+        size_t Size = 0;
+        size_t Files = 0;
+        TOutputFilePtr Largest;
+    };
+
     class TFileStorage {
     public:
         TFileStorage(long capacity, bool storeEmptyFiles)
@@ -29,9 +38,21 @@ namespace NOPTrace {
             return OutputSize;
         }
 
+        const std::map<std::string, size_t>& GetCgroupOutputSizes() const noexcept {
+            return CgroupOutputSizes;
+        }
+
+        const std::map<std::string, TMountOutput>& GetMountOutputs() const noexcept {
+            return MountOutputs;
+        }
+
     private:
         long Capacity;
         size_t OutputSize;
+        // Output of the processes with known cgroup by their cgroups
+        std::map<std::string, size_t> CgroupOutputSizes;
+        // Output of the files with known mount by mount points
+        std::map<std::string, TMountOutput> MountOutputs;
         bool StoreEmptyFiles;
 
         using TMaxOutFilesQueue = std::priority_queue<TOutputFilePtr, std::vector<TOutputFilePtr>, TFileSizeGreater>;
@@ -1,19 +1,81 @@
 #pragma once
 
+#include <string>
+
 #include <sys/syscall.h>
 #include "ptrace.h"
 #include "regs.h"
 #include "utils.h"
 
+namespace NOPTrace {
+    // What the tracer does with the syscall
+    enum class ESyscallClass : unsigned char {
+        None,
+        Open,
+        Write,
+        PositionalWrite,
+        // Offset is passed by pointer, the fd position is used when it is null
+        CopyWrite,
+        Dup,
+        Close,
+        // Closes fds from the first argument to the second one
+        CloseRange,
+        Resize,
+        Seek,
+        // Command is always the argument next to fd
+        Fcntl,
+        Chdir,
+        // Protection is always the argument next to length
+        Mmap,
+        // io_uring syscalls, arguments are decoded by the handlers
+        UringSetup,
+        UringRegister,
+        UringEnter,
+    };
+
+    // Handlers of these classes use only the tracer state, so the syscalls can be accounted after they are done
+    inline bool IsDeferrableSyscall(ESyscallClass cls) {
+        switch (cls) {
+            case ESyscallClass::Write:
+            case ESyscallClass::PositionalWrite:
+            case ESyscallClass::Dup:
+            case ESyscallClass::Close:
+            case ESyscallClass::CloseRange:
+            case ESyscallClass::Resize:
+            case ESyscallClass::Seek:
+            case ESyscallClass::Fcntl:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    // Indexes of the syscall arguments, -1 when there is no such argument
+    struct TSyscallInfo {
+        unsigned Nr;
+        const char* Name;
+        ESyscallClass Class;
+        // File descriptor, dirfd for opens
+        signed char Fd;
+        signed char Path;
+        // Open or dup3 flags, new fd flags for fcntl, RWF_* flags for pwritev2, io_uring_enter, mmap and close_range flags
+        signed char Flags;
+        signed char Offset;
+        signed char Length;
+        // Target fd of dup2/dup3, result of the syscall is used otherwise
+        signed char NewFd;
+    };
+}
+
+#define SYSCALL_ENTRY(NAME, CLASS, FD, PATH, FLAGS, OFFSET, LENGTH, NEWFD) \
+    {SYS_##NAME, "SYS_" #NAME, NOPTrace::ESyscallClass::CLASS, FD, PATH, FLAGS, OFFSET, LENGTH, NEWFD}
+#define SYSCALL_UNTRACED(NAME) SYSCALL_ENTRY(NAME, None, -1, -1, -1, -1, -1, -1)
+
 #ifdef __x86_64__
     #include "syscall_x86_64.h"
 
     #define SYSCALL_NR(REGISTERS) REGISTERS.orig_rax
     #define SYSCALL_RETDATA(REGISTERS) REGISTERS.rax
-    #define SYSCALL_ARG0(REGISTERS) REGISTERS.rdi
-    #define SYSCALL_ARG1(REGISTERS) REGISTERS.rsi
-    #define SYSCALL_ARG2(REGISTERS) REGISTERS.rdx
-    #define SYSCALL_ARG3(REGISTERS) REGISTERS.r10
 
 #endif
 
@@ -22,14 +84,53 @@
 
     #define SYSCALL_NR(REGISTERS) REGISTERS.regs[8]
     #define SYSCALL_RETDATA(REGISTERS) REGISTERS.regs[0]
-    #define SYSCALL_ARG0(REGISTERS) REGISTERS.regs[9] // We saved ARG0 here in SyscallEnter
-    #define SYSCALL_ARG1(REGISTERS) REGISTERS.regs[1]
-    #define SYSCALL_ARG2(REGISTERS) REGISTERS.regs[2]
-    #define SYSCALL_ARG3(REGISTERS) REGISTERS.regs[3]
 #endif
 
 namespace NOPTrace {
+    inline unsigned long long GetSyscallArg(const struct user_regs_struct& registers, int arg) {
+        switch (arg) {
+#ifdef __x86_64__
+            case 0: return registers.rdi;
+            case 1: return registers.rsi;
+            case 2: return registers.rdx;
+            case 3: return registers.r10;
+            case 4: return registers.r8;
+            case 5: return registers.r9;
+#endif
+#ifdef __aarch64__
+            case 0: return registers.regs[9]; // We saved ARG0 here at syscall-entry-stop
+            case 1: return registers.regs[1];
+            case 2: return registers.regs[2];
+            case 3: return registers.regs[3];
+            case 4: return registers.regs[4];
+            case 5: return registers.regs[5];
+#endif
+            default: return 0;
+        }
+    }
+
+    // Fills registers from syscall arguments taken not from a stopped tracee
+    inline void SetSyscallArgs(struct user_regs_struct& registers, const unsigned long long* args) {
+#ifdef __x86_64__
+        registers.rdi = args[0];
+        registers.rsi = args[1];
+        registers.rdx = args[2];
+        registers.r10 = args[3];
+        registers.r8 = args[4];
+        registers.r9 = args[5];
+#endif
+#ifdef __aarch64__
+        for (int i = 0; i < 6; i++) {
+            registers.regs[i] = args[i];
+        }
+        registers.regs[9] = args[0];
+#endif
+    }
+
+    const TSyscallInfo& GetSyscallInfo(unsigned long long syscall);
     long GetCloneFlags(pid_t pid);
     long GetSyscallNumber(const struct user_regs_struct& registers);
+    bool ReadTraceeMemory(pid_t pid, unsigned long long addr, void* buff, size_t size);
+    std::string ReadTraceeString(pid_t pid, unsigned long long addr, size_t limit);
     const char* StrSyscallName(int syscall);
 }
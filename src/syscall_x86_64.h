@@ -136,3 +136,367 @@
 #ifndef SYS_statx
     #define SYS_statx 332
 #endif
+
+#ifndef SYS_io_uring_setup
+    #define SYS_io_uring_setup 425
+#endif
+
+#ifndef SYS_io_uring_enter
+    #define SYS_io_uring_enter 426
+#endif
+
+#ifndef SYS_io_uring_register
+    #define SYS_io_uring_register 427
+#endif
+
+#ifndef SYS_close_range
+    #define SYS_close_range 436
+#endif
+
+namespace NOPTrace {
+    // Syscall metadata, see TSyscallInfo for the columns:
+    //                   name, class, fd, path, flags, offset, length, newfd
+    constexpr TSyscallInfo SyscallTable[] = {
+        // x86-64 specific syscalls.
+        // refer here: https://marcin.juszkiewicz.com.pl/download/tables/syscalls.html
+        SYSCALL_UNTRACED(_sysctl),
+        SYSCALL_UNTRACED(access),
+        SYSCALL_UNTRACED(afs_syscall),
+        SYSCALL_UNTRACED(alarm),
+        SYSCALL_UNTRACED(arch_prctl),
+        SYSCALL_UNTRACED(chmod),
+        SYSCALL_UNTRACED(chown),
+        SYSCALL_ENTRY(creat, Open, -1,  0, -1, -1, -1, -1),
+        SYSCALL_UNTRACED(create_module),
+        SYSCALL_ENTRY(dup2, Dup,  0, -1, -1, -1, -1,  1),
+        SYSCALL_UNTRACED(epoll_create),
+        SYSCALL_UNTRACED(epoll_ctl_old),
+        SYSCALL_UNTRACED(epoll_wait),
+        SYSCALL_UNTRACED(epoll_wait_old),
+        SYSCALL_UNTRACED(eventfd),
+        SYSCALL_UNTRACED(fork),
+        SYSCALL_UNTRACED(futimesat),
+        SYSCALL_UNTRACED(get_kernel_syms),
+        SYSCALL_UNTRACED(get_thread_area),
+        SYSCALL_UNTRACED(getdents),
+        SYSCALL_UNTRACED(getpgrp),
+        SYSCALL_UNTRACED(getpmsg),
+        SYSCALL_UNTRACED(inotify_init),
+        SYSCALL_UNTRACED(ioperm),
+        SYSCALL_UNTRACED(iopl),
+        SYSCALL_UNTRACED(kexec_file_load),
+        SYSCALL_UNTRACED(lchown),
+        SYSCALL_UNTRACED(link),
+        SYSCALL_UNTRACED(lstat),
+        SYSCALL_UNTRACED(mkdir),
+        SYSCALL_UNTRACED(mknod),
+        SYSCALL_UNTRACED(modify_ldt),
+        SYSCALL_ENTRY(open, Open, -1,  0,  1, -1, -1, -1),
+        SYSCALL_UNTRACED(pause),
+        SYSCALL_UNTRACED(pipe),
+        SYSCALL_UNTRACED(poll),
+        SYSCALL_UNTRACED(putpmsg),
+        SYSCALL_UNTRACED(query_module),
+        SYSCALL_UNTRACED(readlink),
+        SYSCALL_UNTRACED(rename),
+        SYSCALL_UNTRACED(rmdir),
+        SYSCALL_UNTRACED(security),
+        SYSCALL_UNTRACED(select),
+        SYSCALL_UNTRACED(set_thread_area),
+        SYSCALL_UNTRACED(signalfd),
+        SYSCALL_UNTRACED(stat),
+        SYSCALL_UNTRACED(symlink),
+        SYSCALL_UNTRACED(sysfs),
+        SYSCALL_UNTRACED(time),
+        SYSCALL_UNTRACED(tuxcall),
+        SYSCALL_UNTRACED(unlink),
+        SYSCALL_UNTRACED(uselib),
+        SYSCALL_UNTRACED(ustat),
+        SYSCALL_UNTRACED(utime),
+        SYSCALL_UNTRACED(utimes),
+        SYSCALL_UNTRACED(vfork),
+        SYSCALL_UNTRACED(vserver),
+
+        // Common syscalls
+        SYSCALL_UNTRACED(accept),
+        SYSCALL_UNTRACED(accept4),
+        SYSCALL_UNTRACED(acct),
+        SYSCALL_UNTRACED(add_key),
+        SYSCALL_UNTRACED(adjtimex),
+        SYSCALL_UNTRACED(bind),
+        SYSCALL_UNTRACED(bpf),
+        SYSCALL_UNTRACED(brk),
+        SYSCALL_UNTRACED(capget),
+        SYSCALL_UNTRACED(capset),
+        SYSCALL_ENTRY(chdir, Chdir, -1,  0, -1, -1, -1, -1),
+        SYSCALL_UNTRACED(chroot),
+        SYSCALL_UNTRACED(clock_adjtime),
+        SYSCALL_UNTRACED(clock_getres),
+        SYSCALL_UNTRACED(clock_gettime),
+        SYSCALL_UNTRACED(clock_nanosleep),
+        SYSCALL_UNTRACED(clock_settime),
+        SYSCALL_UNTRACED(clone),
+        SYSCALL_ENTRY(close, Close,  0, -1, -1, -1, -1, -1),
+        SYSCALL_ENTRY(close_range, CloseRange,  0, -1,  2, -1, -1, -1),
+        SYSCALL_UNTRACED(connect),
+        SYSCALL_ENTRY(copy_file_range, CopyWrite,  2, -1, -1,  3, -1, -1),
+        SYSCALL_UNTRACED(delete_module),
+        SYSCALL_ENTRY(dup, Dup,  0, -1, -1, -1, -1, -1),
+        SYSCALL_ENTRY(dup3, Dup,  0, -1,  2, -1, -1,  1),
+        SYSCALL_UNTRACED(epoll_create1),
+        SYSCALL_UNTRACED(epoll_ctl),
+        SYSCALL_UNTRACED(epoll_pwait),
+        SYSCALL_UNTRACED(eventfd2),
+        SYSCALL_UNTRACED(execve),
+        SYSCALL_UNTRACED(execveat),
+        SYSCALL_UNTRACED(exit),
+        SYSCALL_UNTRACED(exit_group),
+        SYSCALL_UNTRACED(faccessat),
+        SYSCALL_UNTRACED(fadvise64),
+        SYSCALL_ENTRY(fallocate, Resize,  0, -1, -1,  2,  3, -1),
+        SYSCALL_UNTRACED(fanotify_init),
+        SYSCALL_UNTRACED(fanotify_mark),
+        SYSCALL_ENTRY(fchdir, Chdir,  0, -1, -1, -1, -1, -1),
+        SYSCALL_UNTRACED(fchmod),
+        SYSCALL_UNTRACED(fchmodat),
+        SYSCALL_UNTRACED(fchown),
+        SYSCALL_UNTRACED(fchownat),
+        SYSCALL_ENTRY(fcntl, Fcntl,  0, -1,  2, -1, -1, -1),
+        SYSCALL_UNTRACED(fdatasync),
+        SYSCALL_UNTRACED(fgetxattr),
+        SYSCALL_UNTRACED(finit_module),
+        SYSCALL_UNTRACED(flistxattr),
+        SYSCALL_UNTRACED(flock),
+        SYSCALL_UNTRACED(fremovexattr),
+        SYSCALL_UNTRACED(fsetxattr),
+        SYSCALL_UNTRACED(fstat),
+        SYSCALL_UNTRACED(fstatfs),
+        SYSCALL_UNTRACED(fsync),
+        SYSCALL_ENTRY(ftruncate, Resize,  0, -1, -1, -1,  1, -1),
+        SYSCALL_UNTRACED(futex),
+        SYSCALL_UNTRACED(get_mempolicy),
+        SYSCALL_UNTRACED(get_robust_list),
+        SYSCALL_UNTRACED(getcpu),
+        SYSCALL_UNTRACED(getcwd),
+        SYSCALL_UNTRACED(getdents64),
+        SYSCALL_UNTRACED(getegid),
+        SYSCALL_UNTRACED(geteuid),
+        SYSCALL_UNTRACED(getgid),
+        SYSCALL_UNTRACED(getgroups),
+        SYSCALL_UNTRACED(getitimer),
+        SYSCALL_UNTRACED(getpeername),
+        SYSCALL_UNTRACED(getpgid),
+        SYSCALL_UNTRACED(getpid),
+        SYSCALL_UNTRACED(getppid),
+        SYSCALL_UNTRACED(getpriority),
+        SYSCALL_UNTRACED(getrandom),
+        SYSCALL_UNTRACED(getresgid),
+        SYSCALL_UNTRACED(getresuid),
+        SYSCALL_UNTRACED(getrlimit),
+        SYSCALL_UNTRACED(getrusage),
+        SYSCALL_UNTRACED(getsid),
+        SYSCALL_UNTRACED(getsockname),
+        SYSCALL_UNTRACED(getsockopt),
+        SYSCALL_UNTRACED(gettid),
+        SYSCALL_UNTRACED(gettimeofday),
+        SYSCALL_UNTRACED(getuid),
+        SYSCALL_UNTRACED(getxattr),
+        SYSCALL_UNTRACED(init_module),
+        SYSCALL_UNTRACED(inotify_add_watch),
+        SYSCALL_UNTRACED(inotify_init1),
+        SYSCALL_UNTRACED(inotify_rm_watch),
+        SYSCALL_UNTRACED(io_cancel),
+        SYSCALL_UNTRACED(io_destroy),
+        SYSCALL_UNTRACED(io_getevents),
+        SYSCALL_UNTRACED(io_setup),
+        SYSCALL_UNTRACED(io_submit),
+        SYSCALL_ENTRY(io_uring_enter, UringEnter,  0, -1,  3, -1, -1, -1),
+        SYSCALL_ENTRY(io_uring_register, UringRegister,  0, -1, -1, -1, -1, -1),
+        SYSCALL_ENTRY(io_uring_setup, UringSetup, -1, -1, -1, -1, -1, -1),
+        SYSCALL_UNTRACED(ioctl),
+        SYSCALL_UNTRACED(ioprio_get),
+        SYSCALL_UNTRACED(ioprio_set),
+        SYSCALL_UNTRACED(kcmp),
+        SYSCALL_UNTRACED(kexec_load),
+        SYSCALL_UNTRACED(keyctl),
+        SYSCALL_UNTRACED(kill),
+        SYSCALL_UNTRACED(lgetxattr),
+        SYSCALL_UNTRACED(linkat),
+        SYSCALL_UNTRACED(listen),
+        SYSCALL_UNTRACED(listxattr),
+        SYSCALL_UNTRACED(llistxattr),
+        SYSCALL_UNTRACED(lookup_dcookie),
+        SYSCALL_UNTRACED(lremovexattr),
+        SYSCALL_ENTRY(lseek, Seek,  0, -1, -1, -1, -1, -1),
+        SYSCALL_UNTRACED(lsetxattr),
+        SYSCALL_UNTRACED(madvise),
+        SYSCALL_UNTRACED(mbind),
+        SYSCALL_UNTRACED(membarrier),
+        SYSCALL_UNTRACED(memfd_create),
+        SYSCALL_UNTRACED(migrate_pages),
+        SYSCALL_UNTRACED(mincore),
+        SYSCALL_UNTRACED(mkdirat),
+        SYSCALL_UNTRACED(mknodat),
+        SYSCALL_UNTRACED(mlock),
+        SYSCALL_UNTRACED(mlock2),
+        SYSCALL_UNTRACED(mlockall),
+        SYSCALL_ENTRY(mmap, Mmap,  4, -1,  3,  5,  1, -1),
+        SYSCALL_UNTRACED(mount),
+        SYSCALL_UNTRACED(move_pages),
+        SYSCALL_UNTRACED(mprotect),
+        SYSCALL_UNTRACED(mq_getsetattr),
+        SYSCALL_UNTRACED(mq_notify),
+        SYSCALL_UNTRACED(mq_open),
+        SYSCALL_UNTRACED(mq_timedreceive),
+        SYSCALL_UNTRACED(mq_timedsend),
+        SYSCALL_UNTRACED(mq_unlink),
+        SYSCALL_UNTRACED(mremap),
+        SYSCALL_UNTRACED(msgctl),
+        SYSCALL_UNTRACED(msgget),
+        SYSCALL_UNTRACED(msgrcv),
+        SYSCALL_UNTRACED(msgsnd),
+        SYSCALL_UNTRACED(msync),
+        SYSCALL_UNTRACED(munlock),
+        SYSCALL_UNTRACED(munlockall),
+        SYSCALL_UNTRACED(munmap),
+        SYSCALL_UNTRACED(name_to_handle_at),
+        SYSCALL_UNTRACED(nanosleep),
+        SYSCALL_UNTRACED(newfstatat),
+        SYSCALL_UNTRACED(nfsservctl),
+        SYSCALL_UNTRACED(open_by_handle_at),
+        SYSCALL_ENTRY(openat, Open,  0,  1,  2, -1, -1, -1),
+        SYSCALL_UNTRACED(perf_event_open),
+        SYSCALL_UNTRACED(personality),
+        SYSCALL_UNTRACED(pipe2),
+        SYSCALL_UNTRACED(pivot_root),
+        SYSCALL_UNTRACED(pkey_alloc),
+        SYSCALL_UNTRACED(pkey_free),
+        SYSCALL_UNTRACED(pkey_mprotect),
+        SYSCALL_UNTRACED(ppoll),
+        SYSCALL_UNTRACED(prctl),
+        SYSCALL_UNTRACED(pread64),
+        SYSCALL_UNTRACED(preadv),
+        SYSCALL_UNTRACED(preadv2),
+        SYSCALL_UNTRACED(prlimit64),
+        SYSCALL_UNTRACED(process_vm_readv),
+        SYSCALL_UNTRACED(process_vm_writev),
+        SYSCALL_UNTRACED(pselect6),
+        SYSCALL_UNTRACED(ptrace),
+        SYSCALL_ENTRY(pwrite64, PositionalWrite,  0, -1, -1,  3, -1, -1),
+        SYSCALL_ENTRY(pwritev, PositionalWrite,  0, -1, -1,  3, -1, -1),
+        SYSCALL_ENTRY(pwritev2, PositionalWrite,  0, -1,  5,  3, -1, -1),
+        SYSCALL_UNTRACED(quotactl),
+        SYSCALL_UNTRACED(read),
+        SYSCALL_UNTRACED(readahead),
+        SYSCALL_UNTRACED(readlinkat),
+        SYSCALL_UNTRACED(readv),
+        SYSCALL_UNTRACED(reboot),
+        SYSCALL_UNTRACED(recvfrom),
+        SYSCALL_UNTRACED(recvmmsg),
+        SYSCALL_UNTRACED(recvmsg),
+        SYSCALL_UNTRACED(remap_file_pages),
+        SYSCALL_UNTRACED(removexattr),
+        SYSCALL_UNTRACED(renameat),
+        SYSCALL_UNTRACED(renameat2),
+        SYSCALL_UNTRACED(request_key),
+        SYSCALL_UNTRACED(restart_syscall),
+        SYSCALL_UNTRACED(rt_sigaction),
+        SYSCALL_UNTRACED(rt_sigpending),
+        SYSCALL_UNTRACED(rt_sigprocmask),
+        SYSCALL_UNTRACED(rt_sigqueueinfo),
+        SYSCALL_UNTRACED(rt_sigreturn),
+        SYSCALL_UNTRACED(rt_sigsuspend),
+        SYSCALL_UNTRACED(rt_sigtimedwait),
+        SYSCALL_UNTRACED(rt_tgsigqueueinfo),
+        SYSCALL_UNTRACED(sched_get_priority_max),
+        SYSCALL_UNTRACED(sched_get_priority_min),
+        SYSCALL_UNTRACED(sched_getaffinity),
+        SYSCALL_UNTRACED(sched_getattr),
+        SYSCALL_UNTRACED(sched_getparam),
+        SYSCALL_UNTRACED(sched_getscheduler),
+        SYSCALL_UNTRACED(sched_rr_get_interval),
+        SYSCALL_UNTRACED(sched_setaffinity),
+        SYSCALL_UNTRACED(sched_setattr),
+        SYSCALL_UNTRACED(sched_setparam),
+        SYSCALL_UNTRACED(sched_setscheduler),
+        SYSCALL_UNTRACED(sched_yield),
+        SYSCALL_UNTRACED(seccomp),
+        SYSCALL_UNTRACED(semctl),
+        SYSCALL_UNTRACED(semget),
+        SYSCALL_UNTRACED(semop),
+        SYSCALL_UNTRACED(semtimedop),
+        SYSCALL_ENTRY(sendfile, Write,  0, -1, -1, -1, -1, -1),
+        SYSCALL_UNTRACED(sendmmsg),
+        SYSCALL_UNTRACED(sendmsg),
+        SYSCALL_UNTRACED(sendto),
+        SYSCALL_UNTRACED(set_mempolicy),
+        SYSCALL_UNTRACED(set_robust_list),
+        SYSCALL_UNTRACED(set_tid_address),
+        SYSCALL_UNTRACED(setdomainname),
+        SYSCALL_UNTRACED(setfsgid),
+        SYSCALL_UNTRACED(setfsuid),
+        SYSCALL_UNTRACED(setgid),
+        SYSCALL_UNTRACED(setgroups),
+        SYSCALL_UNTRACED(sethostname),
+        SYSCALL_UNTRACED(setitimer),
+        SYSCALL_UNTRACED(setns),
+        SYSCALL_UNTRACED(setpgid),
+        SYSCALL_UNTRACED(setpriority),
+        SYSCALL_UNTRACED(setregid),
+        SYSCALL_UNTRACED(setresgid),
+        SYSCALL_UNTRACED(setresuid),
+        SYSCALL_UNTRACED(setreuid),
+        SYSCALL_UNTRACED(setrlimit),
+        SYSCALL_UNTRACED(setsid),
+        SYSCALL_UNTRACED(setsockopt),
+        SYSCALL_UNTRACED(settimeofday),
+        SYSCALL_UNTRACED(setuid),
+        SYSCALL_UNTRACED(setxattr),
+        SYSCALL_UNTRACED(shmat),
+        SYSCALL_UNTRACED(shmctl),
+        SYSCALL_UNTRACED(shmdt),
+        SYSCALL_UNTRACED(shmget),
+        SYSCALL_UNTRACED(shutdown),
+        SYSCALL_UNTRACED(sigaltstack),
+        SYSCALL_UNTRACED(signalfd4),
+        SYSCALL_UNTRACED(socket),
+        SYSCALL_UNTRACED(socketpair),
+        SYSCALL_ENTRY(splice, CopyWrite,  2, -1, -1,  3, -1, -1),
+        SYSCALL_UNTRACED(statfs),
+        SYSCALL_UNTRACED(statx),
+        SYSCALL_UNTRACED(swapoff),
+        SYSCALL_UNTRACED(swapon),
+        SYSCALL_UNTRACED(symlinkat),
+        SYSCALL_UNTRACED(sync),
+        SYSCALL_UNTRACED(sync_file_range),
+        SYSCALL_UNTRACED(syncfs),
+        SYSCALL_UNTRACED(sysinfo),
+        SYSCALL_UNTRACED(syslog),
+        SYSCALL_UNTRACED(tee),
+        SYSCALL_UNTRACED(tgkill),
+        SYSCALL_UNTRACED(timer_create),
+        SYSCALL_UNTRACED(timer_delete),
+        SYSCALL_UNTRACED(timer_getoverrun),
+        SYSCALL_UNTRACED(timer_gettime),
+        SYSCALL_UNTRACED(timer_settime),
+        SYSCALL_UNTRACED(timerfd_create),
+        SYSCALL_UNTRACED(timerfd_gettime),
+        SYSCALL_UNTRACED(timerfd_settime),
+        SYSCALL_UNTRACED(times),
+        SYSCALL_UNTRACED(tkill),
+        SYSCALL_UNTRACED(truncate),
+        SYSCALL_UNTRACED(umask),
+        SYSCALL_UNTRACED(umount2),
+        SYSCALL_UNTRACED(uname),
+        SYSCALL_UNTRACED(unlinkat),
+        SYSCALL_UNTRACED(unshare),
+        SYSCALL_UNTRACED(userfaultfd),
+        SYSCALL_UNTRACED(utimensat),
+        SYSCALL_UNTRACED(vhangup),
+        SYSCALL_UNTRACED(vmsplice),
+        SYSCALL_UNTRACED(wait4),
+        SYSCALL_UNTRACED(waitid),
+        SYSCALL_ENTRY(write, Write,  0, -1, -1, -1, -1, -1),
+        SYSCALL_ENTRY(writev, Write,  0, -1, -1, -1, -1, -1),
+    };
+}
@@ -1,29 +1,71 @@
 #include "types.h"
 #include "utils.h"
 
+#include <algorithm>
+
 #include <fcntl.h>
+#include <sys/stat.h>
 
 namespace NOPTrace {
-    TFileState::TFileState(const std::string& filename, size_t flags)
+    TFileState::TFileState(size_t flags)
         : MaxPos(0)
+        , ResizePos(0)
         , CurrPos(0)
         , Flags(flags)
-        , Filename(filename)
+        , InitSize(0)
+        , Dev(0)
+        , Resolved(false)
+        , SizeDelta(false)
+        , Mapped(false)
+        , OverMaxSize(false)
+        , Quota(-1)
+        , Throttle(-1)
     {
-        InitSize = GetFileLength(filename);
-        if (IsAppendSet()) {
-            CurrPos = InitSize;
-        } else {
-            CurrPos = 0;
-        }
+    }
+
+    TFileState::TFileState(const std::string& filename, size_t flags)
+        : TFileState(flags)
+    {
+        Resolve(filename);
     }
 
     TFileState::TFileState(const TFileState& s) {
         MaxPos = s.MaxPos;
+        ResizePos = s.ResizePos;
         CurrPos = s.CurrPos;
         Flags = s.Flags;
-        InitSize = GetFileLength(s.Filename);
+        Dev = s.Dev;
+        Resolved = s.Resolved;
+        // Size delta and mapped files share the original state
+        SizeDelta = false;
+        Mapped = false;
+        // Another process gets its own signal
+        OverMaxSize = false;
+        Quota = s.Quota;
+        Throttle = s.Throttle;
         Filename = s.Filename;
+        // Unresolved copy will get its initial size on the first write
+        InitSize = Resolved ? GetFileLength(s.Filename) : 0;
+    }
+
+    void TFileState::Resolve(const std::string& filename) noexcept {
+        Filename = filename;
+
+        struct stat st;
+        if (stat(filename.c_str(), &st) == 0) {
+            InitSize = st.st_size;
+            Dev = st.st_dev;
+        } else {
+            InitSize = 0;
+        }
+        if (IsAppendSet()) {
+            CurrPos = InitSize;
+        }
+        Resolved = true;
+    }
+
+    bool TFileState::IsResolved() const noexcept {
+        return Resolved;
     }
 
     bool TFileState::IsAppendSet() const noexcept {
@@ -34,6 +76,54 @@ namespace NOPTrace {
         return Flags & O_CLOEXEC;
     }
 
+    bool TFileState::IsSizeDelta() const noexcept {
+        return SizeDelta;
+    }
+
+    void TFileState::SetSizeDelta() noexcept {
+        SizeDelta = true;
+    }
+
+    bool TFileState::IsMapped() const noexcept {
+        return Mapped;
+    }
+
+    void TFileState::SetMapped() noexcept {
+        Mapped = true;
+    }
+
+    bool TFileState::IsOverMaxSize() const noexcept {
+        return OverMaxSize;
+    }
+
+    void TFileState::SetOverMaxSize() noexcept {
+        OverMaxSize = true;
+    }
+
+    void TFileState::SetQuota(int quota) noexcept {
+        Quota = quota;
+    }
+
+    int TFileState::GetQuota() const noexcept {
+        return Quota;
+    }
+
+    void TFileState::SetThrottle(int throttle) noexcept {
+        Throttle = throttle;
+    }
+
+    int TFileState::GetThrottle() const noexcept {
+        return Throttle;
+    }
+
+    dev_t TFileState::GetDev() const noexcept {
+        return Dev;
+    }
+
+    void TFileState::SetFilename(const std::string& filename) noexcept {
+        Filename = filename;
+    }
+
     void TFileState::SetFlags(size_t flags) noexcept {
         Flags = flags;
     }
@@ -46,10 +136,18 @@ namespace NOPTrace {
         }
     }
 
+    size_t TFileState::GetFileSize() const noexcept {
+        return std::max({MaxPos, InitSize, ResizePos});
+    }
+
     void TFileState::SetCurrPos(size_t pos) noexcept {
         CurrPos = pos;
     }
 
+    void TFileState::SetInitSize(size_t size) noexcept {
+        InitSize = size;
+    }
+
     void TFileState::Enroll(size_t nbytes) noexcept {
         CurrPos += nbytes;
         if (CurrPos > MaxPos) {
@@ -63,6 +161,29 @@ namespace NOPTrace {
         }
     }
 
+    // Data goes to the end of file regardless of the offset
+    void TFileState::EnrollAppend(size_t nbytes, bool shift) noexcept {
+        MaxPos = std::max(MaxPos, InitSize) + nbytes;
+        if (shift) {
+            CurrPos = MaxPos;
+        }
+    }
+
+    void TFileState::EnrollResize(size_t size) noexcept {
+        ResizePos = std::max(ResizePos, size);
+    }
+
+    void TFileState::EnrollFileSize() noexcept {
+        size_t size = GetFileLength(Filename);
+        if (Mapped || ResizePos) {
+            // Truncated file is sparse until the mapped pages are touched, so the length set by the resize
+            // doesn't count. Only the growth beyond the traced writes is clamped, writes into sparse
+            // or preallocated files are kept as enrolled.
+            size = std::min(size, GetFileAllocatedSize(Filename));
+        }
+        MaxPos = std::max(MaxPos, size);
+    }
+
     void TFileState::SetCloexecFlag(bool on) noexcept {
         if (on) {
             Flags |= O_CLOEXEC;
@@ -74,4 +195,57 @@ namespace NOPTrace {
     std::string TFileState::GetFilename() const noexcept {
         return Filename;
     }
+
+    TFileStatePtr* TFdTable::Find(size_t fd) noexcept {
+        if (fd < LOW_FDS) {
+            return Low[fd] ? &Low[fd] : nullptr;
+        }
+        auto it = High.find(fd);
+        return it != High.end() && it->second ? &it->second : nullptr;
+    }
+
+    TFileState* TFdTable::Get(size_t fd) const noexcept {
+        if (fd < LOW_FDS) {
+            return Low[fd].get();
+        }
+        auto it = High.find(fd);
+        return it != High.end() ? it->second.get() : nullptr;
+    }
+
+    void TFdTable::Set(size_t fd, TFileStatePtr file) noexcept {
+        if (!file) {
+            Erase(fd);
+        } else if (fd < LOW_FDS) {
+            Low[fd] = std::move(file);
+            LowUsed |= 1ULL << fd;
+        } else {
+            High[fd] = std::move(file);
+        }
+    }
+
+    void TFdTable::Erase(size_t fd) noexcept {
+        if (fd < LOW_FDS) {
+            Low[fd] = nullptr;
+            LowUsed &= ~(1ULL << fd);
+        } else {
+            High.erase(fd);
+        }
+    }
+
+    // Burst is limited to this much of the rate, so bandwidth is shaped smoothly
+    const long long THROTTLE_BURST_MS = 100;
+
+    TTokenBucket::TTokenBucket(size_t rate) noexcept
+        : Rate(rate)
+        , Tokens(rate * THROTTLE_BURST_MS / 1000.0)
+        , Updated(GetMonotonicTime())
+    {
+    }
+
+    long long TTokenBucket::Charge(size_t nbytes, long long now) noexcept {
+        Tokens = std::min(Rate * THROTTLE_BURST_MS / 1000.0, Tokens + (now - Updated) * Rate / 1e9);
+        Updated = now;
+        Tokens -= nbytes;
+        return Tokens < 0 ? -Tokens * 1e9 / Rate : 0;
+    }
 }
@@ -1,16 +1,23 @@
 #pragma once
 
+#include "mounts.h"
+#include "uring.h"
+
+#include <cstdint>
+#include <map>
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace NOPTrace {
     struct TProcInfo {
-        TProcInfo(pid_t pid, pid_t ppid, std::string comm, std::string cmd)
+        TProcInfo(pid_t pid, pid_t ppid, std::string comm, std::string cmd, std::string cgroup)
             : Pid(pid)
             , Ppid(ppid)
             , CommandName(comm)
             , CommandLine(cmd)
+            , Cgroup(cgroup)
         {
         }
 
@@ -18,44 +25,130 @@ namespace NOPTrace {
         pid_t Ppid;
         std::string CommandName;
         std::string CommandLine;
+        // Known only if cgroups are traced
+        std::string Cgroup;
     };
 
     using TProcInfoPtr = std::shared_ptr<const TProcInfo>;
 
     class TFileState {
     public:
+        // Filename and initial size are unknown until Resolve is called
+        TFileState(size_t flags);
         TFileState(const std::string& filename, size_t flags);
         TFileState(const TFileState& s);
 
+        void Resolve(const std::string& filename) noexcept;
+        bool IsResolved() const noexcept;
+
         void Enroll(size_t nbytes) noexcept;
         void EnrollNoShift(size_t nbytes, size_t offset) noexcept;
+        void EnrollAppend(size_t nbytes, bool shift) noexcept;
+        // ftruncate or fallocate, the file gets the length without any output
+        void EnrollResize(size_t size) noexcept;
+        void EnrollFileSize() noexcept;
 
         bool IsAppendSet() const noexcept;
         bool IsCloexecSet() const noexcept;
+        bool IsSizeDelta() const noexcept;
+        bool IsMapped() const noexcept;
+        bool IsOverMaxSize() const noexcept;
 
+        void SetFilename(const std::string& filename) noexcept;
         void SetFlags(size_t flags) noexcept;
         void SetCloexecFlag(bool on) noexcept;
         void SetCurrPos(size_t pos) noexcept;
+        void SetInitSize(size_t size) noexcept;
+        void SetSizeDelta() noexcept;
+        void SetMapped() noexcept;
+        void SetOverMaxSize() noexcept;
+        void SetQuota(int quota) noexcept;
+        void SetThrottle(int throttle) noexcept;
 
         size_t GetOutputSize() const noexcept;
+        // Size of the file including the traced writes
+        size_t GetFileSize() const noexcept;
+        int GetQuota() const noexcept;
+        int GetThrottle() const noexcept;
+        // Device of the filesystem, known once the file is resolved
+        dev_t GetDev() const noexcept;
         std::string GetFilename() const noexcept;
 
     private:
         size_t MaxPos;
+        // Largest length set by a resize, it's counted in the file size but not in the output
+        size_t ResizePos;
         size_t CurrPos;
         size_t Flags;
         size_t InitSize;
+        dev_t Dev;
+        bool Resolved;
+        // Writes can bypass syscalls, output is taken from the file size at teardown
+        bool SizeDelta;
+        // File is mapped shared and writable, untouched pages of a sparse file are not output
+        bool Mapped;
+        // Writer is already signalled for exceeding the max file size
+        bool OverMaxSize;
+        // Index of the quota the output is charged to, -1 if there is no such
+        int Quota;
+        // Index of the throttle writes are charged to, -1 if there is no such
+        int Throttle;
         std::string Filename;
     };
 
     using TFileStatePtr = std::shared_ptr<TFileState>;
 
+    // Output files by fd. Low fds are kept inline with a bitmask of the used ones, high fds are in a sorted map,
+    // so walking the table costs the number of tracked fds whatever their numbers are.
+    class TFdTable {
+    public:
+        // nullptr if the fd isn't tracked
+        TFileStatePtr* Find(size_t fd) noexcept;
+        TFileState* Get(size_t fd) const noexcept;
+        void Set(size_t fd, TFileStatePtr file) noexcept;
+        void Erase(size_t fd) noexcept;
+
+        // Calls func(fd, file) for every tracked fd in ascending order, files may be reset but not added or erased
+        template <class TFunc>
+        void ForEach(TFunc func) {
+            for (uint64_t used = LowUsed; used; used &= used - 1) {
+                const size_t fd = __builtin_ctzll(used);
+                if (Low[fd]) {
+                    func(fd, Low[fd]);
+                }
+            }
+            for (auto& it : High) {
+                if (it.second) {
+                    func(it.first, it.second);
+                }
+            }
+        }
+
+    private:
+        static const size_t LOW_FDS = 64;
+
+        TFileStatePtr Low[LOW_FDS];
+        uint64_t LowUsed = 0;
+        std::map<size_t, TFileStatePtr> High;
+    };
+
     struct TProcState {
-        TProcState(pid_t pid, pid_t ppid, const std::string& comm, const std::string& cmd) {
-            ProcInfo = std::make_shared<const TProcInfo>(pid, ppid, comm, cmd);
+        TProcState(pid_t pid, pid_t ppid, const std::string& comm, const std::string& cmd, const std::string& cgroup) {
+            ProcInfo = std::make_shared<const TProcInfo>(pid, ppid, comm, cmd, cgroup);
         }
 
-        std::vector<TFileStatePtr> Fds;
+        TFdTable Fds;
+        // Directories of the fds used as openat dirfd
+        std::unordered_map<int, std::string> DirFds;
+        std::string Cwd;
+        // io_uring instances by ring fd
+        std::unordered_map<int, TIoUring> IoUrings;
+        // Shared writable mappings by address, they keep the file referenced after close
+        std::unordered_map<unsigned long long, TFileStatePtr> Mappings;
+        // Process has set up io_uring, its files are accounted by size delta
+        bool SizeDelta = false;
+        // Index of the process throttle, -1 if there is no such
+        int Throttle = -1;
         TProcInfoPtr ProcInfo;
     };
 
@@ -66,20 +159,40 @@ namespace NOPTrace {
             : Size(file->GetOutputSize())
             , Filename(file->GetFilename())
             , ProcInfo(pinfo)
+            , Estimated(file->IsSizeDelta() || file->IsMapped())
         {
         }
         TOutputFile(const std::string& filename, size_t size, TProcInfoPtr pinfo)
             : Size(size)
             , Filename(filename)
             , ProcInfo(pinfo)
+            , Estimated(false)
         {
         }
 
         size_t Size;
         std::string Filename;
         TProcInfoPtr ProcInfo;
+        // Size is taken from the file size, not from traced writes
+        bool Estimated;
+        // Mount the file is on, nullptr if it's unknown
+        TMountInfoPtr Mount;
     };
 
     using TOutputFilePtr = std::shared_ptr<const TOutputFile>;
 
+    // Refilled at Rate bytes per second, it may go into debt which is paid off by holding the writer
+    class TTokenBucket {
+    public:
+        TTokenBucket(size_t rate) noexcept;
+
+        // Takes nbytes at the time now (ns), returns nanoseconds until the debt is paid off
+        long long Charge(size_t nbytes, long long now) noexcept;
+
+    private:
+        double Rate;
+        double Tokens;
+        long long Updated;
+    };
+
 }
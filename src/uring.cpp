@@ -0,0 +1,323 @@
+#include "uring.h"
+#include "syscall.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include <sys/uio.h>
+
+// Partly from linux/io_uring.h, support ubuntu-10
+#ifndef IORING_OFF_SQ_RING
+    #define IORING_OFF_SQ_RING 0ULL
+    #define IORING_OFF_SQES 0x10000000ULL
+#endif
+
+#ifndef IORING_SETUP_SQPOLL
+    #define IORING_SETUP_SQPOLL (1U << 1)
+#endif
+
+#ifndef IORING_SETUP_SQE128
+    #define IORING_SETUP_SQE128 (1U << 10)
+#endif
+
+#ifndef IORING_SETUP_NO_SQARRAY
+    #define IORING_SETUP_NO_SQARRAY (1U << 16)
+#endif
+
+#ifndef IOSQE_FIXED_FILE
+    #define IOSQE_FIXED_FILE (1U << 0)
+#endif
+
+#ifndef IORING_REGISTER_FILES_SKIP
+    #define IORING_REGISTER_FILES_SKIP (-2)
+#endif
+
+#ifndef IORING_RSRC_REGISTER_SPARSE
+    #define IORING_RSRC_REGISTER_SPARSE (1U << 0)
+#endif
+
+#ifndef RWF_APPEND
+    #define RWF_APPEND 0x00000010
+#endif
+
+namespace NOPTrace {
+    namespace {
+        // Opcodes and register commands are ABI, so they are not taken from the headers
+        enum EUringOp : uint8_t {
+            UringOpWritev = 2,
+            UringOpWriteFixed = 5,
+            UringOpWrite = 23,
+        };
+
+        enum EUringRegister : unsigned {
+            UringRegisterFiles = 2,
+            UringUnregisterFiles = 3,
+            UringRegisterFilesUpdate = 6,
+            UringRegisterFiles2 = 13,
+            UringRegisterFilesUpdate2 = 14,
+        };
+
+        struct TUringParams {
+            uint32_t SqEntries;
+            uint32_t CqEntries;
+            uint32_t Flags;
+            uint32_t SqThreadCpu;
+            uint32_t SqThreadIdle;
+            uint32_t Features;
+            uint32_t WqFd;
+            uint32_t Resv[3];
+            // struct io_sqring_offsets
+            uint32_t SqHead;
+            uint32_t SqTail;
+            uint32_t SqRingMask;
+            uint32_t SqRingEntries;
+            uint32_t SqFlags;
+            uint32_t SqDropped;
+            uint32_t SqArray;
+            uint32_t SqResv1;
+            uint64_t SqUserAddr;
+            // struct io_cqring_offsets is not used
+            uint32_t CqOff[8];
+            uint64_t CqUserAddr;
+        };
+
+        // First 64 bytes of struct io_uring_sqe
+        struct TUringSqe {
+            uint8_t Opcode;
+            uint8_t Flags;
+            uint16_t Ioprio;
+            int32_t Fd;
+            uint64_t Off;
+            uint64_t Addr;
+            uint32_t Len;
+            uint32_t RwFlags;
+            uint64_t UserData;
+            uint8_t Rest[24];
+        };
+
+        // struct io_uring_files_update and io_uring_rsrc_update2
+        struct TUringFilesUpdate {
+            uint32_t Offset;
+            uint32_t Resv;
+            uint64_t Data;
+            uint64_t Tags;
+            uint32_t Nr;
+            uint32_t Resv2;
+        };
+
+        // struct io_uring_rsrc_register
+        struct TUringFilesRegister {
+            uint32_t Nr;
+            uint32_t Flags;
+            uint64_t Resv2;
+            uint64_t Data;
+            uint64_t Tags;
+        };
+
+        static_assert(sizeof(TUringParams) == 120, "io_uring_params layout mismatch");
+        static_assert(sizeof(TUringSqe) == 64, "io_uring_sqe layout mismatch");
+
+        bool ReadTraceeFds(pid_t pid, unsigned long long addr, size_t count, std::vector<int>& fds) noexcept {
+            fds.resize(count);
+            return !count || ReadTraceeMemory(pid, addr, fds.data(), count * sizeof(int));
+        }
+
+        void UpdateFiles(TIoUring& ring, size_t offset, const std::vector<int>& fds) noexcept {
+            if (ring.Files.size() < offset + fds.size()) {
+                ring.Files.resize(offset + fds.size(), -1);
+            }
+            for (size_t i = 0; i < fds.size(); i++) {
+                if (fds[i] != IORING_REGISTER_FILES_SKIP) {
+                    ring.Files[offset + i] = fds[i];
+                }
+            }
+        }
+
+        size_t GetIovecsLength(pid_t pid, unsigned long long addr, size_t count) noexcept {
+            // UIO_MAXIOV
+            count = std::min<size_t>(count, 1024);
+            std::vector<struct iovec> iov(count);
+            if (!count || !ReadTraceeMemory(pid, addr, iov.data(), count * sizeof(struct iovec))) {
+                return 0;
+            }
+
+            size_t length = 0;
+            for (const auto& v : iov) {
+                length += v.iov_len;
+            }
+            return length;
+        }
+    }
+
+    bool ReadIoUringParams(pid_t pid, unsigned long long addr, TIoUring& ring) noexcept {
+        TUringParams params;
+        if (!ReadTraceeMemory(pid, addr, &params, sizeof(params))) {
+            return false;
+        }
+
+        ring.SetupFlags = params.Flags;
+        ring.SqHead = params.SqHead;
+        ring.SqTail = params.SqTail;
+        ring.SqRingMask = params.SqRingMask;
+        ring.SqArray = params.SqArray;
+        return true;
+    }
+
+    bool LocateIoUring(pid_t pid, TIoUring& ring) noexcept {
+        // Rings are mapped from the anonymous io_uring inode at fixed offsets. All instances
+        // share the same inode, so the mappings are usable only if the process has a single ring.
+        std::stringstream ss;
+        ss << "/proc/" << pid << "/maps";
+        std::ifstream maps(ss.str());
+
+        unsigned long long sqRing = 0;
+        unsigned long long sqes = 0;
+        size_t sqRings = 0;
+        size_t sqeArrays = 0;
+
+        std::string line;
+        while (std::getline(maps, line)) {
+            const std::string name = "anon_inode:[io_uring]";
+            if (line.size() < name.size() || line.compare(line.size() - name.size(), name.size(), name)) {
+                continue;
+            }
+
+            unsigned long long start, end, offset;
+            if (sscanf(line.c_str(), "%llx-%llx %*s %llx", &start, &end, &offset) != 3) {
+                continue;
+            }
+
+            if (offset == IORING_OFF_SQ_RING) {
+                sqRing = start;
+                sqRings++;
+            } else if (offset == IORING_OFF_SQES) {
+                sqes = start;
+                sqeArrays++;
+            }
+        }
+
+        if (sqRings != 1 || sqeArrays != 1) {
+            return false;
+        }
+        unsigned mask;
+        if (!ReadTraceeMemory(pid, sqRing + ring.SqRingMask, &mask, sizeof(mask))) {
+            return false;
+        }
+
+        ring.SqRing = sqRing;
+        ring.Sqes = sqes;
+        ring.SqMask = mask;
+        return true;
+    }
+
+    void RegisterIoUringFiles(pid_t pid, TIoUring& ring, unsigned opcode, unsigned long long arg, unsigned nrArgs) noexcept {
+        std::vector<int> fds;
+
+        switch (opcode) {
+            case UringRegisterFiles:
+                if (ReadTraceeFds(pid, arg, nrArgs, fds)) {
+                    ring.Files = std::move(fds);
+                }
+                break;
+            case UringUnregisterFiles:
+                ring.Files.clear();
+                break;
+            case UringRegisterFilesUpdate: {
+                // io_uring_files_update has no tags and nr fields
+                TUringFilesUpdate update;
+                if (ReadTraceeMemory(pid, arg, &update, offsetof(TUringFilesUpdate, Tags))
+                    && ReadTraceeFds(pid, update.Data, nrArgs, fds))
+                {
+                    UpdateFiles(ring, update.Offset, fds);
+                }
+                break;
+            }
+            case UringRegisterFiles2: {
+                TUringFilesRegister reg;
+                if (!ReadTraceeMemory(pid, arg, &reg, sizeof(reg))) {
+                    break;
+                }
+                if (reg.Flags & IORING_RSRC_REGISTER_SPARSE) {
+                    ring.Files.assign(reg.Nr, -1);
+                } else if (ReadTraceeFds(pid, reg.Data, reg.Nr, fds)) {
+                    ring.Files = std::move(fds);
+                }
+                break;
+            }
+            case UringRegisterFilesUpdate2: {
+                TUringFilesUpdate update;
+                if (ReadTraceeMemory(pid, arg, &update, sizeof(update)) && ReadTraceeFds(pid, update.Data, update.Nr, fds)) {
+                    UpdateFiles(ring, update.Offset, fds);
+                }
+                break;
+            }
+        }
+    }
+
+    std::vector<TUringWrite> ReadIoUringWrites(pid_t pid, const TIoUring& ring, unsigned toSubmit) noexcept {
+        std::vector<TUringWrite> writes;
+
+        // Kernel thread consumes the SQ ring on its own in SQPOLL mode
+        if (!ring.SqRing || !ring.Sqes || (ring.SetupFlags & IORING_SETUP_SQPOLL)) {
+            return writes;
+        }
+
+        uint32_t head, tail;
+        if (!ReadTraceeMemory(pid, ring.SqRing + ring.SqHead, &head, sizeof(head))
+            || !ReadTraceeMemory(pid, ring.SqRing + ring.SqTail, &tail, sizeof(tail)))
+        {
+            return writes;
+        }
+
+        const size_t sqeSize = (ring.SetupFlags & IORING_SETUP_SQE128) ? 2 * sizeof(TUringSqe) : sizeof(TUringSqe);
+        const uint32_t count = std::min<uint32_t>(tail - head, toSubmit);
+
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t index = (head + i) & ring.SqMask;
+            if (!(ring.SetupFlags & IORING_SETUP_NO_SQARRAY)
+                && !ReadTraceeMemory(pid, ring.SqRing + ring.SqArray + index * sizeof(uint32_t), &index, sizeof(index)))
+            {
+                break;
+            }
+
+            TUringSqe sqe;
+            if (!ReadTraceeMemory(pid, ring.Sqes + index * sqeSize, &sqe, sizeof(sqe))) {
+                break;
+            }
+
+            size_t length;
+            switch (sqe.Opcode) {
+                case UringOpWrite:
+                case UringOpWriteFixed:
+                    length = sqe.Len;
+                    break;
+                case UringOpWritev:
+                    length = GetIovecsLength(pid, sqe.Addr, sqe.Len);
+                    break;
+                default:
+                    continue;
+            }
+
+            int fd = sqe.Fd;
+            if (sqe.Flags & IOSQE_FIXED_FILE) {
+                if (fd < 0 || (size_t)fd >= ring.Files.size()) {
+                    continue;
+                }
+                fd = ring.Files[fd];
+            }
+            if (fd < 0 || !length) {
+                continue;
+            }
+
+            const bool append = sqe.RwFlags & RWF_APPEND;
+            writes.push_back({fd, (long long)sqe.Off, length, append});
+        }
+        return writes;
+    }
+}
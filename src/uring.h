@@ -0,0 +1,41 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+namespace NOPTrace {
+    // Submission side of an io_uring instance in the tracee address space
+    struct TIoUring {
+        size_t SetupFlags = 0;
+        // Offsets inside the SQ ring, taken from io_uring_params
+        unsigned SqHead = 0;
+        unsigned SqTail = 0;
+        unsigned SqRingMask = 0;
+        unsigned SqArray = 0;
+        // Tracee addresses of the SQ ring and the SQE array, zero until located
+        unsigned long long SqRing = 0;
+        unsigned long long Sqes = 0;
+        // Ring mask value, read once the ring is located
+        unsigned SqMask = 0;
+        // Lookup of the mappings is done once
+        bool LookedUp = false;
+        // Registered files, -1 for empty slots
+        std::vector<int> Files;
+    };
+
+    struct TUringWrite {
+        int Fd;
+        // -1 stands for the fd position
+        long long Offset;
+        size_t Length;
+        // RWF_APPEND is set
+        bool Append;
+    };
+
+    bool ReadIoUringParams(pid_t pid, unsigned long long addr, TIoUring& ring) noexcept;
+    bool LocateIoUring(pid_t pid, TIoUring& ring) noexcept;
+    void RegisterIoUringFiles(pid_t pid, TIoUring& ring, unsigned opcode, unsigned long long arg, unsigned nrArgs) noexcept;
+    std::vector<TUringWrite> ReadIoUringWrites(pid_t pid, const TIoUring& ring, unsigned toSubmit) noexcept;
+}
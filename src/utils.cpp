@@ -1,7 +1,9 @@
 #include "utils.h"
 
 #include <cassert>
+#include <cctype>
 #include <cmath>
+#include <cstdint>
 #include <cstring>
 #include <fstream>
 #include <iostream>
@@ -11,47 +13,105 @@
 #include <linux/limits.h>
 #include <sys/resource.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/syscall.h>
 #include <sys/utsname.h>
+#include <time.h>
 #include <unistd.h>
 
 namespace NOPTrace {
-    int parseLine(char* line) noexcept {
-        while (*line < '0' || *line > '9') {
-            line++;
+    std::vector<pid_t> ListProcessTasks(pid_t pid) noexcept {
+        std::stringstream ss;
+        ss << "/proc/" << pid << "/task";
+
+        std::vector<pid_t> tasks;
+        int dirfd = open(ss.str().c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dirfd >= 0) {
+            // Task entries are numeric as fd ones
+            tasks = ListFds(dirfd);
+            close(dirfd);
         }
-        char* p = line;
-        while (*p >= '0' && *p <= '9') {
-            p++;
+        return tasks;
+    }
+
+    std::vector<pid_t> ListProcessChildren(pid_t pid, pid_t tid) noexcept {
+        std::stringstream ss;
+        ss << "/proc/" << pid << "/task/" << tid << "/children";
+
+        std::vector<pid_t> children;
+        std::stringstream content(ReadFileSafe(ss.str()));
+        pid_t child;
+        while (content >> child) {
+            children.push_back(child);
         }
-        *p = '\0';
-        return atoi(line);
+        return children;
     }
 
-    int MyHighestFd() noexcept {
-        const int buffSize = 512;
-        const int limit = buffSize - 1;
-        int size = 0, ret = 1;
-        char line[buffSize] = {0};
+    bool ReadFdInfo(pid_t pid, int fd, size_t& flags, size_t& pos) noexcept {
+        char buff[256];
+        snprintf(buff, sizeof(buff), "/proc/%d/fdinfo/%d", pid, fd);
 
-        // rlim_cur of the RLIMIT_NOFILE might be really huge
-        int fd = open("/proc/self/status", 0);
-        while (size < limit && ret > 0) {
-            while ((ret = read(fd, &line + size, limit - size)) < 0 && errno == EINTR) {
-            }
-            size += ret;
+        int infofd = open(buff, O_RDONLY | O_CLOEXEC);
+        if (infofd < 0) {
+            return false;
         }
-        close(fd);
+        ssize_t size;
+        while ((size = read(infofd, buff, sizeof(buff) - 1)) < 0 && errno == EINTR) {
+        }
+        close(infofd);
+        if (size <= 0) {
+            return false;
+        }
+        buff[size] = '\0';
+
+        // See `man 5 proc` format of the /proc/[pid]/fdinfo/[fd]: flags are octal
+        const char* posLine = strstr(buff, "pos:");
+        const char* flagsLine = strstr(buff, "flags:");
+        if (!posLine || !flagsLine) {
+            return false;
+        }
+        pos = strtoull(posLine + 4, nullptr, 10);
+        flags = strtoull(flagsLine + 6, nullptr, 8);
+        return true;
+    }
 
-        char* fdsize = strstr(line, "FDSize:");
-        assert(fdsize);
-        fd = parseLine(fdsize + 7);
+    std::vector<TMountInfo> ReadMountInfo(pid_t pid) noexcept {
+        std::stringstream ss;
+        ss << "/proc/" << pid << "/mountinfo";
+        std::ifstream file(ss.str());
 
-        while (fd >= 0) {
-            if (fcntl(fd, F_GETFD) >= 0)
-                break;
-            fd--;
+        std::vector<TMountInfo> mounts;
+        std::string line;
+        while (std::getline(file, line)) {
+            // ID PARENT MAJOR:MINOR ROOT MOUNTPOINT OPTIONS [OPTIONAL...] - FSTYPE SOURCE SUPEROPTIONS
+            std::stringstream fields(line);
+            std::string id, parent, root, mountPoint, field;
+            unsigned major, minor;
+            char colon;
+            if (!(fields >> id >> parent >> major >> colon >> minor >> root >> mountPoint)) {
+                continue;
+            }
+            while (fields >> field && field != "-") {
+            }
+
+            TMountInfo mount;
+            if (!(fields >> mount.FsType)) {
+                continue;
+            }
+            mount.Dev = makedev(major, minor);
+
+            // Spaces and other special characters are escaped as \ooo
+            for (size_t i = 0; i < mountPoint.size(); i++) {
+                if (mountPoint[i] == '\\' && i + 3 < mountPoint.size() && isdigit(mountPoint[i + 1])) {
+                    mount.MountPoint += (char)strtol(mountPoint.substr(i + 1, 3).c_str(), nullptr, 8);
+                    i += 3;
+                } else {
+                    mount.MountPoint += mountPoint[i];
+                }
+            }
+            mounts.push_back(mount);
         }
-        return fd;
+        return mounts;
     }
 
     bool KernelVerGreaterOrEqual(const char* ver) noexcept {
@@ -60,10 +120,33 @@ namespace NOPTrace {
         return strverscmp(un.release, ver) >= 0;
     }
 
-    bool IsFile(int fd) noexcept {
-        static thread_local struct stat st;
-        assert(fstat(fd, &st) >= 0);
-        return S_ISREG(st.st_mode);
+    std::vector<int> ListFds(int dirfd) noexcept {
+        // Kernel's struct linux_dirent64
+        struct TDirent64 {
+            uint64_t d_ino;
+            int64_t d_off;
+            unsigned short d_reclen;
+            unsigned char d_type;
+            char d_name[];
+        };
+
+        std::vector<int> fds;
+        alignas(TDirent64) char buff[16384];
+        long size;
+
+        while ((size = syscall(SYS_getdents64, dirfd, buff, sizeof(buff))) > 0) {
+            for (long pos = 0; pos < size;) {
+                auto entry = reinterpret_cast<TDirent64*>(buff + pos);
+                pos += entry->d_reclen;
+
+                // Skip "." and ".."
+                if (entry->d_name[0] < '0' || entry->d_name[0] > '9') {
+                    continue;
+                }
+                fds.push_back(atoi(entry->d_name));
+            }
+        }
+        return fds;
     }
 
     std::string ReadFileSafe(const std::string& filename, long limit) noexcept {
@@ -96,7 +179,7 @@ namespace NOPTrace {
     std::string GetBaseName(const std::string& filename) noexcept {
         auto pos = filename.rfind("/");
         if (pos == std::string::npos) {
-            return "";
+            return filename;
         }
         return std::string(filename.substr(pos + 1));
     }
@@ -110,6 +193,40 @@ namespace NOPTrace {
         }
     }
 
+    std::string JoinPath(const std::string& dirname, const std::string& filename) noexcept {
+        std::string path = filename;
+        if (filename.empty() || filename[0] != '/') {
+            path = dirname + "/" + filename;
+        }
+
+        // Lexically drop empty, "." and ".." components
+        std::string res;
+        size_t pos = 0;
+        while (pos < path.size()) {
+            size_t end = path.find('/', pos);
+            if (end == std::string::npos) {
+                end = path.size();
+            }
+            size_t len = end - pos;
+
+            if (len == 0 || (len == 1 && path[pos] == '.')) {
+                // skip
+            } else if (len == 2 && path[pos] == '.' && path[pos + 1] == '.') {
+                auto slash = res.rfind('/');
+                res.resize(slash == std::string::npos ? 0 : slash);
+            } else {
+                res += '/';
+                res.append(path, pos, len);
+            }
+            pos = end + 1;
+        }
+
+        if (res.empty()) {
+            return "/";
+        }
+        return res;
+    }
+
     size_t GetFileLength(const std::string& filename) noexcept {
         struct stat st;
         if (stat(filename.c_str(), &st) == 0) {
@@ -119,16 +236,29 @@ namespace NOPTrace {
         }
     }
 
-    std::string ReadLink(const std::string& filename) noexcept {
+    size_t GetFileAllocatedSize(const std::string& filename) noexcept {
+        struct stat st;
+        if (stat(filename.c_str(), &st) == 0) {
+            // st_blocks is always in 512-byte units
+            return st.st_blocks * 512;
+        } else {
+            return 0;
+        }
+    }
+
+    std::string ReadLinkSafe(const std::string& filename, int dirfd) noexcept {
         char buff[PATH_MAX];
-        ssize_t size = readlink(filename.c_str(), buff, sizeof(buff) - 1);
+        ssize_t size = readlinkat(dirfd, filename.c_str(), buff, sizeof(buff) - 1);
         if (size != -1) {
-            buff[size] = '\0';
-            return std::string(buff);
-        } else {
-            std::cerr << "Failed to readlink (" << filename.c_str() << "): " << strerror(errno) << std::endl;
-            exit(2);
+            return std::string(buff, size);
         }
+        return "";
+    }
+
+    std::string GetFdPath(pid_t pid, int fd) noexcept {
+        char buff[64];
+        int size = snprintf(buff, sizeof(buff), "/proc/%d/fd/%d", pid, fd);
+        return std::string(buff, size);
     }
 
     void StripString(std::string& str) noexcept {
@@ -183,4 +313,10 @@ namespace NOPTrace {
         }
         return buff;
     }
+
+    long long GetMonotonicTime() noexcept {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    }
 }
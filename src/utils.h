@@ -1,18 +1,36 @@
 #pragma once
 
 #include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/types.h>
 
 namespace NOPTrace {
-    bool IsFile(int fd) noexcept;
-    int MyHighestFd() noexcept;
+    struct TMountInfo {
+        dev_t Dev;
+        std::string MountPoint;
+        std::string FsType;
+    };
+
+    std::vector<int> ListFds(int dirfd) noexcept;
+    std::vector<pid_t> ListProcessTasks(pid_t pid) noexcept;
+    std::vector<pid_t> ListProcessChildren(pid_t pid, pid_t tid) noexcept;
+    bool ReadFdInfo(pid_t pid, int fd, size_t& flags, size_t& pos) noexcept;
+    std::vector<TMountInfo> ReadMountInfo(pid_t pid) noexcept;
     bool KernelVerGreaterOrEqual(const char* ver) noexcept;
     std::string ReadFileSafe(const std::string& filename, long limit=-1) noexcept;
     std::string GetDirName(const std::string& filename) noexcept;
     std::string GetBaseName(const std::string& filename) noexcept;
     std::string GetCwd() noexcept;
+    std::string JoinPath(const std::string& dirname, const std::string& filename) noexcept;
     size_t GetFileLength(const std::string& filename) noexcept;
-    std::string ReadLink(const std::string& filename) noexcept;
+    size_t GetFileAllocatedSize(const std::string& filename) noexcept;
+    std::string ReadLinkSafe(const std::string& filename, int dirfd=AT_FDCWD) noexcept;
+    std::string GetFdPath(pid_t pid, int fd) noexcept;
     std::string GetCommandLine(pid_t pid, long limit=-1) noexcept;
     std::string HumanReadableSize(size_t bytes) noexcept;
     void StripString(std::string &str) noexcept;
+    // CLOCK_MONOTONIC in nanoseconds
+    long long GetMonotonicTime() noexcept;
 }
@@ -0,0 +1,205 @@
+#include "test.h"
+
+#include "bpf_program.h"
+#include "syscall.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include <fcntl.h>
+#include <linux/audit.h>
+#include <linux/seccomp.h>
+#include <sys/mman.h>
+
+using namespace NOPTrace;
+
+namespace {
+    const unsigned NOT_RETURNED = ~0u;
+
+#if defined(__aarch64__)
+    const unsigned NATIVE_ARCH = AUDIT_ARCH_AARCH64;
+#else
+    const unsigned NATIVE_ARCH = AUDIT_ARCH_X86_64;
+#endif
+    const unsigned FOREIGN_ARCH = AUDIT_ARCH_I386;
+
+    // Interpreter of the instructions the compiler emits
+    unsigned RunProgram(const TBpfProgram& prog, const struct seccomp_data& data) {
+        uint32_t acc = 0;
+        size_t pc = 0;
+        while (pc < prog.size()) {
+            const struct sock_filter& insn = prog[pc++];
+            switch (insn.code) {
+                case BPF_LD | BPF_W | BPF_ABS:
+                    memcpy(&acc, (const char*)&data + insn.k, sizeof(acc));
+                    break;
+                case BPF_JMP | BPF_JA:
+                    pc += insn.k;
+                    break;
+                case BPF_JMP | BPF_JEQ | BPF_K:
+                    pc += acc == insn.k ? insn.jt : insn.jf;
+                    break;
+                case BPF_JMP | BPF_JGE | BPF_K:
+                    pc += acc >= insn.k ? insn.jt : insn.jf;
+                    break;
+                case BPF_JMP | BPF_JSET | BPF_K:
+                    pc += (acc & insn.k) ? insn.jt : insn.jf;
+                    break;
+                case BPF_RET | BPF_K:
+                    return insn.k;
+                default:
+                    return NOT_RETURNED;
+            }
+        }
+        return NOT_RETURNED;
+    }
+
+    // Verdict of the flat rule list
+    unsigned Expected(const std::vector<TSyscallRule>& rules, const struct seccomp_data& data) {
+        for (const auto& rule : rules) {
+            if (rule.Nr != (unsigned)data.nr) {
+                continue;
+            }
+            if (rule.RequiredArg >= 0 && !((unsigned)data.args[rule.RequiredArg] & rule.RequiredMask)) {
+                return SECCOMP_RET_ALLOW;
+            }
+            if (rule.Arg < 0 || (!rule.Mask && rule.Values.empty()) || rule.Values.size() > 250) {
+                return SECCOMP_RET_TRACE;
+            }
+            const unsigned low = data.args[rule.Arg];
+            bool match = (low & rule.Mask) != 0;
+            for (auto value : rule.Values) {
+                match |= low == value;
+            }
+            return match ? SECCOMP_RET_TRACE : SECCOMP_RET_ALLOW;
+        }
+        return SECCOMP_RET_ALLOW;
+    }
+
+    void CheckProgram(const std::vector<TSyscallRule>& rules, unsigned maxNr) {
+        const TBpfProgram prog = CompileBpfProgram(rules);
+        CHECK(!prog.empty());
+
+        std::vector<uint64_t> args = {0, 1, O_WRONLY, O_RDWR, O_RDONLY | O_CREAT, MAP_SHARED, MAP_PRIVATE,
+                                      F_DUPFD, F_DUPFD_CLOEXEC, F_GETFL, F_SETFL, F_SETFD, 0xffffffff00000000ull};
+        std::vector<uint64_t> required = {0, PROT_READ, PROT_WRITE, PROT_READ | PROT_WRITE};
+        for (const auto& rule : rules) {
+            args.push_back(rule.Mask);
+            args.insert(args.end(), rule.Values.begin(), rule.Values.end());
+            required.push_back(rule.RequiredMask);
+        }
+        for (auto* values : {&args, &required}) {
+            std::sort(values->begin(), values->end());
+            values->erase(std::unique(values->begin(), values->end()), values->end());
+        }
+
+        struct seccomp_data data;
+        memset(&data, 0, sizeof(data));
+        for (unsigned nr = 0; nr <= maxNr; nr++) {
+            data.nr = nr;
+            for (uint64_t arg : args) {
+                // The third argument is the required one of mmap, it's checked both equal to the rest and apart
+                required.push_back(arg);
+                for (uint64_t third : required) {
+                    for (auto& a : data.args) {
+                        a = arg;
+                    }
+                    data.args[2] = third;
+                    data.arch = NATIVE_ARCH;
+                    const unsigned verdict = RunProgram(prog, data);
+                    const unsigned expected = Expected(rules, data);
+                    if (verdict != expected) {
+                        std::cerr << "nr " << nr << " arg " << arg << " third " << third << ": "
+                                  << std::hex << verdict << " != " << expected << std::dec << std::endl;
+                    }
+                    CHECK_EQ(verdict, expected);
+
+                    // Syscalls of other arches are never traced
+                    data.arch = FOREIGN_ARCH;
+                    CHECK_EQ(RunProgram(prog, data), (unsigned)SECCOMP_RET_ALLOW);
+                }
+                required.pop_back();
+            }
+        }
+    }
+
+    unsigned RunMmap(const TBpfProgram& prog, uint64_t prot, uint64_t flags, uint64_t fd) {
+        struct seccomp_data data;
+        memset(&data, 0, sizeof(data));
+        data.arch = NATIVE_ARCH;
+        data.nr = SYS_mmap;
+        data.args[2] = prot;
+        data.args[3] = flags;
+        data.args[4] = fd;
+        return RunProgram(prog, data);
+    }
+
+    // Only shared writable mappings are trapped, anonymous ones are told apart by the tracer
+    void TestMmap() {
+        const TBpfProgram prog = CompileBpfProgram(GetTracingRules(false));
+        CHECK_EQ(RunMmap(prog, PROT_READ | PROT_WRITE, MAP_SHARED, 3), (unsigned)SECCOMP_RET_TRACE);
+        CHECK_EQ(RunMmap(prog, PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1), (unsigned)SECCOMP_RET_TRACE);
+        CHECK_EQ(RunMmap(prog, PROT_READ, MAP_SHARED, 3), (unsigned)SECCOMP_RET_ALLOW);
+        CHECK_EQ(RunMmap(prog, PROT_READ | PROT_EXEC, MAP_SHARED, 3), (unsigned)SECCOMP_RET_ALLOW);
+        CHECK_EQ(RunMmap(prog, PROT_READ | PROT_WRITE, MAP_PRIVATE, 3), (unsigned)SECCOMP_RET_ALLOW);
+        CHECK_EQ(RunMmap(prog, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1), (unsigned)SECCOMP_RET_ALLOW);
+    }
+
+    unsigned MaxSyscallNr() {
+        unsigned max = 0;
+        for (const auto& info : SyscallTable) {
+            max = std::max(max, info.Nr);
+        }
+        return max + 16;
+    }
+
+    // Subtrees longer than a conditional jump can skip
+    std::vector<TSyscallRule> LongRules() {
+        std::vector<TSyscallRule> rules;
+        for (unsigned nr = 0; nr < 400; nr += 2) {
+            TSyscallRule rule = {nr};
+            if (nr % 8 == 0) {
+                rule.Arg = 1;
+                rule.Mask = 0x100;
+                for (unsigned v = 0; v < 20; v++) {
+                    rule.Values.push_back(nr * 100 + v);
+                }
+            }
+            rules.push_back(rule);
+        }
+        return rules;
+    }
+}
+
+int main() {
+    // Tables of the arch the test is built for
+    CheckProgram(GetTracingRules(false), MaxSyscallNr());
+    CheckProgram(GetTracingRules(true), MaxSyscallNr());
+
+    CheckProgram(LongRules(), 420);
+    TestMmap();
+
+    // Required argument alone and along with a long argument check
+    CheckProgram({{3, -1, 0, {}, 1, 0x10}, {5, 0, 0x4, {7, 9}, 2, 0x2}}, 8);
+
+    // Too many values for 8-bit jumps, the syscall is traced unconditionally
+    TSyscallRule wide = {5, 0, 0, {}};
+    for (unsigned v = 0; v < 300; v++) {
+        wide.Values.push_back(v);
+    }
+    CheckProgram({wide}, 8);
+
+    // Longer than the kernel accepts
+    std::vector<TSyscallRule> huge;
+    for (unsigned nr = 0; nr < 200; nr++) {
+        TSyscallRule rule = {nr, 0, 0, {}};
+        for (unsigned v = 0; v < 30; v++) {
+            rule.Values.push_back(v);
+        }
+        huge.push_back(rule);
+    }
+    CHECK(CompileBpfProgram(huge).empty());
+
+    return NTest::Result("bpf_program");
+}
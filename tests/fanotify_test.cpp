@@ -0,0 +1,116 @@
+#include "test.h"
+
+#include "optrace.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mount.h>
+#include <unistd.h>
+
+using namespace NOPTrace;
+
+namespace {
+    const size_t OLD_SIZE = 1 << 20;
+
+    void Fill(int fd, size_t size) {
+        const std::string data(size, 'x');
+        CHECK_EQ(write(fd, data.data(), size), (ssize_t)size);
+    }
+
+    void CreateFile(const std::string& path, size_t size) {
+        const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        CHECK(fd >= 0);
+        Fill(fd, size);
+        close(fd);
+    }
+
+    // Runs in the tracee, the files are closed only by the exit
+    int WriteFiles(const std::string& dir) {
+        Fill(open((dir + "/trunc").c_str(), O_WRONLY | O_TRUNC), 100000);
+        Fill(open((dir + "/append").c_str(), O_WRONLY | O_APPEND), 5000);
+        Fill(open((dir + "/new").c_str(), O_WRONLY | O_CREAT, 0644), 3000);
+        _exit(NTest::Failures() ? 1 : 0);
+    }
+
+    size_t GetReported(const TReport& report, const std::string& path) {
+        for (const auto& file : report.Files) {
+            if (file.Filename == path) {
+                return file.Size;
+            }
+        }
+        return 0;
+    }
+
+    // Files existing before tracing are rewritten and appended by a tracee which closes none of them
+    void CheckWrites(const std::string& dir) {
+        CreateFile(dir + "/trunc", OLD_SIZE);
+        CreateFile(dir + "/append", OLD_SIZE);
+        // Files are older than the trace by their coarse timestamps
+        usleep(100000);
+
+        std::string exe = "/proc/self/exe";
+        std::string flag = "--write";
+        std::string arg = dir;
+        char* argv[] = {&exe[0], &flag[0], &arg[0], nullptr};
+
+        TOptions opts;
+        opts.Engine = EEngine::Fanotify;
+        TReport report;
+        CHECK_EQ(TraceProgram(argv, opts, {}, &report), 0);
+
+        CHECK_EQ(GetReported(report, dir + "/trunc"), 100000u);
+        CHECK_EQ(GetReported(report, dir + "/append"), 5000u);
+        CHECK_EQ(GetReported(report, dir + "/new"), 3000u);
+        CHECK_EQ(report.TotalOutput, 108000u);
+
+        for (const char* name : {"/trunc", "/append", "/new"}) {
+            unlink((dir + name).c_str());
+        }
+    }
+
+    void TestTmpfs() {
+        char dir[] = "/tmp/optrace-fanotify-XXXXXX";
+        CHECK(mkdtemp(dir));
+        if (mount("optrace-test", dir, "tmpfs", 0, "size=16m") != 0) {
+            std::cerr << "tmpfs can't be mounted: " << strerror(errno) << ", skipped" << std::endl;
+        } else {
+            CheckWrites(dir);
+            CHECK_EQ(umount(dir), 0);
+        }
+        rmdir(dir);
+    }
+
+    void TestLoop() {
+        char dir[] = "/tmp/optrace-fanotify-XXXXXX";
+        CHECK(mkdtemp(dir));
+        const std::string image = std::string(dir) + ".img";
+        const std::string mkfs = "truncate -s 32M " + image + " && mkfs.ext4 -q -F " + image + " >/dev/null 2>&1";
+        const std::string mountCmd = "mount -o loop " + image + " " + dir + " 2>/dev/null";
+        if (system(mkfs.c_str()) != 0 || system(mountCmd.c_str()) != 0) {
+            std::cerr << "Loop device can't be mounted, skipped" << std::endl;
+        } else {
+            CheckWrites(dir);
+            // The loop device is detached with the last unmount
+            CHECK_EQ(umount(dir), 0);
+        }
+        unlink(image.c_str());
+        rmdir(dir);
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc == 3 && !strcmp(argv[1], "--write")) {
+        return WriteFiles(argv[2]);
+    }
+    // fanotify and mounts require root
+    if (geteuid() != 0) {
+        std::cout << "fanotify: skipped, not root" << std::endl;
+        return 0;
+    }
+    TestTmpfs();
+    TestLoop();
+    return NTest::Result("fanotify");
+}
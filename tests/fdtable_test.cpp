@@ -0,0 +1,94 @@
+#include "test.h"
+
+#include "types.h"
+
+#include <cstdlib>
+#include <map>
+#include <vector>
+
+#include <fcntl.h>
+
+using namespace NOPTrace;
+
+namespace {
+    using TEntries = std::vector<std::pair<size_t, TFileState*>>;
+
+    TEntries Walk(TFdTable& table) {
+        TEntries entries;
+        table.ForEach([&entries](size_t fd, TFileStatePtr& file) {
+            entries.emplace_back(fd, file.get());
+        });
+        return entries;
+    }
+
+    // Random sets and erases against std::map, fds span both the inline part and the map
+    void TestRandom() {
+        TFdTable table;
+        std::map<size_t, TFileStatePtr> model;
+        srand(1);
+        for (int i = 0; i < 20000; i++) {
+            const size_t fd = rand() % 2 ? rand() % 70 : rand() % 100000;
+            if (rand() % 3) {
+                auto file = std::make_shared<TFileState>(O_WRONLY);
+                table.Set(fd, file);
+                model[fd] = file;
+            } else {
+                table.Erase(fd);
+                model.erase(fd);
+            }
+
+            TFileStatePtr* found = table.Find(fd);
+            CHECK_EQ(!!found, !!model.count(fd));
+            if (found) {
+                CHECK(*found == model[fd]);
+            }
+            CHECK(table.Get(fd) == (model.count(fd) ? model[fd].get() : nullptr));
+
+            if (i % 1000 == 0) {
+                TEntries expected;
+                for (const auto& it : model) {
+                    expected.emplace_back(it.first, it.second.get());
+                }
+                CHECK(Walk(table) == expected);
+            }
+        }
+    }
+
+    void TestReset() {
+        TFdTable table;
+        auto file = std::make_shared<TFileState>(O_WRONLY);
+        for (size_t fd : {0, 63, 64, 1000}) {
+            CHECK(table.Find(fd) == nullptr);
+            CHECK(table.Get(fd) == nullptr);
+            table.Set(fd, file);
+        }
+        CHECK_EQ(file.use_count(), 5);
+
+        // Setting nullptr erases the fd
+        table.Set(63, nullptr);
+        CHECK(table.Find(63) == nullptr);
+
+        // Files reset by ForEach are skipped afterwards and aren't found
+        table.ForEach([](size_t fd, TFileStatePtr& file) {
+            if (fd == 0 || fd == 1000) {
+                file.reset();
+            }
+        });
+        CHECK(table.Find(0) == nullptr);
+        CHECK(table.Find(1000) == nullptr);
+        CHECK(Walk(table) == TEntries({{64, file.get()}}));
+        CHECK_EQ(file.use_count(), 2);
+
+        table.Erase(64);
+        table.Erase(5);
+        table.Erase(12345);
+        CHECK(Walk(table).empty());
+        CHECK_EQ(file.use_count(), 1);
+    }
+}
+
+int main() {
+    TestRandom();
+    TestReset();
+    return NTest::Result("fdtable");
+}
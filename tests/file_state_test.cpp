@@ -0,0 +1,121 @@
+#include "test.h"
+
+#include "types.h"
+
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace NOPTrace;
+
+namespace {
+    const size_t PAGE = 4096;
+    const size_t TRUNCATED = 1ull << 30;
+
+    std::string MakeTempFile(int& fd) {
+        char name[] = "/tmp/optrace-file-state-XXXXXX";
+        fd = mkstemp(name);
+        CHECK(fd >= 0);
+        return name;
+    }
+
+    // The report of a truncated and partly touched mapping, as columnar writers produce
+    void TestTruncatedMapping() {
+        int fd;
+        const std::string name = MakeTempFile(fd);
+        TFileState file(name, O_RDWR);
+
+        CHECK_EQ(ftruncate(fd, TRUNCATED), 0);
+        file.EnrollResize(TRUNCATED);
+        // The length counts against the size limit but isn't output
+        CHECK_EQ(file.GetFileSize(), TRUNCATED);
+        CHECK_EQ(file.GetOutputSize(), 0u);
+
+        // The resize comes before the mapping
+        char* data = static_cast<char*>(mmap(nullptr, TRUNCATED, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+        CHECK(data != MAP_FAILED);
+        file.SetMapped();
+        for (size_t i = 0; i < 4; i++) {
+            data[i * PAGE * 16] = 'x';
+        }
+        CHECK_EQ(msync(data, TRUNCATED, MS_SYNC), 0);
+        munmap(data, TRUNCATED);
+
+        file.EnrollFileSize();
+        struct stat st;
+        CHECK_EQ(fstat(fd, &st), 0);
+        CHECK_EQ(file.GetOutputSize(), (size_t)st.st_blocks * 512);
+        CHECK(file.GetOutputSize() >= 4 * PAGE);
+        CHECK(file.GetOutputSize() < TRUNCATED / 16);
+
+        close(fd);
+        unlink(name.c_str());
+    }
+
+    // Writes after a resize are output, the resize itself is not
+    void TestResizeThenWrite() {
+        int fd;
+        const std::string name = MakeTempFile(fd);
+        TFileState file(name, O_WRONLY);
+
+        file.EnrollResize(TRUNCATED);
+        file.EnrollNoShift(100, 0);
+        CHECK_EQ(file.GetOutputSize(), 100u);
+        file.Enroll(PAGE);
+        CHECK_EQ(file.GetOutputSize(), PAGE);
+
+        // Copies share the resize
+        TFileState copy(file);
+        CHECK_EQ(copy.GetFileSize(), TRUNCATED);
+
+        close(fd);
+        unlink(name.c_str());
+    }
+
+    // Size delta files grown by a resize count only the allocated blocks
+    void TestSizeDelta() {
+        int fd;
+        const std::string name = MakeTempFile(fd);
+        TFileState file(name, O_WRONLY);
+        file.SetSizeDelta();
+
+        CHECK_EQ(ftruncate(fd, TRUNCATED), 0);
+        file.EnrollResize(TRUNCATED);
+        CHECK_EQ(pwrite(fd, "data", 4, 0), 4);
+        CHECK_EQ(fsync(fd), 0);
+
+        file.EnrollFileSize();
+        CHECK(file.GetOutputSize() >= 4);
+        CHECK(file.GetOutputSize() <= 64 * PAGE);
+
+        close(fd);
+        unlink(name.c_str());
+    }
+
+    // Plain writes into a sparse file are kept as enrolled
+    void TestSparseWrite() {
+        int fd;
+        const std::string name = MakeTempFile(fd);
+        TFileState file(name, O_WRONLY);
+        file.SetSizeDelta();
+
+        CHECK_EQ(pwrite(fd, "data", 4, TRUNCATED), 4);
+        file.EnrollNoShift(4, TRUNCATED);
+        file.EnrollFileSize();
+        CHECK_EQ(file.GetOutputSize(), TRUNCATED + 4);
+
+        close(fd);
+        unlink(name.c_str());
+    }
+}
+
+int main() {
+    TestTruncatedMapping();
+    TestResizeThenWrite();
+    TestSizeDelta();
+    TestSparseWrite();
+    return NTest::Result("file_state");
+}
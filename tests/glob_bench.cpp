@@ -0,0 +1,95 @@
+#include "glob.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <fnmatch.h>
+
+using namespace NOPTrace;
+
+namespace {
+    // Patterns of the kinds given to -i and -q: directories, suffixes, single chars and brackets
+    std::vector<std::string> MakePatterns(int count) {
+        std::vector<std::string> patterns;
+        for (int i = 0; patterns.size() < (size_t)count; i++) {
+            const std::string n = std::to_string(i);
+            switch (i % 5) {
+                case 0: patterns.push_back("/var/log/app" + n + "/*.log"); break;
+                case 1: patterns.push_back("/home/*/cache" + n + "/*"); break;
+                case 2: patterns.push_back("/tmp/build-" + n + "-??.o"); break;
+                case 3: patterns.push_back("*.tmp" + n); break;
+                case 4: patterns.push_back("/data/[a-f]" + n + "/*"); break;
+            }
+        }
+        return patterns;
+    }
+
+    std::vector<std::string> MakePaths(int count, int patterns) {
+        std::vector<std::string> paths;
+        srand(1);
+        for (int i = 0; i < count; i++) {
+            const std::string n = std::to_string(rand() % (patterns * 2));
+            switch (rand() % 6) {
+                case 0: paths.push_back("/var/log/app" + n + "/server.log"); break;
+                case 1: paths.push_back("/home/user/cache" + n + "/blob"); break;
+                case 2: paths.push_back("/tmp/build-" + n + "-ab.o"); break;
+                case 3: paths.push_back("/srv/spool/file.tmp" + n); break;
+                case 4: paths.push_back("/data/c" + n + "/part-00000"); break;
+                case 5: paths.push_back("/usr/lib/x86_64-linux-gnu/libfoo.so." + n); break;
+            }
+        }
+        return paths;
+    }
+
+    int FnmatchFirst(const std::vector<std::string>& patterns, const std::string& path) {
+        for (size_t i = 0; i < patterns.size(); i++) {
+            if (!fnmatch(patterns[i].c_str(), path.c_str(), FNM_NOESCAPE)) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    template <class TFunc>
+    double Measure(TFunc func) {
+        const auto start = std::chrono::steady_clock::now();
+        func();
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+}
+
+// Compares TGlobMatcher with the fnmatch loop it replaced on the same patterns and paths
+int main(int argc, char* argv[]) {
+    const int patternCount = argc > 1 ? atoi(argv[1]) : 203;
+    const int pathCount = argc > 2 ? atoi(argv[2]) : 10000;
+
+    const auto patterns = MakePatterns(patternCount);
+    const auto paths = MakePaths(pathCount, patternCount);
+
+    std::vector<int> expected(paths.size());
+    const double loop = Measure([&] {
+        for (size_t i = 0; i < paths.size(); i++) {
+            expected[i] = FnmatchFirst(patterns, paths[i]);
+        }
+    });
+
+    std::vector<int> found(paths.size());
+    const double compiled = Measure([&] {
+        TGlobMatcher matcher(patterns);
+        for (size_t i = 0; i < paths.size(); i++) {
+            found[i] = matcher.MatchFirst(paths[i]);
+        }
+    });
+
+    if (found != expected) {
+        std::cerr << "TGlobMatcher and fnmatch disagree" << std::endl;
+        return 1;
+    }
+
+    std::cout << patternCount << " patterns x " << pathCount << " paths: fnmatch loop " << loop
+              << " ms, TGlobMatcher " << compiled << " ms (including compilation)" << std::endl;
+    return 0;
+}
@@ -0,0 +1,148 @@
+#include "test.h"
+
+#include "glob.h"
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <fnmatch.h>
+
+using namespace NOPTrace;
+
+namespace {
+    std::vector<int> FnmatchAll(const std::vector<std::string>& patterns, const std::string& str) {
+        std::vector<int> found;
+        for (size_t i = 0; i < patterns.size(); i++) {
+            if (!fnmatch(patterns[i].c_str(), str.c_str(), FNM_NOESCAPE)) {
+                found.push_back(i);
+            }
+        }
+        return found;
+    }
+
+    std::string Join(const std::vector<int>& indexes) {
+        std::string str;
+        for (int i : indexes) {
+            str += std::to_string(i) + " ";
+        }
+        return str;
+    }
+
+    void CheckMatch(const TGlobMatcher& matcher, const std::vector<std::string>& patterns, const std::string& str) {
+        const std::vector<int> expected = FnmatchAll(patterns, str);
+        const std::vector<int> found = matcher.Match(str);
+        if (found != expected) {
+            std::cerr << "\"" << str << "\": " << Join(found) << "!= " << Join(expected) << std::endl;
+        }
+        CHECK(found == expected);
+        CHECK_EQ(matcher.MatchFirst(str), expected.empty() ? -1 : expected.front());
+    }
+
+    std::string RandomPattern() {
+        static const char* const PIECES[] = {"a", "b", "/", ".", "*", "?", "[ab]", "[!a]", "[a-c]", "[]a]", "[[:digit:]]", "1", "\\"};
+        std::string pattern;
+        for (int n = rand() % 6; n >= 0; n--) {
+            pattern += PIECES[rand() % (sizeof(PIECES) / sizeof(PIECES[0]))];
+        }
+        return pattern;
+    }
+
+    std::string RandomString() {
+        static const char CHARS[] = "ab/.1]\\";
+        std::string str;
+        for (int n = rand() % 8; n > 0; n--) {
+            str += CHARS[rand() % (sizeof(CHARS) - 1)];
+        }
+        return str;
+    }
+
+    // Random pattern sets against the fnmatch loop they replace
+    void TestRandom() {
+        srand(1);
+        for (int round = 0; round < 300; round++) {
+            std::vector<std::string> patterns;
+            for (int n = rand() % 8 + 1; n > 0; n--) {
+                patterns.push_back(RandomPattern());
+            }
+            TGlobMatcher matcher(patterns);
+            for (int i = 0; i < 100; i++) {
+                CheckMatch(matcher, patterns, RandomString());
+            }
+        }
+    }
+
+    void TestOrder() {
+        const std::vector<std::string> patterns = {"/var/log/*", "*.log", "/var/*/app.log", "/tmp/*"};
+        TGlobMatcher matcher(patterns);
+        CHECK(matcher.Match("/var/log/app.log") == std::vector<int>({0, 1, 2}));
+        CHECK_EQ(matcher.MatchFirst("/var/log/app.log"), 0);
+        CHECK_EQ(matcher.MatchFirst("/srv/app.log"), 1);
+        CHECK_EQ(matcher.MatchFirst("/srv/app.txt"), -1);
+        // '*' matches '/' as fnmatch without FNM_PATHNAME does
+        CHECK_EQ(matcher.MatchFirst("/tmp/a/b/c"), 3);
+    }
+
+    // Patterns the DFA can't express are matched by fnmatch in their place
+    void TestFallbacks() {
+        const std::vector<std::string> patterns = {"[[=a=]]*", "[ab", "*[[:nosuchclass:]]", "a*", "[[.a.]]"};
+        TGlobMatcher matcher(patterns);
+        for (const char* str : {"a", "abc", "[ab", "b", "x:", ""}) {
+            CheckMatch(matcher, patterns, str);
+        }
+    }
+
+    void TestEmpty() {
+        CHECK(TGlobMatcher({}).Empty());
+        CHECK_EQ(TGlobMatcher({}).MatchFirst("a"), -1);
+        CHECK(!TGlobMatcher({"*"}).Empty());
+        CHECK_EQ(TGlobMatcher({""}).MatchFirst(""), 0);
+        CHECK_EQ(TGlobMatcher({""}).MatchFirst("a"), -1);
+    }
+
+    // Enough distinct states to drop the DFA cache while matching
+    void TestLargeSet() {
+        std::vector<std::string> patterns;
+        for (int i = 0; i < 300; i++) {
+            patterns.push_back("*" + std::to_string(i) + "*/*" + std::to_string(i % 7) + "?");
+        }
+        TGlobMatcher matcher(patterns);
+        srand(2);
+        for (int i = 0; i < 2000; i++) {
+            std::string str = "/" + std::to_string(rand() % 400) + "/x" + std::to_string(rand() % 10) + "y";
+            CheckMatch(matcher, patterns, str);
+        }
+    }
+
+    // Literal prefixes nest, end with the string and are followed by stars needing backtracking
+    void TestPrefixes() {
+        const std::vector<std::string> patterns = {
+            "/var/log/*", "/var/log", "/var/lo?", "/var/log/app*.log", "/var/[l]og/x",
+            "/var/log/a*b*c", "/v", "/var/log/*/x", "*.log",
+        };
+        TGlobMatcher matcher(patterns);
+        for (const char* str : {"/var/log", "/var/log/", "/var/log/app1.log", "/var/log/abxbc", "/var/log/abcbx",
+                                "/var/log/x", "/v", "/var/lox", "/var/log/a/x", "/var/log/a/b/x", "", "/"}) {
+            CheckMatch(matcher, patterns, str);
+        }
+    }
+
+    void TestHighChars() {
+        const std::vector<std::string> patterns = {"/tmp/\xd1\x84*", "[\x80-\xff]*", "?\xff"};
+        TGlobMatcher matcher(patterns);
+        for (const char* str : {"/tmp/\xd1\x84.txt", "\xd1", "a\xff", "/tmp/f"}) {
+            CheckMatch(matcher, patterns, str);
+        }
+    }
+}
+
+int main() {
+    TestRandom();
+    TestOrder();
+    TestFallbacks();
+    TestEmpty();
+    TestLargeSet();
+    TestPrefixes();
+    TestHighChars();
+    return NTest::Result("glob");
+}
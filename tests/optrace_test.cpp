@@ -0,0 +1,83 @@
+#include "test.h"
+
+#include "optrace.h"
+
+#include <cstdlib>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace NOPTrace;
+
+namespace {
+    const size_t WRITTEN = 3000;
+
+    size_t GetReported(const TReport& report, const std::string& path) {
+        for (const auto& file : report.Files) {
+            if (file.Filename == path) {
+                return file.Size;
+            }
+        }
+        return 0;
+    }
+
+    pid_t ForkExiting(int code, useconds_t delay) {
+        const pid_t pid = fork();
+        if (pid == 0) {
+            usleep(delay);
+            _exit(code);
+        }
+        CHECK(pid > 0);
+        return pid;
+    }
+
+    // Children of the host exiting before and during the trace are left for the host to reap
+    void TestHostChildren() {
+        const pid_t zombie = ForkExiting(7, 0);
+        siginfo_t info;
+        CHECK_EQ(waitid(P_PID, zombie, &info, WEXITED | WNOWAIT), 0);
+        const pid_t exiting = ForkExiting(9, 100000);
+
+        std::string sh = "/bin/sh";
+        std::string flag = "-c";
+        std::string cmd = "sleep 0.3";
+        char* argv[] = {&sh[0], &flag[0], &cmd[0], nullptr};
+        TReport report;
+        CHECK_EQ(TraceProgram(argv, TOptions(), {}, &report), 0);
+
+        int status;
+        CHECK_EQ(waitpid(zombie, &status, WNOHANG), zombie);
+        CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 7);
+        CHECK_EQ(waitpid(exiting, &status, WNOHANG), exiting);
+        CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 9);
+    }
+
+    // Without argv the caller is forked, both processes return
+    void TestTraceSelf() {
+        char name[] = "/tmp/optrace-self-XXXXXX";
+        const int fd = mkstemp(name);
+        CHECK(fd >= 0);
+        close(fd);
+
+        const pid_t tracer = getpid();
+        TReport report;
+        const int rc = TraceProgram(nullptr, TOptions(), {}, &report);
+        if (getpid() != tracer) {
+            const int out = open(name, O_WRONLY);
+            const std::string data(WRITTEN, 'x');
+            _exit(out >= 0 && write(out, data.data(), data.size()) == (ssize_t)data.size() ? 0 : 1);
+        }
+
+        CHECK_EQ(rc, 0);
+        CHECK_EQ(GetReported(report, name), WRITTEN);
+        unlink(name);
+    }
+}
+
+int main() {
+    TestHostChildren();
+    TestTraceSelf();
+    return NTest::Result("optrace");
+}
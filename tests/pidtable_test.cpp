@@ -0,0 +1,119 @@
+#include "test.h"
+
+#include "pidtable.h"
+
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace NOPTrace;
+
+namespace {
+    using TEntries = std::vector<std::pair<pid_t, std::string>>;
+
+    void CheckSame(TPidTable<std::string>& table, const std::map<pid_t, std::string>& model) {
+        CHECK_EQ(table.GetSize(), model.size());
+        CHECK_EQ(table.Empty(), model.empty());
+
+        // Entries come in ascending pid order as the map has them
+        TEntries entries;
+        table.ForEach([&entries](pid_t pid, std::string& value) {
+            entries.emplace_back(pid, value);
+        });
+        CHECK(entries == TEntries(model.begin(), model.end()));
+    }
+
+    // Random inserts and erases against std::map, pids are spread over a few pages
+    void TestRandom() {
+        TPidTable<std::string> table;
+        std::map<pid_t, std::string> model;
+        srand(1);
+        for (int i = 0; i < 20000; i++) {
+            const pid_t pid = rand() % 4 * 100000 + rand() % 3000;
+            switch (rand() % 4) {
+                case 0: {
+                    auto inserted = table.Emplace(pid);
+                    CHECK_EQ(inserted.second, !model.count(pid));
+                    inserted.first = std::to_string(i);
+                    model[pid] = std::to_string(i);
+                    break;
+                }
+                case 1:
+                    table[pid] += "x";
+                    model[pid] += "x";
+                    break;
+                case 2:
+                case 3:
+                    table.Erase(pid);
+                    model.erase(pid);
+                    break;
+            }
+            const std::string* found = table.Find(pid);
+            CHECK_EQ(!!found, !!model.count(pid));
+            if (found) {
+                CHECK_EQ(*found, model[pid]);
+            }
+            if (i % 1000 == 0) {
+                CheckSame(table, model);
+            }
+        }
+        CheckSame(table, model);
+    }
+
+    void TestErase() {
+        TPidTable<std::string> table;
+        CHECK(table.Find(1) == nullptr);
+        CHECK(table.Find(1 << 22) == nullptr);
+        table.Erase(5);
+        CHECK(table.Empty());
+
+        // Erased entries come back default constructed, also when their page is freed in between
+        table[0] = "init";
+        table[1] = "a";
+        table.Erase(0);
+        table.Erase(1);
+        CHECK(table.Empty());
+        CHECK_EQ(table[1], std::string());
+        table[2] = "b";
+        table.Erase(1);
+        CHECK_EQ(table[1], std::string());
+
+        const TPidTable<std::string>& constTable = table;
+        CHECK_EQ(*constTable.Find(2), std::string("b"));
+    }
+
+    // The current entry may be erased by ForEach callback, as the tracer does with exited threads
+    void TestEraseInForEach() {
+        TPidTable<int> table;
+        for (pid_t pid = 0; pid < 5000; pid += 3) {
+            table[pid] = pid;
+        }
+        std::vector<pid_t> visited;
+        table.ForEach([&](pid_t pid, int& value) {
+            CHECK_EQ(value, pid);
+            visited.push_back(pid);
+            if (pid % 2) {
+                table.Erase(pid);
+            }
+        });
+        CHECK_EQ(visited.size(), 1667u);
+        // Pages emptied by the walk are freed and the rest is intact
+        for (pid_t pid = 0; pid < 5000; pid += 3) {
+            CHECK_EQ(!!table.Find(pid), pid % 2 == 0);
+        }
+        CHECK_EQ(table.GetSize(), 834u);
+
+        table.ForEach([&](pid_t pid, int&) {
+            table.Erase(pid);
+        });
+        CHECK(table.Empty());
+    }
+}
+
+int main() {
+    TestRandom();
+    TestErase();
+    TestEraseInForEach();
+    return NTest::Result("pidtable");
+}
@@ -0,0 +1,186 @@
+#include "test.h"
+
+#include "sink.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace NOPTrace;
+
+namespace {
+    void TestNumbers() {
+        const std::vector<std::pair<uint64_t, size_t>> values = {
+            {0, 1}, {1, 1}, {127, 1}, {128, 2}, {16383, 2}, {16384, 3},
+            {UINT32_MAX, 5}, {uint64_t(1) << 63, 10}, {UINT64_MAX, 10},
+        };
+        for (const auto& it : values) {
+            TSinkWriter writer(ESinkRecord::Totals);
+            writer.Put(it.first);
+            // Type byte and the varint
+            CHECK_EQ(writer.GetData().size(), 1 + it.second);
+
+            TSinkReader reader(writer.GetData().data(), writer.GetData().size());
+            ESinkRecord type;
+            uint64_t value;
+            CHECK(reader.Get(type));
+            CHECK(type == ESinkRecord::Totals);
+            CHECK(reader.Get(value));
+            CHECK_EQ(value, it.first);
+            CHECK(!reader.Get(value));
+        }
+    }
+
+    void TestStrings() {
+        const std::string binary("a\0b\xff", 4);
+        const std::string longString(300, 'x');
+        TSinkWriter writer(ESinkRecord::Session);
+        writer.Put(std::string());
+        writer.Put(binary);
+        writer.Put(longString);
+
+        TSinkReader reader(writer.GetData().data(), writer.GetData().size());
+        ESinkRecord type;
+        std::string value;
+        CHECK(reader.Get(type));
+        CHECK(reader.Get(value));
+        CHECK(value.empty());
+        CHECK(reader.Get(value));
+        CHECK(value == binary);
+        CHECK(reader.Get(value));
+        CHECK(value == longString);
+        CHECK(!reader.Get(value));
+    }
+
+    // Corrupted records are rejected instead of being read past their end
+    void TestMalformed() {
+        const std::string unterminated(11, '\x80');
+        TSinkReader reader(unterminated.data(), unterminated.size());
+        uint64_t value;
+        CHECK(!reader.Get(value));
+
+        TSinkWriter writer(ESinkRecord::File);
+        writer.Put(1000);
+        const std::string overlong = writer.GetData().substr(1) + "short";
+        TSinkReader stringReader(overlong.data(), overlong.size());
+        std::string str;
+        CHECK(!stringReader.Get(str));
+
+        TSinkReader empty(nullptr, 0);
+        ESinkRecord type;
+        CHECK(!empty.Get(type));
+    }
+
+    void TestReportFile() {
+        TReportFile file;
+        file.Filename = "/var/log/app.log";
+        file.Size = 5ull << 32;
+        file.Estimated = true;
+        file.Pid = 4194303;
+        file.Ppid = 1;
+        file.CommandLine = "app --flag";
+        file.Cgroup = "/system.slice/app.service";
+        file.MountPoint = "/";
+
+        TSinkWriter writer(ESinkRecord::File);
+        PutReportFile(writer, file);
+        const std::string& data = writer.GetData();
+
+        TSinkReader reader(data.data(), data.size());
+        ESinkRecord type;
+        TReportFile read;
+        CHECK(reader.Get(type));
+        CHECK(type == ESinkRecord::File);
+        CHECK(GetReportFile(reader, read));
+        CHECK_EQ(read.Filename, file.Filename);
+        CHECK_EQ(read.Size, file.Size);
+        CHECK_EQ(read.Estimated, file.Estimated);
+        CHECK_EQ(read.Pid, file.Pid);
+        CHECK_EQ(read.Ppid, file.Ppid);
+        CHECK_EQ(read.CommandLine, file.CommandLine);
+        CHECK_EQ(read.Cgroup, file.Cgroup);
+        CHECK_EQ(read.MountPoint, file.MountPoint);
+
+        // Every truncated record fails
+        for (size_t len = 1; len < data.size(); len++) {
+            TSinkReader truncated(data.data(), len);
+            CHECK(truncated.Get(type));
+            CHECK(!GetReportFile(truncated, read));
+        }
+    }
+
+    void TestAddress() {
+        struct sockaddr_un addr;
+        socklen_t len;
+        CHECK(ParseSinkAddress("unix:/run/optrace.sock", addr, len));
+        CHECK_EQ(addr.sun_family, AF_UNIX);
+        CHECK_EQ(std::string(addr.sun_path), std::string("/run/optrace.sock"));
+        CHECK_EQ(len, offsetof(struct sockaddr_un, sun_path) + sizeof("/run/optrace.sock"));
+
+        // Abstract names have no trailing NUL
+        CHECK(ParseSinkAddress("unix:@optrace", addr, len));
+        CHECK_EQ(addr.sun_path[0], '\0');
+        CHECK_EQ(std::string(addr.sun_path + 1, 7), std::string("optrace"));
+        CHECK_EQ(len, offsetof(struct sockaddr_un, sun_path) + 8);
+
+        CHECK(!ParseSinkAddress("tcp:localhost:1234", addr, len));
+        CHECK(!ParseSinkAddress("unix:", addr, len));
+        CHECK(!ParseSinkAddress("/run/optrace.sock", addr, len));
+        CHECK(!ParseSinkAddress("unix:/" + std::string(sizeof(addr.sun_path), 'x'), addr, len));
+    }
+
+    // A session announces itself to a listening collector and falls back when there is none
+    void TestSession() {
+        const std::string address = "unix:@optrace-sink-test-" + std::to_string(getpid());
+        CHECK(!TSink(address).IsConnected());
+
+        struct sockaddr_un addr;
+        socklen_t len;
+        CHECK(ParseSinkAddress(address, addr, len));
+        const int listener = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+        CHECK(listener >= 0);
+        CHECK_EQ(bind(listener, (struct sockaddr*)&addr, len), 0);
+        CHECK_EQ(listen(listener, 1), 0);
+
+        TSink sink(address);
+        CHECK(sink.IsConnected());
+        const int conn = accept(listener, nullptr, nullptr);
+        CHECK(conn >= 0);
+
+        char buf[4096];
+        ssize_t size = recv(conn, buf, sizeof(buf), 0);
+        TSinkReader session(buf, size > 0 ? size : 0);
+        ESinkRecord type;
+        uint64_t pid;
+        std::string cmd;
+        CHECK(session.Get(type) && type == ESinkRecord::Session);
+        CHECK(session.Get(pid) && pid == (uint64_t)getpid());
+        CHECK(session.Get(cmd));
+
+        // Records keep their boundaries
+        TSinkWriter totals(ESinkRecord::Totals);
+        totals.Put(12345);
+        sink.Send(totals);
+        sink.Send(totals);
+        CHECK_EQ(recv(conn, buf, sizeof(buf), 0), (ssize_t)totals.GetData().size());
+        CHECK_EQ(recv(conn, buf, sizeof(buf), 0), (ssize_t)totals.GetData().size());
+        CHECK(sink.IsConnected());
+
+        close(conn);
+        close(listener);
+    }
+}
+
+int main() {
+    TestNumbers();
+    TestStrings();
+    TestMalformed();
+    TestReportFile();
+    TestAddress();
+    TestSession();
+    return NTest::Result("sink");
+}
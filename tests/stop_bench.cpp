@@ -0,0 +1,125 @@
+#include "optrace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace NOPTrace;
+
+namespace {
+    struct TConfig {
+        std::string Name;
+        bool Traced;
+        TOptions Opts;
+    };
+
+    // Every write is a seccomp stop and a syscall-exit-stop, so its time is the round trip of two stops
+    double WriteLoop(int writes) {
+        const int fd = open("/dev/null", O_WRONLY);
+        const auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < writes; i++) {
+            if (write(fd, "x", 1) != 1) {
+                return -1;
+            }
+        }
+        const auto end = std::chrono::steady_clock::now();
+        close(fd);
+        return std::chrono::duration<double, std::micro>(end - start).count() / writes;
+    }
+
+    // Runs in a forked child, so the scheduling set up for the tracer doesn't leak into the next runs.
+    // Returns us per write, negative if the trace can't be set up.
+    double Run(const TConfig& config, int writes) {
+        int fds[2];
+        if (pipe(fds) < 0) {
+            return -1;
+        }
+        const pid_t runner = fork();
+        if (runner == 0) {
+            close(fds[0]);
+            const pid_t tracer = getpid();
+            TReport report;
+            const int rc = config.Traced ? TraceProgram(nullptr, config.Opts, {}, &report) : 0;
+            if (!config.Traced || getpid() != tracer) {
+                const double us = WriteLoop(writes);
+                _exit(write(fds[1], &us, sizeof(us)) == sizeof(us) ? 0 : 1);
+            }
+            _exit(rc);
+        }
+        close(fds[1]);
+        double us = -1;
+        if (runner < 0 || read(fds[0], &us, sizeof(us)) != sizeof(us)) {
+            us = -1;
+        }
+        close(fds[0]);
+        int status;
+        waitpid(runner, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            us = -1;
+        }
+        return us;
+    }
+}
+
+// Stop round trip of a tracee making 1-byte writes with the tracer scheduling options (-P, -R, -B) and without them
+int main(int argc, char* argv[]) {
+    const int writes = argc > 1 ? atoi(argv[1]) : 20000;
+    const int runs = argc > 2 ? atoi(argv[2]) : 5;
+
+    cpu_set_t allowed;
+    const int cpus = !sched_getaffinity(0, sizeof(allowed), &allowed) ? CPU_COUNT(&allowed) : 1;
+    // The tracer is pinned to the last allowed CPU, away from the tracee if there are others
+    int lastCpu = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed)) {
+            lastCpu = cpu;
+        }
+    }
+
+    std::vector<TConfig> configs;
+    configs.push_back({"untraced", false, TOptions()});
+    configs.push_back({"traced", true, TOptions()});
+    configs.push_back({"-P " + std::to_string(lastCpu), true, TOptions()});
+    configs.back().Opts.TracerCpu = lastCpu;
+    configs.push_back({"-R", true, TOptions()});
+    configs.back().Opts.TracerFifo = true;
+    configs.push_back({"-B 50", true, TOptions()});
+    configs.back().Opts.BusyWaitUs = 50;
+    configs.push_back({"-P " + std::to_string(lastCpu) + " -R -B 50", true, TOptions()});
+    configs.back().Opts.TracerCpu = lastCpu;
+    configs.back().Opts.TracerFifo = true;
+    configs.back().Opts.BusyWaitUs = 50;
+
+    std::cout << writes << " 1-byte writes, " << runs << " runs, " << cpus << " CPU(s) allowed";
+    if (cpus < 2) {
+        std::cout << ", the -B poll is off";
+    }
+    std::cout << std::endl << "us per write (min / median):" << std::endl;
+
+    for (const auto& config : configs) {
+        std::vector<double> times;
+        for (int i = 0; i < runs; i++) {
+            const double us = Run(config, writes);
+            if (us >= 0) {
+                times.push_back(us);
+            }
+        }
+        std::cout << "  " << std::left << std::setw(20) << config.Name;
+        if (times.empty()) {
+            std::cout << "can't be set up" << std::endl;
+            continue;
+        }
+        std::sort(times.begin(), times.end());
+        std::cout << std::fixed << std::setprecision(2) << times.front() << " / " << times[times.size() / 2] << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <iostream>
+
+// Minimal checks for the tests: a failed check is printed and the test keeps going,
+// the binary exits with 1 if any check has failed.
+namespace NTest {
+    inline int& Failures() {
+        static int failures = 0;
+        return failures;
+    }
+
+    inline int Result(const char* name) {
+        std::cout << name << ": " << (Failures() ? "FAILED" : "OK") << std::endl;
+        return Failures() ? 1 : 0;
+    }
+}
+
+#define CHECK(COND) \
+    do { \
+        if (!(COND)) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #COND << std::endl; \
+            NTest::Failures()++; \
+        } \
+    } while (0)
+
+#define CHECK_EQ(A, B) \
+    do { \
+        const auto& a_ = (A); \
+        const auto& b_ = (B); \
+        if (!(a_ == b_)) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #A " == " #B " (" << a_ << " != " << b_ << ")" << std::endl; \
+            NTest::Failures()++; \
+        } \
+    } while (0)
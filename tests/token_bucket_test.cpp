@@ -0,0 +1,72 @@
+#include "test.h"
+
+#include "types.h"
+#include "utils.h"
+
+#include <cstdlib>
+
+using namespace NOPTrace;
+
+namespace {
+    const long long MS = 1000000;
+
+    // Delays are computed from the construction time, which the test can only read right after it
+    bool Near(long long delay, long long expected) {
+        if (llabs(delay - expected) > MS / 10) {
+            std::cerr << "delay " << delay << " != " << expected << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    void TestBurst() {
+        // A full bucket holds 100ms of the rate
+        TTokenBucket bucket(1000);
+        const long long start = GetMonotonicTime();
+        CHECK_EQ(bucket.Charge(100, start), 0);
+        CHECK(Near(bucket.Charge(50, start), 50 * MS));
+        // Debt grows with every write until it's paid off
+        CHECK(Near(bucket.Charge(50, start), 100 * MS));
+        CHECK(Near(bucket.Charge(0, start + 60 * MS), 40 * MS));
+        CHECK_EQ(bucket.Charge(0, start + 100 * MS), 0);
+    }
+
+    void TestRefillCap() {
+        TTokenBucket bucket(1000);
+        const long long start = GetMonotonicTime();
+        // Idle time doesn't save up more than the burst
+        CHECK_EQ(bucket.Charge(100, start + 10000 * MS), 0);
+        CHECK(Near(bucket.Charge(1, start + 10000 * MS), MS));
+    }
+
+    void TestLargeWrite() {
+        TTokenBucket bucket(1 << 20);
+        const long long start = GetMonotonicTime();
+        // A write larger than the burst is let through and paid off afterwards
+        CHECK(Near(bucket.Charge(1 << 20, start), 900 * MS));
+    }
+
+    // A writer which waits out every delay gets the rate over time
+    void TestSustainedRate() {
+        const size_t rate = 64 << 10;
+        TTokenBucket bucket(rate);
+        long long now = GetMonotonicTime();
+        const long long start = now;
+        size_t written = 0;
+        while (written < 10 * rate) {
+            now += bucket.Charge(4096, now);
+            written += 4096;
+        }
+        // The first burst is free, the rest is paid at the rate
+        const double expected = (written - rate / 10.0) / rate * 1e9;
+        CHECK(llabs(now - start - (long long)expected) < 10 * MS);
+    }
+}
+
+int main() {
+    TestBurst();
+    TestRefillCap();
+    TestLargeWrite();
+    TestSustainedRate();
+    return NTest::Result("token_bucket");
+}